@@ -12,10 +12,16 @@
 #include <czmq_prelude.h>
 #include <zsock.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <math.h>
+#include <sched.h>
+#include <time.h>
 #include <uuid/uuid.h>
 
 #define RAYGUI_IMPLEMENTATION
 #include "raygui.h"
+#include "protocol.h"
 
 // CONSTANT PROGRAM VARIABLES
 // ---------------------------
@@ -35,9 +41,53 @@ const int BOARD_Y = SCREEN_HEIGHT / 2 - BOARD_WIDTH / 2;
 uuid_t binuuid;
 char uuid[37];
 pthread_t sub_thread_id;
+// the network thread, the only one using the requester once the board is fetched
 pthread_t req_thread_id;
 zsock_t *subscriber;
+// DEALER socket, binary commands do not wait for their ack so many of them can be in flight
 zsock_t *requester;
+// cleared once the server answers a binary fetch with anything but a snapshot
+bool server_sends_snapshots = true;
+// identifies us in binary command frames, the session id the server gave us (see protocol.h) or the
+// first 4 bytes of the uuid if it has no sessions. the network thread replaces it after a reconnect
+atomic_uint client_id;
+// sequence number of the last command we sent, commands are numbered on the render and network threads
+atomic_uint command_seq = 0;
+// commands sent whose ack has not arrived yet
+uint32_t commands_in_flight = 0;
+// set by --latency, milliseconds the network thread holds every command before sending it
+double injected_latency_ms = 0;
+// set by --batch-ms, milliseconds painted tiles are collected into one batch before it is sent,
+// 0 sends the tiles of every frame as their own batch
+double batch_window_ms = 50;
+// messages the network thread sent and the tiles in them, printed on exit
+uint64_t messages_sent = 0;
+uint64_t tiles_sent = 0;
+// cleared when the window closes to stop the network thread
+atomic_bool network_running = true;
+// set by --text, send "client_id\ncommand\nargs" strings for servers from before the binary protocol
+bool text_protocol = false;
+// set by --board, the board to join (see BOARD NAMES in protocol.h), "" for the default board
+const char *board_name = "";
+// the topics of the board (see TOPICS in protocol.h): everything it publishes about its regions and its
+// resizes and ticks. text servers publish without topics, then the first is ""
+char all_regions_topic[TOPIC_MAX];
+char global_topic[TOPIC_MAX];
+// board seq (see protocol.h) the board is at, only known after a binary snapshot, lets a resync
+// fetch just the commands we missed. written by the render thread, read by the network thread
+atomic_uint board_seq = 0;
+atomic_bool board_seq_known = false;
+// set by the subscriber thread when the subscriber reconnects, the main loop then resyncs the board
+atomic_bool resync_requested = false;
+// set by the subscriber thread when it notices published commands were lost, the main loop then fetches
+// the commands since gap_since, the board seq before the first lost one
+atomic_bool gap_resync_requested = false;
+atomic_uint gap_since = 0;
+// gaps in the publish stream, the board seqs of the ticks skipped entirely and the region batches lost
+// from ticks that did arrive, printed on exit and shown next to the FPS
+atomic_uint stream_gaps = 0;
+atomic_uint stream_seqs_missed = 0;
+atomic_uint stream_batches_missed = 0;
 
 // CUSTOM TYPEDEFS
 // ----------------
@@ -58,72 +108,421 @@ Color getColor(ColorIndex idx)
     return tileColors[idx];
 }
 
+// Tool
+// what dragging or clicking on the board paints. the pencil paints the tiles under the cursor, or
+// stamps circles of brush_radius, rect, line and circle paint the shape dragged out and the flood
+// fills fill the area of the clicked color
+typedef enum
+{
+    TOOL_PENCIL,
+    TOOL_RECT,
+    TOOL_LINE,
+    TOOL_CIRCLE,
+    TOOL_FLOOD_4,
+    TOOL_FLOOD_8,
+} Tool;
+
+#define TOOL_COUNT 6
+const char *tool_names[TOOL_COUNT] = {"pencil", "rect", "line", "circle", "flood 4", "flood 8"};
+
+// ChunkKey
+// chunk coordinates, chunk (cx, cy) holds columns cx * CHUNK_SIZE.. and rows cy * CHUNK_SIZE..
 typedef struct
 {
-    ColorIndex color_num;
-    Rectangle rect;
-} Tile;
+    int cx;
+    int cy;
+} ChunkKey;
+
+// DirtyRows
+// rows row0..row1 of a chunk changed since its texture was last updated, none when row0 > row1
+typedef struct
+{
+    int row0;
+    int row1;
+} DirtyRows;
 
+// TileBoard
+// the tiles are stored in square chunks of CHUNK_SIZE x CHUNK_SIZE tiles (see protocol.h) that are only allocated once a tile in them
+// is painted, tiles of unallocated chunks are BLACK_NUM
 typedef struct
 {
     // board width
     int columns;
     // board height
     int rows;
-    // 2d array of tiles
-    Tile **tiles;
+    // chunk pool, chunk i owns the one byte ColorIndex of its tiles in chunk_colors[i * CHUNK_AREA] (row-major)
+    // and is located at chunk_keys[i]. where a tile is drawn follows from its row and column
+    int chunk_count;
+    int chunk_capacity;
+    uint8_t *chunk_colors;
+    ChunkKey *chunk_keys;
+    // chunk directory, open addressing hash table of chunk index + 1, 0 marks an empty slot
+    int directory_capacity;
+    int *directory;
+    // pool index of the chunk found by the last lookup, neighboring tiles usually share a chunk
+    int last_chunk_idx;
+    // chunk images, chunk i is drawn as chunk_textures[i] with one pixel per tile scaled up to TILE_SIZE.
+    // the pixels are kept in chunk_pixels[i * CHUNK_AREA] and only the rows in chunk_dirty[i] are
+    // refreshed and uploaded again. a texture stays with its pool slot since every chunk has the same size
+    Color *chunk_pixels;
+    Texture2D *chunk_textures;
+    DirtyRows *chunk_dirty;
 } TileBoard;
 
 // freeTiles
 void freeTiles(TileBoard *board)
 {
-    for (int i = 0; i < board->rows; i++)
+    for (int i = 0; i < board->chunk_capacity; i++)
+    {
+        if (board->chunk_textures[i].id != 0)
+        {
+            UnloadTexture(board->chunk_textures[i]);
+        }
+    }
+    free(board->chunk_colors);
+    free(board->chunk_keys);
+    free(board->chunk_pixels);
+    free(board->chunk_textures);
+    free(board->chunk_dirty);
+    free(board->directory);
+    board->chunk_colors = NULL;
+    board->chunk_keys = NULL;
+    board->chunk_pixels = NULL;
+    board->chunk_textures = NULL;
+    board->chunk_dirty = NULL;
+    board->directory = NULL;
+    board->chunk_count = 0;
+}
+
+// getTileRectangle
+// the world rectangle a tile is drawn in
+Rectangle getTileRectangle(int row_idx, int col_idx)
+{
+    return (Rectangle){BOARD_X + TILE_SIZE * col_idx, BOARD_Y + TILE_SIZE * row_idx, TILE_SIZE, TILE_SIZE};
+}
+
+// hashChunkKey
+// spread the chunk coordinates over the directory, capacity must be a power of two
+uint32_t hashChunkKey(int cx, int cy, int capacity)
+{
+    uint64_t key = ((uint64_t)(uint32_t)cx << 32) | (uint32_t)cy;
+    key *= 0x9E3779B97F4A7C15ull;
+    return (uint32_t)(key >> 32) & (capacity - 1);
+}
+
+// rebuildChunkDirectory
+// reinsert every chunk of the pool into a directory of the given capacity
+void rebuildChunkDirectory(TileBoard *board, int capacity)
+{
+    int *directory = (int *)calloc(capacity, sizeof(int));
+    if (directory == NULL)
+    {
+        fprintf(stderr, "error allocating chunk directory\n");
+        exit(1);
+    }
+    for (int i = 0; i < board->chunk_count; i++)
+    {
+        uint32_t slot = hashChunkKey(board->chunk_keys[i].cx, board->chunk_keys[i].cy, capacity);
+        while (directory[slot] != 0)
+        {
+            slot = (slot + 1) & (capacity - 1);
+        }
+        directory[slot] = i + 1;
+    }
+    free(board->directory);
+    board->directory = directory;
+    board->directory_capacity = capacity;
+}
+
+// findChunk
+// returns the pool index of chunk (cx, cy) or -1 when nothing in it was painted yet
+int findChunk(TileBoard *board, int cx, int cy)
+{
+    if (board->last_chunk_idx < board->chunk_count && board->chunk_keys[board->last_chunk_idx].cx == cx &&
+        board->chunk_keys[board->last_chunk_idx].cy == cy)
+    {
+        return board->last_chunk_idx;
+    }
+    uint32_t slot = hashChunkKey(cx, cy, board->directory_capacity);
+    while (board->directory[slot] != 0)
     {
-        free(board->tiles[i]);
+        int chunk_idx = board->directory[slot] - 1;
+        if (board->chunk_keys[chunk_idx].cx == cx && board->chunk_keys[chunk_idx].cy == cy)
+        {
+            board->last_chunk_idx = chunk_idx;
+            return chunk_idx;
+        }
+        slot = (slot + 1) & (board->directory_capacity - 1);
     }
-    free(board->tiles);
+    return -1;
+}
+
+// getChunkColors
+// returns the row-major tile colors of a chunk in the pool
+uint8_t *getChunkColors(TileBoard *board, int chunk_idx)
+{
+    return &board->chunk_colors[(size_t)chunk_idx * CHUNK_AREA];
+}
+
+// markChunkDirty
+// the tiles of rows row0..row1 of a chunk changed, its texture is updated the next time it is drawn
+void markChunkDirty(TileBoard *board, int chunk_idx, int row0, int row1)
+{
+    DirtyRows *dirty = &board->chunk_dirty[chunk_idx];
+    dirty->row0 = row0 < dirty->row0 ? row0 : dirty->row0;
+    dirty->row1 = row1 > dirty->row1 ? row1 : dirty->row1;
 }
 
-// initTileRectangle
-// call to init a raylib rectangle for each tile to help with rendering and collision detection
-// prevents creating this struct ad hoc every frame by keeping it in the TileBoard struct
-void initTileRectangle(Rectangle *rec, int row_idx, int col_idx)
+// createChunk
+// appends a chunk of BLACK_NUM tiles to the pool and registers it in the directory
+int createChunk(TileBoard *board, int cx, int cy)
 {
-    rec->height = TILE_SIZE;
-    rec->width = TILE_SIZE;
-    rec->x = BOARD_X + TILE_SIZE * col_idx;
-    rec->y = BOARD_Y + TILE_SIZE * row_idx;
-};
+    if (board->chunk_count == board->chunk_capacity)
+    {
+        int new_capacity = board->chunk_capacity * 2;
+        uint8_t *colors_realloc = (uint8_t *)realloc(board->chunk_colors, (size_t)new_capacity * CHUNK_AREA);
+        ChunkKey *keys_realloc = (ChunkKey *)realloc(board->chunk_keys, new_capacity * sizeof(ChunkKey));
+        Color *pixels_realloc = (Color *)realloc(board->chunk_pixels, (size_t)new_capacity * CHUNK_AREA * sizeof(Color));
+        Texture2D *textures_realloc = (Texture2D *)realloc(board->chunk_textures, new_capacity * sizeof(Texture2D));
+        DirtyRows *dirty_realloc = (DirtyRows *)realloc(board->chunk_dirty, new_capacity * sizeof(DirtyRows));
+        if (colors_realloc == NULL || keys_realloc == NULL || pixels_realloc == NULL || textures_realloc == NULL ||
+            dirty_realloc == NULL)
+        {
+            fprintf(stderr, "error realloc chunk pool\n");
+            exit(1);
+        }
+        board->chunk_colors = colors_realloc;
+        board->chunk_keys = keys_realloc;
+        board->chunk_pixels = pixels_realloc;
+        board->chunk_textures = textures_realloc;
+        board->chunk_dirty = dirty_realloc;
+        memset(&board->chunk_textures[board->chunk_capacity], 0,
+               (new_capacity - board->chunk_capacity) * sizeof(Texture2D));
+        board->chunk_capacity = new_capacity;
+    }
+    int chunk_idx = board->chunk_count++;
+    board->chunk_keys[chunk_idx].cx = cx;
+    board->chunk_keys[chunk_idx].cy = cy;
+    memset(getChunkColors(board, chunk_idx), BLACK_NUM, CHUNK_AREA);
+    // the slot may still hold the image of a dropped chunk
+    board->chunk_dirty[chunk_idx] = (DirtyRows){0, CHUNK_SIZE - 1};
+
+    // keep the directory at most half full so probe sequences stay short
+    if (board->chunk_count * 2 > board->directory_capacity)
+    {
+        rebuildChunkDirectory(board, board->directory_capacity * 2);
+    }
+    else
+    {
+        uint32_t slot = hashChunkKey(cx, cy, board->directory_capacity);
+        while (board->directory[slot] != 0)
+        {
+            slot = (slot + 1) & (board->directory_capacity - 1);
+        }
+        board->directory[slot] = chunk_idx + 1;
+    }
+    return chunk_idx;
+}
 
-// getBoardTile
-// a way to access tiles from the TileBoard that checks for out of bounds issues
-Tile *getBoardTile(TileBoard *board, int row_idx, int col_idx)
+// checkBoardBounds
+// exits when a tile coordinate is outside of the board
+void checkBoardBounds(TileBoard *board, int row_idx, int col_idx)
 {
-    if (row_idx > board->rows)
+    if (row_idx < 0 || row_idx >= board->rows)
     {
         fprintf(stderr, "out of bounds access board rows\n");
         exit(1);
     }
-    if (col_idx > board->columns)
+    if (col_idx < 0 || col_idx >= board->columns)
     {
         fprintf(stderr, "out of bounds access board columns\n");
         exit(1);
     }
-    return &board->tiles[row_idx][col_idx];
+}
+
+// getTileColor
+// read a tile color without allocating its chunk
+ColorIndex getTileColor(TileBoard *board, int row_idx, int col_idx)
+{
+    checkBoardBounds(board, row_idx, col_idx);
+    int chunk_idx = findChunk(board, col_idx >> CHUNK_SHIFT, row_idx >> CHUNK_SHIFT);
+    if (chunk_idx < 0)
+    {
+        return BLACK_NUM;
+    }
+    return getChunkColors(board, chunk_idx)[(row_idx & (CHUNK_SIZE - 1)) * CHUNK_SIZE + (col_idx & (CHUNK_SIZE - 1))];
+}
+
+// getTileChunk
+// the pool index of the chunk of a tile, checks for out of bounds issues and allocates the chunk
+// on first access
+int getTileChunk(TileBoard *board, int row_idx, int col_idx)
+{
+    checkBoardBounds(board, row_idx, col_idx);
+    int cx = col_idx >> CHUNK_SHIFT;
+    int cy = row_idx >> CHUNK_SHIFT;
+    int chunk_idx = findChunk(board, cx, cy);
+    if (chunk_idx < 0)
+    {
+        chunk_idx = createChunk(board, cx, cy);
+    }
+    return chunk_idx;
+}
+
+// setTileColor
+// paint a tile and mark its row of the chunk image for the next texture update, every tile write
+// goes through here so the texture never misses one
+void setTileColor(TileBoard *board, int row_idx, int col_idx, ColorIndex color_num)
+{
+    int chunk_idx = getTileChunk(board, row_idx, col_idx);
+    int row = row_idx & (CHUNK_SIZE - 1);
+    getChunkColors(board, chunk_idx)[row * CHUNK_SIZE + (col_idx & (CHUNK_SIZE - 1))] = color_num;
+    markChunkDirty(board, chunk_idx, row, row);
 }
 
 // isTileColor
 // return true if the given tile coordinate is of the given color
 bool isTileColor(TileBoard *board, int row_idx, int col_idx, ColorIndex color_num)
 {
-    Tile *tile = getBoardTile(board, row_idx, col_idx);
-    if (tile->color_num == color_num)
+    return getTileColor(board, row_idx, col_idx) == color_num;
+}
+
+// fillTileRow
+// paint columns x0..x1 of row y with one memset per chunk the run crosses and mark that row of every
+// chunk image, the row fill of the shapes (see SHAPES in protocol.h)
+void fillTileRow(TileBoard *board, int y, int x0, int x1, ColorIndex color_num)
+{
+    int row = y & (CHUNK_SIZE - 1);
+    while (x0 <= x1)
     {
-        return true;
+        int end = (x0 | (CHUNK_SIZE - 1)) < x1 ? x0 | (CHUNK_SIZE - 1) : x1;
+        int chunk_idx = getTileChunk(board, y, x0);
+        memset(&getChunkColors(board, chunk_idx)[row * CHUNK_SIZE + (x0 & (CHUNK_SIZE - 1))], color_num, end - x0 + 1);
+        markChunkDirty(board, chunk_idx, row, row);
+        x0 = end + 1;
     }
-    else
+}
+
+// TileRange
+// columns col0..col1 and rows row0..row1, empty when col0 > col1 or row0 > row1
+typedef struct
+{
+    int col0;
+    int row0;
+    int col1;
+    int row1;
+} TileRange;
+
+// ShapeFill
+// what fillShapeRow paints with, and the tiles it may paint
+typedef struct
+{
+    TileBoard *board;
+    ColorIndex color_num;
+    TileRange clip;
+} ShapeFill;
+
+// fillShapeRow
+// ShapeRowFn painting the part of a run of a shape inside the clip into the board
+void fillShapeRow(void *context, int y, int x0, int x1)
+{
+    ShapeFill *fill = (ShapeFill *)context;
+    x0 = x0 < fill->clip.col0 ? fill->clip.col0 : x0;
+    x1 = x1 > fill->clip.col1 ? fill->clip.col1 : x1;
+    if (y < fill->clip.row0 || y > fill->clip.row1 || x0 > x1)
     {
-        return false;
+        return;
+    }
+    fillTileRow(fill->board, y, x0, x1, fill->color_num);
+}
+
+// worldToTile
+// the row and column of the tile at a world position, which may be outside of the board.
+// with GetScreenToWorld2D this finds the tile under the cursor without testing any tile for collision
+void worldToTile(Vector2 world_pos, int *row_idx, int *col_idx)
+{
+    *col_idx = (int)floorf((world_pos.x - BOARD_X) / TILE_SIZE);
+    *row_idx = (int)floorf((world_pos.y - BOARD_Y) / TILE_SIZE);
+}
+
+// getViewTiles
+// the tiles between the corners of the screen, not clamped to the board. the camera is never rotated
+TileRange getViewTiles(Camera2D camera)
+{
+    TileRange view;
+    worldToTile(GetScreenToWorld2D((Vector2){0, 0}, camera), &view.row0, &view.col0);
+    worldToTile(GetScreenToWorld2D((Vector2){SCREEN_WIDTH, SCREEN_HEIGHT}, camera), &view.row1, &view.col1);
+    return view;
+}
+
+// updateChunkTexture
+// refresh the dirty rows of a chunk image from its tiles and upload only those rows, loads the texture
+// the first time the chunk is drawn in a window. returns the number of rows refreshed
+int updateChunkTexture(TileBoard *board, int chunk_idx)
+{
+    DirtyRows *dirty = &board->chunk_dirty[chunk_idx];
+    Texture2D *texture = &board->chunk_textures[chunk_idx];
+    Color *pixels = &board->chunk_pixels[(size_t)chunk_idx * CHUNK_AREA];
+    int rows = 0;
+    if (dirty->row0 <= dirty->row1)
+    {
+        rows = dirty->row1 - dirty->row0 + 1;
+        uint8_t *colors = getChunkColors(board, chunk_idx);
+        for (int i = dirty->row0 * CHUNK_SIZE; i < (dirty->row1 + 1) * CHUNK_SIZE; i++)
+        {
+            pixels[i] = getColor(colors[i]);
+        }
+        // the rows are contiguous in the image, so they go up in one call without copying
+        if (texture->id != 0)
+        {
+            Rectangle rows_rect = {0, (float)dirty->row0, CHUNK_SIZE, (float)rows};
+            UpdateTextureRec(*texture, rows_rect, &pixels[dirty->row0 * CHUNK_SIZE]);
+        }
+        *dirty = (DirtyRows){CHUNK_SIZE, -1};
+    }
+    if (texture->id == 0 && IsWindowReady())
+    {
+        Image image = {pixels, CHUNK_SIZE, CHUNK_SIZE, 1, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8};
+        *texture = LoadTextureFromImage(image);
+    }
+    return rows;
+}
+
+// drawBoard
+// draws the chunks of the board that are on screen, call between BeginMode2D and EndMode2D
+void drawBoard(TileBoard *board, Camera2D camera)
+{
+    TileRange view = getViewTiles(camera);
+    view.col0 = view.col0 < 0 ? 0 : view.col0;
+    view.row0 = view.row0 < 0 ? 0 : view.row0;
+    view.col1 = view.col1 >= board->columns ? board->columns - 1 : view.col1;
+    view.row1 = view.row1 >= board->rows ? board->rows - 1 : view.row1;
+    if (view.col0 > view.col1 || view.row0 > view.row1)
+    {
+        return;
+    }
+    // unpainted chunks are not stored, so the visible part of the board is drawn BLACK_NUM first and
+    // only the allocated chunks are drawn on top of it
+    Rectangle view_rect = {BOARD_X + (float)view.col0 * TILE_SIZE, BOARD_Y + (float)view.row0 * TILE_SIZE,
+                           (float)(view.col1 - view.col0 + 1) * TILE_SIZE, (float)(view.row1 - view.row0 + 1) * TILE_SIZE};
+    DrawRectangleRec(view_rect, getColor(BLACK_NUM));
+    for (int c = 0; c < board->chunk_count; c++)
+    {
+        int chunk_col = board->chunk_keys[c].cx * CHUNK_SIZE;
+        int chunk_row = board->chunk_keys[c].cy * CHUNK_SIZE;
+        if (chunk_col > view.col1 || chunk_col + CHUNK_SIZE <= view.col0 || chunk_row > view.row1 ||
+            chunk_row + CHUNK_SIZE <= view.row0)
+        {
+            continue;
+        }
+        updateChunkTexture(board, c);
+        // chunks on the edge of the board hang over it, only draw the part inside
+        int width = board->columns - chunk_col < CHUNK_SIZE ? board->columns - chunk_col : CHUNK_SIZE;
+        int height = board->rows - chunk_row < CHUNK_SIZE ? board->rows - chunk_row : CHUNK_SIZE;
+        Rectangle source = {0, 0, (float)width, (float)height};
+        Rectangle dest = {BOARD_X + (float)chunk_col * TILE_SIZE, BOARD_Y + (float)chunk_row * TILE_SIZE,
+                          (float)width * TILE_SIZE, (float)height * TILE_SIZE};
+        DrawTexturePro(board->chunk_textures[c], source, dest, (Vector2){0, 0}, 0, WHITE);
     }
 }
 
@@ -133,105 +532,115 @@ void initTileBoard(TileBoard *board)
 {
     board->columns = INIT_COLUMNS;
     board->rows = INIT_ROWS;
-    // allocate memory for 2d array of tiles
-    board->tiles = (Tile **)malloc(INIT_ROWS * sizeof(Tile *));
-    if (board->tiles == NULL)
+    board->chunk_count = 0;
+    board->chunk_capacity = 16;
+    // allocate memory for the chunk pool, every tile starts out BLACK_NUM so no chunk is created yet
+    board->chunk_colors = (uint8_t *)malloc((size_t)board->chunk_capacity * CHUNK_AREA);
+    board->chunk_keys = (ChunkKey *)malloc(board->chunk_capacity * sizeof(ChunkKey));
+    board->chunk_pixels = (Color *)malloc((size_t)board->chunk_capacity * CHUNK_AREA * sizeof(Color));
+    // no texture is loaded until the chunk is drawn in a window
+    board->chunk_textures = (Texture2D *)calloc(board->chunk_capacity, sizeof(Texture2D));
+    board->chunk_dirty = (DirtyRows *)malloc(board->chunk_capacity * sizeof(DirtyRows));
+    if (board->chunk_colors == NULL || board->chunk_keys == NULL || board->chunk_pixels == NULL ||
+        board->chunk_textures == NULL || board->chunk_dirty == NULL)
     {
-        fprintf(stderr, "error allocating tile rows array\n");
+        fprintf(stderr, "error allocating chunk pool\n");
         exit(1);
     }
-    // for (int i = 0; i < INIT)
-    //  allocate memory and initialize values
-    for (int i = 0; i < INIT_ROWS; i++)
+    board->directory = NULL;
+    board->last_chunk_idx = 0;
+    rebuildChunkDirectory(board, 64);
+}
+
+// clearTileBoard
+// drop every chunk so the whole board is BLACK_NUM again, used before applying a server snapshot
+void clearTileBoard(TileBoard *board)
+{
+    board->chunk_count = 0;
+    memset(board->directory, 0, board->directory_capacity * sizeof(int));
+}
+
+// trimBoardChunks
+// after a shrink, drop the chunks that are now fully outside of the board and reset the tiles
+// outside of the board in the chunks on the edge so growing again shows BLACK_NUM there
+void trimBoardChunks(TileBoard *board)
+{
+    int kept = 0;
+    for (int i = 0; i < board->chunk_count; i++)
     {
-        board->tiles[i] = (Tile *)malloc(INIT_COLUMNS * sizeof(Tile));
-        if (board->tiles[i] == NULL)
+        ChunkKey key = board->chunk_keys[i];
+        int first_col = key.cx * CHUNK_SIZE;
+        int first_row = key.cy * CHUNK_SIZE;
+        if (first_col >= board->columns || first_row >= board->rows)
         {
-            fprintf(stderr, "error allocating tile columns array\n");
-            exit(1);
+            continue;
+        }
+        if (kept != i)
+        {
+            memcpy(getChunkColors(board, kept), getChunkColors(board, i), CHUNK_AREA);
+            board->chunk_keys[kept] = key;
         }
-        for (int j = 0; j < INIT_COLUMNS; j++)
+        uint8_t *colors = getChunkColors(board, kept);
+        // the slot now holds another chunk or lost its edge, refresh the whole image
+        board->chunk_dirty[kept] = (DirtyRows){0, CHUNK_SIZE - 1};
+        for (int row = 0; row < CHUNK_SIZE; row++)
         {
-            Tile *board_tile = getBoardTile(board, i, j); // &board->tiles[i][j];
-            board_tile->color_num = BLACK_NUM;
-            initTileRectangle(&board_tile->rect, i, j);
+            for (int col = 0; col < CHUNK_SIZE; col++)
+            {
+                if (first_row + row >= board->rows || first_col + col >= board->columns)
+                {
+                    colors[row * CHUNK_SIZE + col] = BLACK_NUM;
+                }
+            }
         }
+        kept++;
+    }
+    if (kept != board->chunk_count)
+    {
+        board->chunk_count = kept;
+        rebuildChunkDirectory(board, board->directory_capacity);
     }
 }
 
 // resizeBoardWidth
-// take a new width and reallocate memory for it
-// initialize new values if new width is bigger than old width
+// take a new width, chunks are allocated lazily so only shrinking has to touch memory
 // updating board[][COLUMNS]
 void resizeBoardWidth(TileBoard *board, int new_width)
 {
     int old_width = board->columns;
     board->columns = new_width;
-
-    // resize every row to new width
-    for (int i = 0; i < board->rows; i++)
+    if (new_width < old_width)
     {
-        board->tiles[i] = (Tile *)realloc(board->tiles[i], new_width * sizeof(Tile));
-        // initialize data for new columns
-        for (int j = old_width; j < new_width; j++)
-        {
-            Tile *tile = getBoardTile(board, i, j);
-            tile->color_num = BLACK_NUM;
-            initTileRectangle(&tile->rect, i, j);
-        }
+        trimBoardChunks(board);
     }
 }
 
 // resizeBoardHeight
-// take a new height and reallocate memory for it
-// initialize new values if new height is bigger than old height
+// take a new height, chunks are allocated lazily so only shrinking has to touch memory
 // updating board[ROWS][]
 void resizeBoardHeight(TileBoard *board, int new_height)
 {
     int old_rows = board->rows;
-    // free old row data
-    if (new_height < old_rows)
-    {
-        for (int i = new_height; i < old_rows; i++)
-        {
-            free(board->tiles[i]);
-        }
-    }
     board->rows = new_height;
-    // init memory for new rows
-    Tile **temp_realloc = (Tile **)realloc(board->tiles, new_height * sizeof(Tile *));
-    if (temp_realloc == NULL)
-    {
-        fprintf(stderr, "error realloc height/rows\n");
-        exit(1);
-    }
-    board->tiles = temp_realloc;
-
-    // initialize data for new rows
-    for (int i = old_rows; i < new_height; i++)
+    if (new_height < old_rows)
     {
-
-        Tile *temp_malloc = (Tile *)malloc(board->columns * sizeof(Tile));
-
-        if (temp_malloc == NULL)
-        {
-            fprintf(stderr, "error allocating tile columns array \n");
-            exit(1);
-        }
-        board->tiles[i] = temp_malloc;
-
-        for (int j = 0; j < board->columns; j++)
-        {
-            Tile *tile = getBoardTile(board, i, j); // &board->tiles[i][j];
-            tile->color_num = BLACK_NUM;
-            initTileRectangle(&tile->rect, i, j);
-        }
+        trimBoardChunks(board);
     }
 }
 
 // MUTABLE PROGRAM VARIABLES
 // --------------------------
 ColorIndex selected_color_index = PURPLE_NUM; // selected color = 4
+Tool selected_tool = TOOL_PENCIL;
+// set with [ and ], the radius of the circles the pencil stamps, 0 for single tiles
+int brush_radius = 0;
+// the tile a rect, line or circle drag started on and the last tile of a pencil stroke, while the
+// button is held
+bool drag_active = false;
+int drag_row;
+int drag_col;
+int stroke_row = -1;
+int stroke_col = -1;
 Vector2 mouse_pos;
 Vector2 mouse_world_pos;
 Camera2D camera;
@@ -290,14 +699,14 @@ bool checkInBoundary()
 // ----------------
 
 // validateDimensionInput
-// takes the string input of a text box and returns true if its one or two digits and only positive numbers
-// false otherwise
+// takes the string input of a text box and returns true if its only digits and a number between
+// 1 and MAX_BOARD_DIMENSION, false otherwise
 bool validateDimensionInput(char *inputText)
 {
     int length = strlen(inputText);
-    if (length > 2)
+    if (length == 0 || length > 6)
     {
-        // must be no more than 2 digits
+        // must be no more than 6 digits
         return false;
     }
     for (int i = 0; i < length; i++)
@@ -308,38 +717,15 @@ bool validateDimensionInput(char *inputText)
             return false;
         }
     }
-    return true;
+    int value = atoi(inputText);
+    return value >= 1 && value <= MAX_BOARD_DIMENSION;
 }
 
-// parseBoardCSV - input: string
-// takes the server response and populates the tile board
-// not an actual csv because the first line is missing
-// we assume to know what the rows will be
-void parseBoardCSV(TileBoard *board, char *boardCSV)
+// applyServerDimensions
+// called before applying a snapshot from the server, resizes the board to the server dimensions
+// and clears it because the server only sends the tiles of its painted chunks
+void applyServerDimensions(TileBoard *board, int server_rows, int server_columns)
 {
-
-    /*
-    rows,columns\n
-    board,c,s,v
-    */
-    // extract the first line with the dimensions
-    char *token;
-    char *rest_board = boardCSV;
-    // char *dimensions_str;
-    int server_columns = -1;
-    int server_rows = -1;
-    token = strtok_r(rest_board, "\n", &rest_board);
-    char *dimensions_str = token;
-    printf("dimension str %s\n", dimensions_str);
-    char *rest_dimensions = dimensions_str;
-    token = strtok_r(rest_dimensions, ",", &rest_dimensions);
-    server_rows = atoi(token);
-    printf("token %s\n", token);
-    token = strtok_r(rest_dimensions, ",", &rest_dimensions);
-    server_columns = atoi(token);
-    printf("token %s\n", token);
-
-
     // check if different and resize actually!
     if (server_rows != board->rows)
     {
@@ -349,12 +735,117 @@ void parseBoardCSV(TileBoard *board, char *boardCSV)
     if (server_columns != board->columns)
     {
         resizeBoardWidth(board, server_columns);
-        snprintf(width_input_text, sizeof(height_input_text), "%d", server_columns);
+        snprintf(width_input_text, sizeof(width_input_text), "%d", server_columns);
+    }
+    clearTileBoard(board);
+}
+
+// scanCSVInt
+// parse the unsigned decimal number at the cursor and leave the cursor after it, returns -1
+// without moving the cursor when there is no digit there
+int scanCSVInt(const char **cursor, const char *end)
+{
+    const char *c = *cursor;
+    int value = 0;
+    // more digits than this can not be a valid coordinate and would overflow
+    const char *limit = end - c > 9 ? c + 9 : end;
+    while (c < limit && (unsigned char)(*c - '0') < 10)
+    {
+        value = value * 10 + (*c - '0');
+        c++;
+    }
+    if (c == *cursor)
+    {
+        return -1;
+    }
+    *cursor = c;
+    return value;
+}
+
+// parseBoardCSV
+// takes the server response and populates the tile board in a single pass over it, without
+// copying or allocating. the first line is "rows,columns" and every other line "x,y,color_num",
+// lines that do not parse or are outside of the board are skipped
+void parseBoardCSV(TileBoard *board, const char *csv, size_t length)
+{
+    const char *cursor = csv;
+    const char *end = csv + length;
+    int server_rows = scanCSVInt(&cursor, end);
+    int server_columns = -1;
+    if (cursor < end && *cursor == ',')
+    {
+        cursor++;
+        server_columns = scanCSVInt(&cursor, end);
+    }
+    if (server_rows < 1 || server_rows > MAX_BOARD_DIMENSION || server_columns < 1 ||
+        server_columns > MAX_BOARD_DIMENSION)
+    {
+        fprintf(stderr, "ignoring csv board with bad dimensions\n");
+        return;
+    }
+    applyServerDimensions(board, server_rows, server_columns);
+
+    while (cursor < end)
+    {
+        int fields[3];
+        int field_count = 0;
+        while (field_count < 3 && (fields[field_count] = scanCSVInt(&cursor, end)) >= 0)
+        {
+            field_count++;
+            if (field_count < 3)
+            {
+                if (cursor == end || *cursor != ',')
+                {
+                    break;
+                }
+                cursor++;
+            }
+        }
+        // the rest of the line is only more than the newline if it is malformed
+        const char *newline = memchr(cursor, '\n', end - cursor);
+        cursor = newline == NULL ? end : newline + 1;
+        // black tiles are already black after clearing, skip them so no chunk gets allocated for them
+        if (field_count < 3 || fields[2] == BLACK_NUM || fields[2] > PURPLE_NUM || fields[0] >= board->columns ||
+            fields[1] >= board->rows)
+        {
+            continue;
+        }
+        setTileColor(board, fields[1], fields[0], fields[2]);
     }
-    // -----
+}
+
+// parseBoardCSVLegacy
+// the multi-pass parser parseBoardCSV replaced, only kept so --bench can compare against it. splits a
+// NUL-terminated copy of the reply into lines with strtok_r and every line into fields with strtok and
+// atoi, it does not check the tiles against the board
+void parseBoardCSVLegacy(TileBoard *board, char *boardCSV)
+{
+    char *token;
+    char *rest_board = boardCSV;
+    token = strtok_r(rest_board, "\n", &rest_board);
+    char *rest_dimensions = token;
+    token = strtok_r(rest_dimensions, ",", &rest_dimensions);
+    int server_rows = atoi(token);
+    token = strtok_r(rest_dimensions, ",", &rest_dimensions);
+    int server_columns = atoi(token);
+    applyServerDimensions(board, server_rows, server_columns);
 
+    // one line per tile, the board can be far bigger than the lines sent so count them first
+    int line_count = 0;
+    for (char *c = rest_board; *c != '\0'; c++)
+    {
+        if (*c == '\n')
+        {
+            line_count++;
+        }
+    }
+    char **lines = (char **)malloc((line_count + 1) * sizeof(char *));
+    if (lines == NULL)
+    {
+        fprintf(stderr, "error malloc in parseBoardCSVLegacy\n");
+        exit(1);
+    }
     token = strtok_r(rest_board, "\n", &rest_board);
-    char *lines[server_columns * server_rows];
     int lineIdx = 0;
     while (token != NULL)
     {
@@ -364,11 +855,7 @@ void parseBoardCSV(TileBoard *board, char *boardCSV)
     }
     for (int i = 0; i < lineIdx; i++)
     {
-        char *line = lines[i];
-        // printf("%s\n", line);
-        char *dataToken;
-        // int lineData[3];
-        dataToken = strtok(line, ",");
+        char *dataToken = strtok(lines[i], ",");
         int dataIdx = 0;
         int colorNum = 0;
         int x = 0;
@@ -387,77 +874,938 @@ void parseBoardCSV(TileBoard *board, char *boardCSV)
                 colorNum = atoi(dataToken);
                 break;
             }
-            //  lineData[dataIdx] = atoi(dataToken);
             dataToken = strtok(NULL, ",");
             dataIdx++;
         }
-        Tile *lineTile = getBoardTile(board, y, x); //&board->tiles[x][y];
-
-        Rectangle *rect = &(*lineTile).rect;
-        rect->x = BOARD_X + x * TILE_SIZE;
-        rect->y = BOARD_Y + y * TILE_SIZE;
-        rect->width = TILE_SIZE;
-        rect->height = TILE_SIZE;
-        lineTile->color_num = colorNum;
+        if (colorNum == BLACK_NUM)
+        {
+            // already black after clearing, skip it so no chunk gets allocated for it
+            continue;
+        }
+        setTileColor(board, y, x, colorNum);
     }
+    free(lines);
+}
 
-    // free(dimensions_str);
+// applySnapshotChunks
+// paint the chunks of a snapshot onto a board that is black where they are
+void applySnapshotChunks(TileBoard *board, SnapshotHeader *header, uint8_t *chunks)
+{
+    uint8_t colors[CHUNK_AREA];
+    uint8_t *cursor = chunks;
+    for (uint32_t i = 0; i < header->chunk_count; i++, cursor += SNAPSHOT_CHUNK_SIZE)
+    {
+        uint32_t cx = readU32(&cursor[0]);
+        uint32_t cy = readU32(&cursor[4]);
+        int first_col = cx * CHUNK_SIZE;
+        int first_row = cy * CHUNK_SIZE;
+        if (cx >= header->columns / CHUNK_SIZE + 1 || cy >= header->rows / CHUNK_SIZE + 1 ||
+            first_col >= board->columns || first_row >= board->rows)
+        {
+            continue;
+        }
+        unpackChunkColors(colors, &cursor[8]);
+        // tiles outside of the board and colors we do not know stay black
+        bool painted = false;
+        for (int row = 0; row < CHUNK_SIZE; row++)
+        {
+            for (int col = 0; col < CHUNK_SIZE; col++)
+            {
+                uint8_t *color_num = &colors[row * CHUNK_SIZE + col];
+                if (*color_num > PURPLE_NUM || first_row + row >= board->rows || first_col + col >= board->columns)
+                {
+                    *color_num = BLACK_NUM;
+                }
+                painted |= *color_num != BLACK_NUM;
+            }
+        }
+        // an all black chunk is what the board has there after clearing, skip it so it is not allocated
+        if (!painted)
+        {
+            continue;
+        }
+        int chunk_idx = getTileChunk(board, first_row, first_col);
+        memcpy(getChunkColors(board, chunk_idx), colors, CHUNK_AREA);
+        markChunkDirty(board, chunk_idx, 0, CHUNK_SIZE - 1);
+    }
 }
 
-// sendReq 
-// takes a req_str and sends it on the zeromq request socket and returns the response
-char *sendReq(char *req_str)
+// parseBoardSnapshot
+// takes a binary snapshot (see protocol.h) from the server and populates the tile board
+// returns false without touching the board if the snapshot can not be decoded
+bool parseBoardSnapshot(TileBoard *board, uint8_t *snapshot, size_t size)
 {
-    printf("sending command %s \n", req_str);
-    zstr_send(requester, req_str);
-    // sleep(1);
-    char *str = zstr_recv(requester);
-    return str;
+    SnapshotHeader header;
+    if (!readSnapshotHeader(snapshot, size, &header))
+    {
+        return false;
+    }
+    applyServerDimensions(board, header.rows, header.columns);
+    board_seq = header.seq;
+    board_seq_known = true;
+    applySnapshotChunks(board, &header, snapshot + SNAPSHOT_HEADER_SIZE);
+    return true;
 }
 
-// sendFetchReq
-// uses sendReq with a "fetch" string and updates the entire Board state
-void sendFetchReq(TileBoard *board)
+// recvReply
+// waits for the next reply on the request socket and returns its body without the empty delimiter
+// that every request starts with, so the server answers the DEALER like a REQ socket
+zframe_t *recvReply()
 {
-    char *result = sendReq("fetch");
-    parseBoardCSV(board, result);
-    printf("%s\n",result);
-    zstr_free(&result);
+    zmsg_t *reply = zmsg_recv(requester);
+    if (reply == NULL)
+    {
+        return NULL;
+    }
+    zframe_t *delimiter = zmsg_pop(reply);
+    zframe_t *body = zmsg_pop(reply);
+    zframe_destroy(&delimiter);
+    zmsg_destroy(&reply);
+    return body;
 }
 
-// sendResizeReq 
-// takes integer values for the new rows and columns and calls sendReq with a string to trigger a resize on the server
-void sendResizeReq(int new_rows, int new_cols)
+// handleAck
+// the reply to a binary command, matched to the command by its sequence number. returns false
+// without using the reply if it is not an ack
+bool handleAck(zframe_t *reply)
 {
-    char command_str[64];
-    snprintf(command_str, sizeof(command_str), "%s\nresize\n%d,%d",
-             uuid, new_rows, new_cols);
-    char *result = sendReq(command_str);
-    printf("%s\n", result);
-    zstr_free(&result);
+    CommandHeader header;
+    if (!readCommandHeader(zframe_data(reply), zframe_size(reply), &header) || header.opcode != OP_ACK)
+    {
+        return false;
+    }
+    if (commands_in_flight > 0)
+    {
+        commands_in_flight--;
+    }
+    if (header.payload[0] != ACK_OK)
+    {
+        printf("command %u was rejected\n", header.seq);
+    }
+    return true;
 }
 
-// sendUpdateReq
-// takes integers for the coordinates and color and calls sendReq with a string to triger a resize on the server
-void sendUpdateReq(int x, int y, ColorIndex color_num)
+// drainReplies
+// handle the acks that arrived since the last frame without waiting for the ones still in flight
+void drainReplies()
 {
-    char command_str[64];
-    snprintf(command_str, sizeof(command_str), "%s\nupdate\n%d,%d,%d",
-             uuid, x, y, color_num);
-    char *result = sendReq(command_str);
-    printf("%s\n", result);
-    zstr_free(&result);
+    while (commands_in_flight > 0 && (zsock_events(requester) & ZMQ_POLLIN))
+    {
+        zframe_t *reply = recvReply();
+        if (reply != NULL && !handleAck(reply))
+        {
+            fprintf(stderr, "ignoring unexpected reply of %zu bytes\n", zframe_size(reply));
+        }
+        zframe_destroy(&reply);
+    }
 }
 
-// parseBoardUpdate
-// use x,y,color string received from the subscriber to update the board to match with 
-// the other users
-void parseBoardUpdate(TileBoard* board, char* arg_str){
-// parse update string
+// recvFetchReply
+// waits for the reply to a fetch, handling the acks of the commands sent before it on the way since
+// the server answers the requests of one client in order
+zframe_t *recvFetchReply()
+{
+    zframe_t *reply = recvReply();
+    while (reply != NULL && commands_in_flight > 0 && handleAck(reply))
+    {
+        zframe_destroy(&reply);
+        reply = recvReply();
+    }
+    return reply;
+}
 
-    char *token;
-    token = strtok(arg_str, ",");
-    int x = 0;
+// sendReq 
+// takes a req_str and sends it on the zeromq request socket and returns the response
+char *sendReq(char *req_str)
+{
+    printf("sending command %s \n", req_str);
+    zsock_send(requester, "zs", req_str);
+    // sleep(1);
+    zframe_t *reply = recvReply();
+    if (reply == NULL)
+    {
+        return NULL;
+    }
+    char *str = zframe_strdup(reply);
+    zframe_destroy(&reply);
+    return str;
+}
+
+// BoardReply
+// a fetch reply received by the network thread, handed to the render thread which applies it to the board
+typedef enum
+{
+    // a binary snapshot or a fetch_since delta
+    REPLY_FETCH,
+    // the CSV board of a server from before the binary protocol
+    REPLY_CSV,
+    // an OP_FETCH_REGION snapshot of regions rx0..rx1, ry0..ry1
+    REPLY_REGION,
+} BoardReplyKind;
+
+typedef struct
+{
+    BoardReplyKind kind;
+    zframe_t *frame;
+    int rx0;
+    int ry0;
+    int rx1;
+    int ry1;
+} BoardReply;
+
+// sendFetchReq
+// asks the server for a binary snapshot of the entire Board state, once the board seq is known
+// only for the commands since board seq since, which the server answers with a delta or a snapshot if it
+// no longer has them
+// with --text, falls back to a "fetch" string and the CSV format if the server does not answer with one.
+// fills reply for applyBoardReply, returns false if there is nothing to apply
+bool sendFetchReq(BoardReply *reply, uint32_t since)
+{
+    reply->kind = REPLY_FETCH;
+    if (!text_protocol)
+    {
+        uint8_t frame[COMMAND_FRAME_MAX];
+        if (atomic_load(&board_seq_known))
+        {
+            zsock_send(requester, "zb", frame, encodeFetchSince(frame, client_id, ++command_seq, since));
+        }
+        else
+        {
+            zsock_send(requester, "zb", frame, encodeFetch(frame, client_id, ++command_seq, FETCH_SNAPSHOT));
+        }
+        reply->frame = recvFetchReply();
+        return reply->frame != NULL;
+    }
+    if (server_sends_snapshots)
+    {
+        char command_str[64];
+        snprintf(command_str, sizeof(command_str), "%s\nfetch\nbinary", uuid);
+        printf("sending command fetch binary \n");
+        zsock_send(requester, "zs", command_str);
+        reply->frame = recvReply();
+        if (reply->frame != NULL && isSnapshot(zframe_data(reply->frame), zframe_size(reply->frame)))
+        {
+            return true;
+        }
+        printf("server did not send a binary snapshot, falling back to csv\n");
+        server_sends_snapshots = false;
+        zframe_destroy(&reply->frame);
+    }
+    printf("sending command fetch \n");
+    zsock_send(requester, "zs", "fetch");
+    reply->kind = REPLY_CSV;
+    reply->frame = recvReply();
+    return reply->frame != NULL;
+}
+
+// startSession
+// say OP_HELLO to the board and use the session id the server answers with as client id from now on.
+// servers from before sessions reject the hello and the client keeps the id derived from its uuid
+void startSession()
+{
+    uint8_t frame[HELLO_FRAME_MAX];
+    zsock_send(requester, "zb", frame, encodeHello(frame, compactClientId(uuid), ++command_seq, board_name));
+    zframe_t *reply = recvFetchReply();
+    CommandHeader header;
+    if (reply != NULL && readCommandHeader(zframe_data(reply), zframe_size(reply), &header) &&
+        header.opcode == OP_WELCOME)
+    {
+        client_id = readU32(header.payload);
+        printf("joined %s as session %08x\n", board_name[0] != '\0' ? board_name : "the default board",
+               (unsigned)client_id);
+    }
+    else if (board_name[0] != '\0')
+    {
+        // an old server or a name it refused, painting on the default board instead would surprise
+        fprintf(stderr, "the server did not let us join board %s\n", board_name);
+        exit(1);
+    }
+    else
+    {
+        printf("server has no sessions, staying %08x\n", (unsigned)client_id);
+    }
+    zframe_destroy(&reply);
+}
+
+// sendCommandFrame
+// sends a binary command frame (see protocol.h) on the request socket without waiting for the ack,
+// drainReplies handles it once it arrives
+void sendCommandFrame(uint8_t *frame, size_t frame_size)
+{
+    zsock_send(requester, "zb", frame, frame_size);
+    commands_in_flight++;
+}
+
+// SINGLE PRODUCER, SINGLE CONSUMER RINGS
+// ---------------------------------------
+// the threads only hand each other work through these rings, the slots live in an array next to the ring
+
+// SpscRing
+// slots are used modulo capacity, a power of two. head is only written by the producer and tail only by
+// the consumer so each side publishes its slot with a release store
+typedef struct
+{
+    atomic_uint head;
+    atomic_uint tail;
+    unsigned int capacity;
+} SpscRing;
+
+// ringReserve
+// called from the producer, the index of the next free slot to fill before ringCommit.
+// only waits if the consumer is capacity slots behind
+unsigned int ringReserve(SpscRing *ring)
+{
+    unsigned int head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    while (head - atomic_load_explicit(&ring->tail, memory_order_acquire) == ring->capacity)
+    {
+        sched_yield();
+    }
+    return head & (ring->capacity - 1);
+}
+
+// ringCommit
+// hands the slot from ringReserve to the consumer
+void ringCommit(SpscRing *ring)
+{
+    unsigned int head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+// ringPeek
+// called from the consumer, the index of the oldest filled slot or -1 if there is none
+int ringPeek(SpscRing *ring)
+{
+    unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    if (tail == atomic_load_explicit(&ring->head, memory_order_acquire))
+    {
+        return -1;
+    }
+    return tail & (ring->capacity - 1);
+}
+
+// ringPop
+// called from the consumer once it is done with the slot from ringPeek, frees it
+void ringPop(SpscRing *ring)
+{
+    unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+}
+
+// ringSize
+// filled slots, exact from the consumer and a lower bound from anywhere else
+unsigned int ringSize(SpscRing *ring)
+{
+    return atomic_load_explicit(&ring->head, memory_order_acquire) -
+           atomic_load_explicit(&ring->tail, memory_order_relaxed);
+}
+
+// OUTBOUND QUEUE
+// --------------
+// the render thread never talks to the server itself, it puts its commands into this single producer,
+// single consumer ring and the network thread sends them and handles their acks
+
+#define OUTBOUND_CAPACITY 4096
+#define OUTBOUND_DATA_MAX 64
+
+typedef enum
+{
+    OUTBOUND_FRAME,
+    OUTBOUND_TEXT,
+    OUTBOUND_FETCH,
+    OUTBOUND_BATCH,
+    OUTBOUND_FETCH_REGION,
+    OUTBOUND_HELLO,
+} OutboundKind;
+
+// OutboundCommand
+// a binary command frame, a text command string, a resync of the board or a batch frame
+typedef struct
+{
+    OutboundKind kind;
+    uint8_t size;
+    uint8_t data[OUTBOUND_DATA_MAX];
+    // OUTBOUND_BATCH, malloc'd frame freed by the network thread once it is sent
+    uint8_t *batch;
+    size_t batch_size;
+    // monotonic time in milliseconds the command may be sent at, later than queued with --latency
+    double send_at;
+} OutboundCommand;
+
+OutboundCommand outbound_queue[OUTBOUND_CAPACITY];
+SpscRing outbound_ring = {0, 0, OUTBOUND_CAPACITY};
+
+// nowMs
+// monotonic clock in milliseconds, usable from any thread unlike raylib's GetTime
+double nowMs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+// reserveOutbound
+// called from the render thread, the next free slot to fill before commitOutbound.
+// only waits if the network thread is OUTBOUND_CAPACITY commands behind
+OutboundCommand *reserveOutbound()
+{
+    return &outbound_queue[ringReserve(&outbound_ring)];
+}
+
+// commitOutbound
+// hands the slot from reserveOutbound to the network thread
+void commitOutbound(OutboundCommand *command)
+{
+    command->send_at = nowMs() + injected_latency_ms;
+    ringCommit(&outbound_ring);
+}
+
+// enqueueOutbound
+// called from the render thread to queue a command of up to OUTBOUND_DATA_MAX bytes
+void enqueueOutbound(OutboundKind kind, const void *data, size_t size)
+{
+    OutboundCommand *command = reserveOutbound();
+    command->kind = kind;
+    command->size = size;
+    if (size > 0)
+    {
+        memcpy(command->data, data, size);
+    }
+    commitOutbound(command);
+}
+
+// peekOutbound
+// called from the network thread, the oldest queued command or NULL if there is none
+OutboundCommand *peekOutbound()
+{
+    int idx = ringPeek(&outbound_ring);
+    return idx < 0 ? NULL : &outbound_queue[idx];
+}
+
+// popOutbound
+// called from the network thread once the command from peekOutbound is sent, frees its slot
+void popOutbound()
+{
+    ringPop(&outbound_ring);
+}
+
+// BOARD HANDOFF
+// -------------
+// only the render thread touches the board. the network thread hands it fetch replies and the
+// subscriber thread the commands of other clients, and the render thread applies both at the start
+// of a frame
+
+#define BOARD_REPLY_CAPACITY 64
+#define REMOTE_OP_CAPACITY 65536
+
+BoardReply board_replies[BOARD_REPLY_CAPACITY];
+SpscRing board_reply_ring = {0, 0, BOARD_REPLY_CAPACITY};
+
+// queueBoardReply
+// called from the network thread, the render thread destroys the frame once it is applied
+void queueBoardReply(BoardReply *reply)
+{
+    board_replies[ringReserve(&board_reply_ring)] = *reply;
+    ringCommit(&board_reply_ring);
+}
+
+typedef enum
+{
+    // moves the board seq without changing the board, for our own published commands
+    REMOTE_SEQ,
+    REMOTE_UPDATE,
+    REMOTE_RESIZE,
+    REMOTE_SHAPE,
+    // a run of tiles a flood fill painted
+    REMOTE_SPAN,
+} RemoteOpKind;
+
+// RemoteOp
+// a command another client sent, as published by the server
+typedef struct
+{
+    RemoteOpKind kind;
+    // the board seq the server published it at, text servers send none
+    bool has_seq;
+    uint32_t seq;
+    // REMOTE_UPDATE, the first corner or end of REMOTE_SHAPE, the center of a circle and the start of REMOTE_SPAN
+    int x;
+    int y;
+    int color_num;
+    // REMOTE_RESIZE
+    int rows;
+    int columns;
+    // REMOTE_SHAPE, OP_FILL_RECT, OP_LINE or OP_FILL_CIRCLE
+    uint8_t opcode;
+    // the other corner or end of a rectangle or line, the end of REMOTE_SPAN in row y
+    int x1;
+    int y1;
+    int radius;
+    // a published REMOTE_SHAPE comes once for every region it touches and is only painted inside that one
+    bool clipped;
+    uint32_t region;
+} RemoteOp;
+
+// the region of a frame published under TOPIC_GLOBAL, region y << 16 | region x otherwise
+#define NO_REGION UINT32_MAX
+
+RemoteOp remote_ops[REMOTE_OP_CAPACITY];
+SpscRing remote_op_ring = {0, 0, REMOTE_OP_CAPACITY};
+// set by --apply-budget, the most remote ops the render thread applies in one frame, the rest wait
+// for the next frame so a burst of updates can not stall rendering
+int apply_budget = 20000;
+// remote ops still queued after the last frame, the most there ever were and how many were applied,
+// shown next to the FPS and printed on exit
+unsigned int remote_backlog = 0;
+unsigned int remote_backlog_max = 0;
+int remote_ops_last_frame = 0;
+uint64_t remote_ops_applied = 0;
+
+// queueRemoteOp
+// called from the subscriber thread, waits if the render thread is REMOTE_OP_CAPACITY ops behind
+void queueRemoteOp(RemoteOp *op)
+{
+    remote_ops[ringReserve(&remote_op_ring)] = *op;
+    ringCommit(&remote_op_ring);
+}
+
+// sendResizeReq 
+// takes integer values for the new rows and columns and queues a command to trigger a resize on the server
+void sendResizeReq(int new_rows, int new_cols)
+{
+    if (!text_protocol)
+    {
+        uint8_t frame[COMMAND_FRAME_MAX];
+        enqueueOutbound(OUTBOUND_FRAME, frame, encodeResize(frame, client_id, ++command_seq, new_rows, new_cols));
+        return;
+    }
+    char command_str[OUTBOUND_DATA_MAX];
+    int length = snprintf(command_str, sizeof(command_str), "%s\nresize\n%d,%d",
+                          uuid, new_rows, new_cols);
+    enqueueOutbound(OUTBOUND_TEXT, command_str, length + 1);
+}
+
+// sendUpdateReq
+// takes integers for the coordinates and color and queues a command to trigger an update on the server
+void sendUpdateReq(int x, int y, ColorIndex color_num)
+{
+    if (!text_protocol)
+    {
+        uint8_t frame[COMMAND_FRAME_MAX];
+        enqueueOutbound(OUTBOUND_FRAME, frame, encodeUpdate(frame, client_id, ++command_seq, x, y, color_num));
+        return;
+    }
+    char command_str[OUTBOUND_DATA_MAX];
+    int length = snprintf(command_str, sizeof(command_str), "%s\nupdate\n%d,%d,%d",
+                          uuid, x, y, color_num);
+    enqueueOutbound(OUTBOUND_TEXT, command_str, length + 1);
+}
+
+// sendTextRow
+// ShapeRowFn queueing every tile of a run as a text update, text servers have no shapes
+void sendTextRow(void *context, int y, int x0, int x1)
+{
+    for (int x = x0; x <= x1; x++)
+    {
+        sendUpdateReq(x, y, *(ColorIndex *)context);
+    }
+}
+
+// sendShapeReq
+// queue a rectangle, line or circle the board is already painted with as one command, with --text
+// as an update per tile
+void sendShapeReq(TileBoard *board, const RemoteOp *shape)
+{
+    ColorIndex color_num = shape->color_num;
+    if (text_protocol)
+    {
+        if (shape->opcode == OP_FILL_RECT)
+        {
+            rasterizeRect(shape->x, shape->y, shape->x1, shape->y1, sendTextRow, &color_num);
+        }
+        if (shape->opcode == OP_LINE)
+        {
+            rasterizeLine(shape->x, shape->y, shape->x1, shape->y1, sendTextRow, &color_num);
+        }
+        if (shape->opcode == OP_FILL_CIRCLE)
+        {
+            rasterizeCircle(shape->x, shape->y, shape->radius, board->rows, board->columns, sendTextRow, &color_num);
+        }
+        return;
+    }
+    uint8_t frame[COMMAND_FRAME_MAX];
+    size_t size;
+    if (shape->opcode == OP_FILL_RECT)
+    {
+        size = encodeFillRect(frame, client_id, ++command_seq, shape->x, shape->y, shape->x1, shape->y1, color_num);
+    }
+    else if (shape->opcode == OP_LINE)
+    {
+        size = encodeLine(frame, client_id, ++command_seq, shape->x, shape->y, shape->x1, shape->y1, color_num);
+    }
+    else
+    {
+        size = encodeFillCircle(frame, client_id, ++command_seq, shape->x, shape->y, shape->radius, color_num);
+    }
+    enqueueOutbound(OUTBOUND_FRAME, frame, size);
+}
+
+// sendFloodFillReq
+// queue a flood fill from the tile x, y, which is painted once the server publishes what it filled
+void sendFloodFillReq(int x, int y, ColorIndex color_num, int connectivity)
+{
+    if (text_protocol)
+    {
+        fprintf(stderr, "flood fill needs the binary protocol\n");
+        return;
+    }
+    uint8_t frame[COMMAND_FRAME_MAX];
+    enqueueOutbound(OUTBOUND_FRAME, frame, encodeFloodFill(frame, client_id, ++command_seq, x, y, color_num,
+                                                           connectivity));
+}
+
+// PENDING BATCH
+// the tiles painted since the last flush, only touched by the render thread
+uint64_t pending_tiles[BATCH_MAX_TILES];
+int pending_count = 0;
+double pending_since = 0;
+
+// flushTileUpdates
+// queue the pending tiles as one command, a single tile as a plain update
+void flushTileUpdates()
+{
+    if (pending_count == 0)
+    {
+        return;
+    }
+    if (pending_count == 1)
+    {
+        int x, y, color_num;
+        unpackTile(pending_tiles[0], &x, &y, &color_num);
+        sendUpdateReq(x, y, color_num);
+        pending_count = 0;
+        return;
+    }
+    OutboundCommand *command = reserveOutbound();
+    command->kind = OUTBOUND_BATCH;
+    command->batch = (uint8_t *)malloc(batchFrameSize(pending_count));
+    if (command->batch == NULL)
+    {
+        fprintf(stderr, "error malloc flushTileUpdates\n");
+        exit(1);
+    }
+    command->batch_size = encodeBatchUpdate(command->batch, client_id, ++command_seq, pending_tiles, pending_count);
+    commitOutbound(command);
+    pending_count = 0;
+}
+
+// queueTileUpdate
+// called instead of sendUpdateReq while painting, collects the tile into the pending batch.
+// text servers have no batches so with --text the tile is sent right away
+void queueTileUpdate(int x, int y, ColorIndex color_num)
+{
+    if (text_protocol)
+    {
+        sendUpdateReq(x, y, color_num);
+        return;
+    }
+    if (pending_count == BATCH_MAX_TILES)
+    {
+        flushTileUpdates();
+    }
+    if (pending_count == 0)
+    {
+        pending_since = nowMs();
+    }
+    pending_tiles[pending_count++] = packTile(x, y, color_num);
+}
+
+// sendOutbound
+// called from the network thread to send a queued command. binary commands go out without waiting,
+// text commands still wait for their reply since it does not say which command it answers
+void sendOutbound(OutboundCommand *command)
+{
+    messages_sent++;
+    if (command->kind == OUTBOUND_FRAME)
+    {
+        tiles_sent += command->data[1] == OP_UPDATE;
+        sendCommandFrame(command->data, command->size);
+        return;
+    }
+    if (command->kind == OUTBOUND_BATCH)
+    {
+        tiles_sent += (command->batch_size - COMMAND_HEADER_SIZE) / 8;
+        sendCommandFrame(command->batch, command->batch_size);
+        free(command->batch);
+        return;
+    }
+    BoardReply reply;
+    if (command->kind == OUTBOUND_HELLO)
+    {
+        startSession();
+        return;
+    }
+    if (command->kind == OUTBOUND_FETCH)
+    {
+        // the board seq to fetch from comes with the command after a gap, otherwise it is where the board is
+        uint32_t since = atomic_load(&board_seq);
+        if (command->size == sizeof(since))
+        {
+            memcpy(&since, command->data, sizeof(since));
+        }
+        if (sendFetchReq(&reply, since))
+        {
+            queueBoardReply(&reply);
+        }
+        return;
+    }
+    if (command->kind == OUTBOUND_FETCH_REGION)
+    {
+        zsock_send(requester, "zb", command->data, (size_t)command->size);
+        const uint8_t *payload = &command->data[COMMAND_HEADER_SIZE];
+        reply.kind = REPLY_REGION;
+        reply.frame = recvFetchReply();
+        reply.rx0 = readU16(&payload[0]);
+        reply.ry0 = readU16(&payload[2]);
+        reply.rx1 = readU16(&payload[4]);
+        reply.ry1 = readU16(&payload[6]);
+        if (reply.frame != NULL)
+        {
+            queueBoardReply(&reply);
+        }
+        return;
+    }
+    char *result = sendReq((char *)command->data);
+    if (result != NULL)
+    {
+        printf("%s\n", result);
+    }
+    zstr_free(&result);
+}
+
+// applyBoardUpdate
+// set a tile to the color another user painted it, ignored if it is outside of the board
+void applyBoardUpdate(TileBoard *board, int x, int y, int color_num)
+{
+    if (x < 0 || x >= board->columns || y < 0 || y >= board->rows || color_num < 0 || color_num >= PALETTE_SIZE)
+    {
+        fprintf(stderr, "ignoring update of %d, %d to %d\n", x, y, color_num);
+        return;
+    }
+    setTileColor(board, y, x, color_num); // &board->tiles[x][y];
+}
+
+// applyBoardResize
+// resize the board to match with the other users
+void applyBoardResize(TileBoard *board, int new_rows, int new_cols)
+{
+    if (new_rows < 1 || new_rows > MAX_BOARD_DIMENSION || new_cols < 1 || new_cols > MAX_BOARD_DIMENSION){
+        fprintf(stderr, "ignoring resize to %d, %d\n", new_rows, new_cols);
+        return;
+    }
+
+    if (new_rows != board->rows){
+        resizeBoardHeight(board, new_rows);
+        snprintf(height_input_text, sizeof(width_input_text), "%d", new_rows);
+    }
+    if (new_cols != board->columns){
+        resizeBoardWidth(board, new_cols);
+        snprintf(width_input_text, sizeof(width_input_text), "%d", new_cols);
+    }
+}
+
+// readShapeOp
+// fill in the shape fields of a remote op from an OP_FILL_RECT, OP_LINE or OP_FILL_CIRCLE frame
+void readShapeOp(RemoteOp *op, CommandHeader *header)
+{
+    int unused;
+    op->kind = REMOTE_SHAPE;
+    op->opcode = header->opcode;
+    unpackTile(readU64(header->payload), &op->x, &op->y, &op->color_num);
+    if (header->opcode == OP_FILL_CIRCLE)
+    {
+        op->radius = (int)(readU32(&header->payload[8]) & 0x7fffffff);
+        return;
+    }
+    unpackTile(readU64(&header->payload[8]), &op->x1, &op->y1, &unused);
+}
+
+// applyBoardShape
+// paint a rectangle, line or circle with the rasterizer the server uses, ignored if it is not on the board
+void applyBoardShape(TileBoard *board, const RemoteOp *shape)
+{
+    bool valid = shape->x >= 0 && shape->x < board->columns && shape->y >= 0 && shape->y < board->rows &&
+                 shape->color_num >= 0 && shape->color_num < PALETTE_SIZE;
+    if (shape->opcode == OP_FILL_CIRCLE)
+    {
+        valid = valid && shape->radius >= 0 && shape->radius <= SHAPE_MAX_RADIUS;
+    }
+    else
+    {
+        valid = valid && shape->x1 >= 0 && shape->x1 < board->columns && shape->y1 >= 0 && shape->y1 < board->rows;
+    }
+    if (shape->opcode == OP_FILL_RECT)
+    {
+        valid = valid && rectTileCount(shape->x, shape->y, shape->x1, shape->y1) <= SHAPE_MAX_TILES;
+    }
+    if (!valid)
+    {
+        fprintf(stderr, "ignoring shape %d at %d, %d to %d\n", shape->opcode, shape->x, shape->y, shape->color_num);
+        return;
+    }
+    ShapeFill fill = {board, shape->color_num, {0, 0, board->columns - 1, board->rows - 1}};
+    if (shape->clipped)
+    {
+        int col0 = (int)(shape->region & 0xffff) << REGION_SHIFT;
+        int row0 = (int)(shape->region >> 16) << REGION_SHIFT;
+        fill.clip = (TileRange){col0, row0, col0 + REGION_SIZE - 1, row0 + REGION_SIZE - 1};
+    }
+    // a shape comes once for every region it paints in, only the rows of the clip are rasterized so a long
+    // line or tall rectangle costs the same per region as a short one
+    if (shape->opcode == OP_FILL_RECT)
+    {
+        int top = shape->y < shape->y1 ? shape->y : shape->y1;
+        int bottom = shape->y < shape->y1 ? shape->y1 : shape->y;
+        top = top < fill.clip.row0 ? fill.clip.row0 : top;
+        bottom = bottom > fill.clip.row1 ? fill.clip.row1 : bottom;
+        if (top <= bottom)
+        {
+            rasterizeRect(shape->x, top, shape->x1, bottom, fillShapeRow, &fill);
+        }
+    }
+    if (shape->opcode == OP_LINE)
+    {
+        rasterizeLineRows(shape->x, shape->y, shape->x1, shape->y1, fill.clip.row0, fill.clip.row1, fillShapeRow,
+                          &fill);
+    }
+    if (shape->opcode == OP_FILL_CIRCLE)
+    {
+        int bottom = fill.clip.row1 < board->rows ? fill.clip.row1 : board->rows - 1;
+        rasterizeCircleRows(shape->x, shape->y, shape->radius, fill.clip.row0, bottom, board->columns, fillShapeRow,
+                            &fill);
+    }
+}
+
+// applyBoardSpan
+// paint a run of a flood fill, ignored if it is not on the board
+void applyBoardSpan(TileBoard *board, int y, int x0, int x1, int color_num)
+{
+    if (y < 0 || y >= board->rows || x0 < 0 || x1 >= board->columns || x0 > x1 || color_num < 0 ||
+        color_num >= PALETTE_SIZE)
+    {
+        fprintf(stderr, "ignoring fill of %d..%d, %d to %d\n", x0, x1, y, color_num);
+        return;
+    }
+    fillTileRow(board, y, x0, x1, color_num);
+}
+
+// paintStroke
+// continue the pencil stroke on to row, col. a fast mouse skips tiles between two frames, so the tiles
+// from the last one are painted as a line that goes out as one command, which the server and the other
+// clients rasterize the same way. the first tile of a stroke and a step to a neighboring tile go into
+// the pending batch
+void paintStroke(TileBoard *board, int row, int col)
+{
+    if (row == stroke_row && col == stroke_col)
+    {
+        return;
+    }
+    if (stroke_row < 0 || (abs(row - stroke_row) <= 1 && abs(col - stroke_col) <= 1))
+    {
+        if (isTileColor(board, row, col, selected_color_index) == false)
+        {
+            setTileColor(board, row, col, selected_color_index);
+            printf("painting %d, %d as %d\n", col, row, selected_color_index);
+            queueTileUpdate(col, row, selected_color_index);
+        }
+    }
+    else
+    {
+        RemoteOp line = {.kind = REMOTE_SHAPE, .opcode = OP_LINE, .x = stroke_col, .y = stroke_row, .x1 = col,
+                         .y1 = row, .color_num = selected_color_index};
+        applyBoardShape(board, &line);
+        flushTileUpdates();
+        sendShapeReq(board, &line);
+    }
+    stroke_row = row;
+    stroke_col = col;
+}
+
+// dragShape
+// the shape of the selected tool dragged out from the tile the drag started on to row, col
+RemoteOp dragShape(int row, int col)
+{
+    RemoteOp shape = {.kind = REMOTE_SHAPE, .x = drag_col, .y = drag_row, .x1 = col, .y1 = row,
+                      .color_num = selected_color_index};
+    shape.opcode = selected_tool == TOOL_RECT ? OP_FILL_RECT : selected_tool == TOOL_LINE ? OP_LINE : OP_FILL_CIRCLE;
+    if (shape.opcode == OP_FILL_CIRCLE)
+    {
+        float dx = col - drag_col;
+        float dy = row - drag_row;
+        shape.radius = (int)(sqrtf(dx * dx + dy * dy) + 0.5f);
+        shape.radius = shape.radius > SHAPE_MAX_RADIUS ? SHAPE_MAX_RADIUS : shape.radius;
+    }
+    return shape;
+}
+
+// drawShapePreview
+// the outline of a shape while it is dragged out, call between BeginMode2D and EndMode2D
+void drawShapePreview(const RemoteOp *shape)
+{
+    Rectangle start = getTileRectangle(shape->y, shape->x);
+    Rectangle end = getTileRectangle(shape->y1, shape->x1);
+    Vector2 center = {start.x + TILE_SIZE / 2.0f, start.y + TILE_SIZE / 2.0f};
+    if (shape->opcode == OP_FILL_RECT)
+    {
+        Rectangle outline = {fminf(start.x, end.x), fminf(start.y, end.y), fabsf(end.x - start.x) + TILE_SIZE,
+                             fabsf(end.y - start.y) + TILE_SIZE};
+        DrawRectangleLinesEx(outline, 2, YELLOW);
+    }
+    if (shape->opcode == OP_LINE)
+    {
+        DrawLineEx(center, (Vector2){end.x + TILE_SIZE / 2.0f, end.y + TILE_SIZE / 2.0f}, 2, YELLOW);
+    }
+    if (shape->opcode == OP_FILL_CIRCLE)
+    {
+        DrawCircleLines(center.x, center.y, (shape->radius + 0.5f) * TILE_SIZE, YELLOW);
+    }
+}
+
+// applyRegionSnapshot
+// replace the tiles of regions rx0..rx1, ry0..ry1 with the OP_FETCH_REGION reply, the regions were
+// not subscribed to before so what the board has there is out of date
+bool applyRegionSnapshot(TileBoard *board, int rx0, int ry0, int rx1, int ry1, uint8_t *snapshot, size_t size)
+{
+    SnapshotHeader header;
+    if (!readSnapshotHeader(snapshot, size, &header))
+    {
+        return false;
+    }
+    applyBoardResize(board, header.rows, header.columns);
+    int shift = REGION_SHIFT - CHUNK_SHIFT;
+    for (int c = 0; c < board->chunk_count; c++)
+    {
+        int rx = board->chunk_keys[c].cx >> shift;
+        int ry = board->chunk_keys[c].cy >> shift;
+        if (rx >= rx0 && rx <= rx1 && ry >= ry0 && ry <= ry1)
+        {
+            memset(getChunkColors(board, c), BLACK_NUM, CHUNK_AREA);
+            markChunkDirty(board, c, 0, CHUNK_SIZE - 1);
+        }
+    }
+    applySnapshotChunks(board, &header, snapshot + SNAPSHOT_HEADER_SIZE);
+    printf("fetched regions %d,%d to %d,%d\n", rx0, ry0, rx1, ry1);
+    return true;
+}
+
+// parseBoardUpdate
+// use x,y,color string received from the subscriber to queue an update of the board to match with 
+// the other users
+void parseBoardUpdate(char* arg_str){
+// parse update string
+
+    char *token;
+    token = strtok(arg_str, ",");
+    int x = 0;
     int y = 0;
     int color_num = 0;
     int i = 0;
@@ -474,95 +1822,949 @@ void parseBoardUpdate(TileBoard* board, char* arg_str){
       token = strtok(NULL, ",");
       i++;
     }
-    printf("setting %d, %d to %d\n", x, y, color_num);
-    Tile *tile = getBoardTile(board, y, x); // &board->tiles[x][y];
-    tile->color_num = color_num;
+    RemoteOp op = {.kind = REMOTE_UPDATE, .x = x, .y = y, .color_num = color_num};
+    queueRemoteOp(&op);
+}
+
+// parseBoardResize
+// takes the passed in string argument new_rows,new_columns in order to queue a resize
+// to match with the other users
+void parseBoardResize(char* arg_str){
+    char* token;
+    int new_rows = 32;
+    int new_cols = 32;
+    token = strtok(arg_str, ",");
+    new_rows = atoi(token);
+    token = strtok(NULL, ",");
+    new_cols = atoi(token);
+    RemoteOp op = {.kind = REMOTE_RESIZE, .rows = new_rows, .columns = new_cols};
+    queueRemoteOp(&op);
+}
+
+// parseCommandFrame
+// queue a binary command published by the server under the topic of region for the render thread,
+// skipping our own commands
+void parseCommandFrame(uint8_t *frame, size_t frame_size, uint32_t region)
+{
+    CommandHeader header;
+    if (!readCommandHeader(frame, frame_size, &header))
+    {
+        fprintf(stderr, "ignoring malformed command frame of %zu bytes\n", frame_size);
+        return;
+    }
+    // the server stamps published commands with the board seq, ours still have to move it
+    RemoteOp op = {.kind = REMOTE_SEQ, .has_seq = true, .seq = header.seq};
+    bool queued = false;
+    if (header.opcode == OP_FILL_SPANS)
+    {
+        // flood fills are painted from what the server found, ours too
+        int span_count = (header.payload_length - 1) / 8;
+        for (int i = 0; i < span_count; i++)
+        {
+            RemoteOp span = {.kind = REMOTE_SPAN, .has_seq = true, .seq = header.seq, .color_num = header.payload[0]};
+            int length;
+            unpackSpan(readU64(&header.payload[1 + i * 8]), &span.x, &span.y, &length);
+            span.x1 = span.x + length - 1;
+            queueRemoteOp(&span);
+            queued = true;
+        }
+    }
+    else if (header.client_id == client_id)
+    {
+        printf("same ID. SKIP\n");
+    }
+    else if (header.opcode == OP_UPDATE)
+    {
+        op.kind = REMOTE_UPDATE;
+        unpackTile(readU64(header.payload), &op.x, &op.y, &op.color_num);
+        queueRemoteOp(&op);
+        queued = true;
+    }
+    else if (header.opcode == OP_PUBLISH_BATCH)
+    {
+        // the updates of a publish tick from every client, skip ours one by one
+        int entry_count = (header.payload_length - 4) / PUBLISH_ENTRY_SIZE;
+        for (int i = 0; i < entry_count; i++)
+        {
+            const uint8_t *entry = &header.payload[4 + i * PUBLISH_ENTRY_SIZE];
+            if (readU32(&entry[0]) == client_id)
+            {
+                continue;
+            }
+            RemoteOp update = {.kind = REMOTE_UPDATE, .has_seq = true, .seq = header.seq};
+            unpackTile(readU64(&entry[4]), &update.x, &update.y, &update.color_num);
+            queueRemoteOp(&update);
+            queued = true;
+        }
+    }
+    else if (header.opcode == OP_RESIZE)
+    {
+        op.kind = REMOTE_RESIZE;
+        op.rows = readU32(&header.payload[0]);
+        op.columns = readU32(&header.payload[4]);
+        queueRemoteOp(&op);
+        queued = true;
+    }
+    else if (header.opcode == OP_FILL_RECT || header.opcode == OP_LINE || header.opcode == OP_FILL_CIRCLE)
+    {
+        readShapeOp(&op, &header);
+        op.clipped = region != NO_REGION;
+        op.region = region;
+        queueRemoteOp(&op);
+        queued = true;
+    }
+    if (!queued)
+    {
+        queueRemoteOp(&op);
+    }
+}
+
+// applyDeltaReply
+// apply the commands of a fetch_since reply in the order the server applied them, our own included
+// since the board may have changed after we painted. returns false if the reply is not a delta
+bool applyDeltaReply(TileBoard *board, uint8_t *delta, size_t size)
+{
+    DeltaHeader header;
+    if (!readDeltaHeader(delta, size, &header))
+    {
+        return false;
+    }
+    printf("catching up %u commands from %u to %u\n", header.count, header.since, header.seq);
+    for (uint32_t i = 0; i < header.count; i++)
+    {
+        // frames shorter than COMMAND_FRAME_MAX are padded
+        CommandHeader command;
+        const uint8_t *frame = &header.frames[i * COMMAND_FRAME_MAX];
+        size_t frame_size = COMMAND_HEADER_SIZE + readU16(&frame[2]);
+        if (frame_size > COMMAND_FRAME_MAX || !readCommandHeader(frame, frame_size, &command))
+        {
+            continue;
+        }
+        if (command.opcode == OP_UPDATE)
+        {
+            int x, y, color_num;
+            unpackTile(readU64(command.payload), &x, &y, &color_num);
+            applyBoardUpdate(board, x, y, color_num);
+        }
+        if (command.opcode == OP_RESIZE)
+        {
+            applyBoardResize(board, readU32(&command.payload[0]), readU32(&command.payload[4]));
+        }
+        if (command.opcode == OP_FILL_RECT || command.opcode == OP_LINE || command.opcode == OP_FILL_CIRCLE)
+        {
+            RemoteOp shape;
+            readShapeOp(&shape, &command);
+            applyBoardShape(board, &shape);
+        }
+    }
+    if ((int32_t)(header.seq - board_seq) > 0)
+    {
+        board_seq = header.seq;
+    }
+    return true;
+}
+
+// applyBoardReply
+// apply a fetch reply from the network thread and destroy its frame, called from the render thread
+void applyBoardReply(TileBoard *board, BoardReply *reply)
+{
+    uint8_t *data = zframe_data(reply->frame);
+    size_t size = zframe_size(reply->frame);
+    if (reply->kind == REPLY_FETCH && !applyDeltaReply(board, data, size) && !parseBoardSnapshot(board, data, size))
+    {
+        fprintf(stderr, "could not decode the fetch reply from the server\n");
+    }
+    if (reply->kind == REPLY_REGION &&
+        !applyRegionSnapshot(board, reply->rx0, reply->ry0, reply->rx1, reply->ry1, data, size))
+    {
+        fprintf(stderr, "could not decode the region snapshot from the server\n");
+    }
+    if (reply->kind == REPLY_CSV)
+    {
+        parseBoardCSV(board, (char *)data, size);
+        printf("fetched a csv board of %zu bytes\n", size);
+    }
+    zframe_destroy(&reply->frame);
+}
+
+// applyRemoteOps
+// called at the start of every frame, applies the fetch replies and then up to apply_budget remote ops
+// in the order they were published. ops published before the board seq the board was fetched at are
+// already in it and dropped
+void applyRemoteOps(TileBoard *board)
+{
+    int idx;
+    while ((idx = ringPeek(&board_reply_ring)) >= 0)
+    {
+        applyBoardReply(board, &board_replies[idx]);
+        ringPop(&board_reply_ring);
+    }
+    int applied = 0;
+    while (applied < apply_budget && (idx = ringPeek(&remote_op_ring)) >= 0)
+    {
+        RemoteOp *op = &remote_ops[idx];
+        // a publish tick queues its updates all at the seq of the tick, applying the one the board is at
+        // again only sets what it already has
+        bool is_new = !op->has_seq || !board_seq_known || (int32_t)(op->seq - board_seq) >= 0;
+        if (is_new && op->kind == REMOTE_UPDATE)
+        {
+            applyBoardUpdate(board, op->x, op->y, op->color_num);
+        }
+        if (is_new && op->kind == REMOTE_RESIZE)
+        {
+            applyBoardResize(board, op->rows, op->columns);
+        }
+        if (is_new && op->kind == REMOTE_SHAPE)
+        {
+            applyBoardShape(board, op);
+        }
+        if (is_new && op->kind == REMOTE_SPAN)
+        {
+            applyBoardSpan(board, op->y, op->x, op->x1, op->color_num);
+        }
+        if (op->has_seq && board_seq_known && (int32_t)(op->seq - board_seq) > 0)
+        {
+            board_seq = op->seq;
+        }
+        ringPop(&remote_op_ring);
+        applied++;
+    }
+    remote_ops_last_frame = applied;
+    remote_ops_applied += applied;
+    remote_backlog = ringSize(&remote_op_ring);
+    if (remote_backlog > remote_backlog_max)
+    {
+        remote_backlog_max = remote_backlog;
+    }
+}
+
+// SPATIAL SUBSCRIPTIONS
+// ---------------------
+// the subscriber only subscribes to the region topics (see protocol.h) of the regions on screen. the
+// render thread decides which regions those are, the subscriber thread changes the subscriptions since
+// zeromq sockets belong to one thread, and the render thread then fetches the regions that were not
+// subscribed before, what the board has there is out of date
+
+// RegionRect
+// regions x0..x1, y0..y1
+typedef struct
+{
+    int x0;
+    int y0;
+    int x1;
+    int y1;
+} RegionRect;
+
+// zoomed out further than this many regions, subscribe to the whole board
+#define MAX_SUBSCRIBED_REGIONS 64
+// the whole board, the subscriber starts out subscribed to everything
+#define ALL_REGIONS UINT64_MAX
+
+// packed with packRegionRect, written by the render thread and by the subscriber thread
+atomic_uint_fast64_t wanted_regions = ALL_REGIONS;
+atomic_uint_fast64_t subscribed_regions = ALL_REGIONS;
+
+uint64_t packRegionRect(RegionRect rect)
+{
+    return (uint64_t)rect.x0 | (uint64_t)rect.y0 << 16 | (uint64_t)rect.x1 << 32 | (uint64_t)rect.y1 << 48;
+}
+
+RegionRect unpackRegionRect(uint64_t packed)
+{
+    return (RegionRect){packed & 0xffff, (packed >> 16) & 0xffff, (packed >> 32) & 0xffff, packed >> 48};
+}
+
+bool isRegionInRect(RegionRect rect, int rx, int ry)
+{
+    return rx >= rect.x0 && rx <= rect.x1 && ry >= rect.y0 && ry <= rect.y1;
+}
+
+// boardRegions
+// every region of the board
+RegionRect boardRegions(TileBoard *board)
+{
+    return (RegionRect){0, 0, (board->columns - 1) >> REGION_SHIFT, (board->rows - 1) >> REGION_SHIFT};
+}
+
+// setRegionSubscriptions
+// subscribe or unsubscribe the topics of the regions in rect that are not in other
+void setRegionSubscriptions(RegionRect rect, RegionRect other, bool other_all, bool subscribe)
+{
+    char topic[TOPIC_MAX];
+    for (int ry = rect.y0; ry <= rect.y1; ry++)
+    {
+        for (int rx = rect.x0; rx <= rect.x1; rx++)
+        {
+            if (other_all || isRegionInRect(other, rx, ry))
+            {
+                continue;
+            }
+            writeRegionTopic(topic, board_name, rx, ry);
+            if (subscribe)
+            {
+                zsock_set_subscribe(subscriber, topic);
+            }
+            else
+            {
+                zsock_set_unsubscribe(subscriber, topic);
+            }
+        }
+    }
+}
+
+// PUBLISH STREAM
+// --------------
+// the subscriber thread follows the board seqs of the OP_PUBLISH_TICK frames and resizes (see protocol.h)
+// and the region batches in between to notice lost messages, after a slow subscriber hit the high water
+// mark for example. only the subscriber thread touches this state
+
+// the board seq of the last tick or resize
+bool stream_seq_known = false;
+uint32_t stream_seq = 0;
+// the regions of the batches received since the last tick, ascending like the server sends them
+uint32_t tick_regions[PUBLISH_BATCH_MAX];
+int tick_region_count = 0;
+// regions a batch arrived for since the subscriptions last changed. for the others the subscription
+// may not have reached the server yet, so a tick listing them without their batch is no loss
+uint32_t confirmed_regions[MAX_SUBSCRIBED_REGIONS];
+int confirmed_region_count = 0;
+// subscribed to every region and a batch arrived since
+bool confirmed_all = false;
+
+// isRegionConfirmed
+// true if the batches of a region are known to reach us
+bool isRegionConfirmed(uint32_t region)
+{
+    if (confirmed_all)
+    {
+        return true;
+    }
+    for (int i = 0; i < confirmed_region_count; i++)
+    {
+        if (confirmed_regions[i] == region)
+        {
+            return true;
+        }
+    }
+    return false;
 }
 
-// parseBoardResize
-// takes the passed in string argument new_rows,new_columns in order to process a resize
-// to match with the other users
-void parseBoardResize(TileBoard* board, char* arg_str){
-    char* token;
-    int new_rows = 32;
-    int new_cols = 32;
-    token = strtok(arg_str, ",");
-    new_rows = atoi(token);
-    token = strtok(NULL, ",");
-    new_cols = atoi(token);
+// reportStreamGap
+// count a gap and have the render thread fetch the commands after board seq since
+void reportStreamGap(uint32_t since, uint32_t seqs_missed, uint32_t batches_missed)
+{
+    printf("lost %u board seqs and %u region batches after %u, resyncing\n", seqs_missed, batches_missed, since);
+    stream_gaps++;
+    stream_seqs_missed += seqs_missed;
+    stream_batches_missed += batches_missed;
+    atomic_store(&gap_since, since);
+    atomic_store(&gap_resync_requested, true);
+}
 
-    if (new_rows != board->rows){
-        resizeBoardHeight(board, new_rows);
-        snprintf(height_input_text, sizeof(width_input_text), "%d", new_rows);
+// trackPublishStream
+// called from the subscriber thread with every published command frame and the region of its topic before
+// it is queued
+void trackPublishStream(uint8_t *frame, size_t frame_size, uint32_t region)
+{
+    CommandHeader header;
+    if (!readCommandHeader(frame, frame_size, &header))
+    {
+        return;
     }
-    if (new_cols != board->columns){
-        resizeBoardWidth(board, new_cols);
-        snprintf(width_input_text, sizeof(width_input_text), "%d", new_cols);
+    // the spans of a flood fill and the shapes of a tick come in region frames of their own
+    if (region != NO_REGION && (header.opcode == OP_PUBLISH_BATCH || header.opcode == OP_FILL_SPANS ||
+                                header.opcode == OP_FILL_RECT || header.opcode == OP_LINE ||
+                                header.opcode == OP_FILL_CIRCLE))
+    {
+        // a region with several frames in one tick is listed once
+        bool listed = tick_region_count > 0 && tick_regions[tick_region_count - 1] == region;
+        if (tick_region_count < PUBLISH_BATCH_MAX && !listed)
+        {
+            tick_regions[tick_region_count++] = region;
+        }
+        if (atomic_load(&subscribed_regions) == ALL_REGIONS)
+        {
+            confirmed_all = true;
+        }
+        else if (!isRegionConfirmed(region) && confirmed_region_count < MAX_SUBSCRIBED_REGIONS)
+        {
+            confirmed_regions[confirmed_region_count++] = region;
+        }
+        return;
+    }
+    // resizes are published on their own, they move the board seq by one
+    bool is_single = header.opcode == OP_RESIZE;
+    if (header.opcode != OP_PUBLISH_TICK && !is_single)
+    {
+        return;
+    }
+    uint32_t since = is_single ? header.seq - 1 : readU32(header.payload);
+    uint32_t seqs_missed = 0;
+    // a tick from before the one we saw last can not be a gap
+    if (stream_seq_known && (int32_t)(since - stream_seq) > 0)
+    {
+        seqs_missed = since - stream_seq;
+    }
+    // both lists are ascending, walk them together to find the subscribed regions without a batch
+    uint32_t batches_missed = 0;
+    if (header.opcode == OP_PUBLISH_TICK)
+    {
+        uint64_t subscribed = atomic_load(&subscribed_regions);
+        RegionRect rect = unpackRegionRect(subscribed);
+        int region_count = (header.payload_length - 4) / 4;
+        int received = 0;
+        for (int i = 0; i < region_count; i++)
+        {
+            uint32_t region = readU32(&header.payload[4 + i * 4]);
+            while (received < tick_region_count && tick_regions[received] < region)
+            {
+                received++;
+            }
+            if (received < tick_region_count && tick_regions[received] == region)
+            {
+                continue;
+            }
+            bool is_subscribed = subscribed == ALL_REGIONS || isRegionInRect(rect, region & 0xffff, region >> 16);
+            if (is_subscribed && isRegionConfirmed(region))
+            {
+                batches_missed++;
+            }
+        }
+    }
+    if (seqs_missed > 0 || batches_missed > 0)
+    {
+        // the batches of this tick that did arrive are fetched again along with the lost ones
+        reportStreamGap(seqs_missed > 0 ? stream_seq : since, seqs_missed, batches_missed);
+    }
+    stream_seq = header.seq;
+    stream_seq_known = true;
+    tick_region_count = 0;
+}
+
+// updateSubscriptions
+// called from the subscriber thread, moves the subscriptions to the regions the render thread wants.
+// new subscriptions come first so there is no moment without the regions in both
+void updateSubscriptions()
+{
+    uint64_t subscribed = atomic_load(&subscribed_regions);
+    uint64_t wanted = atomic_load(&wanted_regions);
+    if (wanted == subscribed)
+    {
+        return;
+    }
+    RegionRect old_rect = unpackRegionRect(subscribed);
+    RegionRect new_rect = unpackRegionRect(wanted);
+    if (wanted == ALL_REGIONS)
+    {
+        zsock_set_subscribe(subscriber, all_regions_topic);
+    }
+    else
+    {
+        setRegionSubscriptions(new_rect, old_rect, subscribed == ALL_REGIONS, true);
+    }
+    if (subscribed == ALL_REGIONS)
+    {
+        zsock_set_unsubscribe(subscriber, all_regions_topic);
+    }
+    else
+    {
+        setRegionSubscriptions(old_rect, new_rect, wanted == ALL_REGIONS, false);
+    }
+    atomic_store(&subscribed_regions, wanted);
+    // the batches of the new regions may take a while to start arriving
+    confirmed_region_count = 0;
+    confirmed_all = false;
+}
+
+// queueRegionFetch
+// called from the render thread to fetch the regions of rect, if it is not empty
+void queueRegionFetch(RegionRect rect)
+{
+    if (rect.x0 > rect.x1 || rect.y0 > rect.y1)
+    {
+        return;
+    }
+    uint8_t frame[COMMAND_FRAME_MAX];
+    enqueueOutbound(OUTBOUND_FETCH_REGION, frame,
+                    encodeFetchRegion(frame, client_id, ++command_seq, rect.x0, rect.y0, rect.x1, rect.y1));
+}
+
+// updateViewportRegions
+// called from the render thread every frame, asks for the regions on screen and fetches the ones that
+// became subscribed since the last call. covered is the subscription the board is current for
+void updateViewportRegions(TileBoard *board, Camera2D camera, uint64_t *covered)
+{
+    RegionRect board_regions = boardRegions(board);
+    TileRange view_tiles = getViewTiles(camera);
+    RegionRect view = {view_tiles.col0 >> REGION_SHIFT, view_tiles.row0 >> REGION_SHIFT,
+                       view_tiles.col1 >> REGION_SHIFT, view_tiles.row1 >> REGION_SHIFT};
+    view.x0 = view.x0 < 0 ? 0 : view.x0;
+    view.y0 = view.y0 < 0 ? 0 : view.y0;
+    view.x1 = view.x1 > board_regions.x1 ? board_regions.x1 : view.x1;
+    view.y1 = view.y1 > board_regions.y1 ? board_regions.y1 : view.y1;
+    if (view.x0 > view.x1 || view.y0 > view.y1)
+    {
+        // looking past the board, keep the corner region so there is always a subscription
+        view.x0 = view.x1 = view.x0 > board_regions.x1 ? board_regions.x1 : view.x0;
+        view.y0 = view.y1 = view.y0 > board_regions.y1 ? board_regions.y1 : view.y0;
+    }
+    bool all = (view.x1 - view.x0 + 1) * (view.y1 - view.y0 + 1) > MAX_SUBSCRIBED_REGIONS;
+    atomic_store(&wanted_regions, all ? ALL_REGIONS : packRegionRect(view));
+
+    uint64_t subscribed = atomic_load(&subscribed_regions);
+    if (subscribed == *covered)
+    {
+        return;
+    }
+    RegionRect new_rect = subscribed == ALL_REGIONS ? board_regions : unpackRegionRect(subscribed);
+    RegionRect old_rect = *covered == ALL_REGIONS ? board_regions : unpackRegionRect(*covered);
+    *covered = subscribed;
+    if (new_rect.x1 < old_rect.x0 || new_rect.x0 > old_rect.x1 || new_rect.y1 < old_rect.y0 ||
+        new_rect.y0 > old_rect.y1)
+    {
+        queueRegionFetch(new_rect);
+        return;
+    }
+    // the part of new_rect outside of old_rect as strips above, below, left and right of it
+    int y0 = new_rect.y0 > old_rect.y0 ? new_rect.y0 : old_rect.y0;
+    int y1 = new_rect.y1 < old_rect.y1 ? new_rect.y1 : old_rect.y1;
+    queueRegionFetch((RegionRect){new_rect.x0, new_rect.y0, new_rect.x1, old_rect.y0 - 1});
+    queueRegionFetch((RegionRect){new_rect.x0, old_rect.y1 + 1, new_rect.x1, new_rect.y1});
+    queueRegionFetch((RegionRect){new_rect.x0, y0, old_rect.x0 - 1, y1});
+    queueRegionFetch((RegionRect){old_rect.x1 + 1, y0, new_rect.x1, y1});
+}
+
+// watchSubscriberEvent
+// handle an event of the subscriber monitor, the server restarting or the network dropping shows up
+// as a disconnect and the board is resynced once the subscriber is connected again
+void watchSubscriberEvent(zactor_t *monitor, bool *disconnected)
+{
+    zmsg_t *event = zmsg_recv(monitor);
+    if (event == NULL)
+    {
+        return;
+    }
+    char *name = zmsg_popstr(event);
+    if (name != NULL && strcmp(name, "DISCONNECTED") == 0)
+    {
+        printf("subscriber disconnected\n");
+        *disconnected = true;
+        // the resync after reconnecting fetches everything we miss until then
+        stream_seq_known = false;
+        tick_region_count = 0;
+    }
+    else if (name != NULL && strcmp(name, "CONNECTED") == 0 && *disconnected)
+    {
+        printf("subscriber reconnected, resyncing\n");
+        *disconnected = false;
+        atomic_store(&resync_requested, true);
+    }
+    free(name);
+    zmsg_destroy(&event);
+}
+
+// isOwnBoardTopic
+// true if a published topic is one of the board this client is on. text clients subscribe to every topic
+// and would take the frames of the named boards for their own otherwise
+bool isOwnBoardTopic(const uint8_t *topic, size_t size)
+{
+    char prefix[TOPIC_MAX];
+    writeBoardTopic(prefix, board_name, "");
+    size_t length = strlen(prefix);
+    if (length == 0)
+    {
+        return size == 0 || topic[0] != 'b';
     }
+    return size >= length && memcmp(topic, prefix, length) == 0;
+}
 
+// topicRegion
+// the region of a region topic of our board as region y << 16 | region x, NO_REGION for any other topic
+uint32_t topicRegion(const uint8_t *topic, size_t size)
+{
+    char text[TOPIC_MAX];
+    char prefix[TOPIC_MAX];
+    writeBoardTopic(prefix, board_name, TOPIC_REGIONS);
+    size_t length = strlen(prefix);
+    int rx, ry;
+    if (size >= TOPIC_MAX || size <= length || memcmp(topic, prefix, length) != 0)
+    {
+        return NO_REGION;
+    }
+    memcpy(text, &topic[length], size - length);
+    text[size - length] = '\0';
+    if (sscanf(text, "%d,%d;", &rx, &ry) != 2 || rx < 0 || ry < 0 || rx > 0xffff || ry > 0xffff)
+    {
+        return NO_REGION;
+    }
+    return (uint32_t)ry << 16 | (uint32_t)rx;
 }
 
 // updateSubThread
-// this is passed to pthread_create along with the board address in order to set up 
-// subscriptions
+// this is passed to pthread_create in order to set up subscriptions, the commands it receives
+// are queued for the render thread
 void * updateSubThread(void * arg){
+  zactor_t *monitor = zactor_new(zmonitor, subscriber);
+  zstr_sendx(monitor, "LISTEN", "CONNECTED", "DISCONNECTED", NULL);
+  zstr_send(monitor, "START");
+  zsock_wait(monitor);
+  zpoller_t *poller = zpoller_new(subscriber, monitor, NULL);
+  bool disconnected = false;
   while(1){
-    TileBoard* board = (TileBoard*)arg;
-    char * sub_buffer;
     // simulate latency
     //sleep(1);
-    zsock_recv(subscriber, "s", &sub_buffer);
+    // wake up now and then to follow the viewport even when nothing is published
+    void *ready = zpoller_wait(poller, 50);
+    if (!text_protocol){
+        updateSubscriptions();
+    }
+    if (ready == monitor){
+        watchSubscriberEvent(monitor, &disconnected);
+        continue;
+    }
+    if (ready != subscriber){
+        continue;
+    }
+    // binary commands come with a topic frame in front, text commands from --text-pub without one
+    zmsg_t *sub_msg = zmsg_recv(subscriber);
+    if (sub_msg == NULL){
+        continue;
+    }
+    uint32_t region = NO_REGION;
+    if (zmsg_size(sub_msg) > 1){
+        zframe_t *topic = zmsg_pop(sub_msg);
+        bool own_board = isOwnBoardTopic(zframe_data(topic), zframe_size(topic));
+        region = topicRegion(zframe_data(topic), zframe_size(topic));
+        zframe_destroy(&topic);
+        if (!own_board){
+            zmsg_destroy(&sub_msg);
+            continue;
+        }
+    }
+    // the shapes of a tick come as one message per region with a frame per shape
+    zframe_t *sub_frame = zmsg_pop(sub_msg);
+    while (sub_frame != NULL && isCommandFrame(zframe_data(sub_frame), zframe_size(sub_frame))){
+        trackPublishStream(zframe_data(sub_frame), zframe_size(sub_frame), region);
+        parseCommandFrame(zframe_data(sub_frame), zframe_size(sub_frame), region);
+        zframe_destroy(&sub_frame);
+        sub_frame = zmsg_pop(sub_msg);
+    }
+    zmsg_destroy(&sub_msg);
+    if (sub_frame == NULL){
+        continue;
+    }
+    // text commands from a server running with --text-pub
+    char *sub_buffer = strndup((char *)zframe_data(sub_frame), zframe_size(sub_frame));
+    zframe_destroy(&sub_frame);
     printf("sub got %s\n", sub_buffer);
     char* token;
     char* client_id_str;
     char* command_name;
     char* command_args;
-    int i = 0;
     token = strtok(sub_buffer, "\n");
     client_id_str = token;
-    if (strcmp(client_id_str, uuid) == 0){
+    // text clients send their uuid and binary clients their compact id, both map to the same compact id
+    if (client_id_str == NULL || compactClientId(client_id_str) == client_id){
         printf("same ID. SKIP\n");
-        zstr_free(&sub_buffer);
+        free(sub_buffer);
         continue;
     }
     token = strtok(NULL, "\n");
     command_name = token;
     token = strtok(NULL, "\n");
     command_args = token;
+    if (command_name == NULL || command_args == NULL){
+        free(sub_buffer);
+        continue;
+    }
     if (strcmp(command_name, "update") == 0){
-        parseBoardUpdate(board, command_args);
+        parseBoardUpdate(command_args);
     }
     if (strcmp(command_name, "resize") == 0){
-        parseBoardResize(board, command_args);
+        parseBoardResize(command_args);
 
     }
-    zstr_free(&sub_buffer);
+    free(sub_buffer);
 }
   
   return NULL;
 }
 
-int main(void)
+// networkThread
+// this is passed to pthread_create, sends the queued commands once they are due and handles the acks
+// as they arrive
+void *networkThread(void *arg)
+{
+    zpoller_t *poller = zpoller_new(requester, NULL);
+    // send what is still queued when the window closes before stopping
+    while (atomic_load(&network_running) || peekOutbound() != NULL)
+    {
+        // wake up at least every millisecond to look at the queue
+        int wait_ms = 1;
+        OutboundCommand *command;
+        while ((command = peekOutbound()) != NULL)
+        {
+            double now = nowMs();
+            if (command->send_at > now)
+            {
+                wait_ms = (int)ceil(command->send_at - now);
+                break;
+            }
+            sendOutbound(command);
+            popOutbound();
+        }
+        if (zpoller_wait(poller, wait_ms) == requester)
+        {
+            drainReplies();
+        }
+    }
+    zpoller_destroy(&poller);
+    return NULL;
+}
+
+// BENCHMARKS
+// ----------
+
+// updateBoardTextures
+// refresh the images of every chunk like drawing the whole board would, returns the rows refreshed
+int updateBoardTextures(TileBoard *board)
+{
+    int rows = 0;
+    for (int c = 0; c < board->chunk_count; c++)
+    {
+        rows += updateChunkTexture(board, c);
+    }
+    return rows;
+}
+
+// runBenchmarks
+// started with ./client --bench, times the CPU side of the chunk textures without opening a window:
+// painting tiles, tracking their dirty rows and refreshing those rows of the chunk images
+int runBenchmarks(void)
+{
+    TileBoard board;
+    initTileBoard(&board);
+    applyBoardResize(&board, 1024, 1024);
+    int total_rows = 1024 / CHUNK_SIZE * 1024;
+
+    double start = nowMs();
+    for (int i = 0; i < board.rows; i++)
+    {
+        for (int j = 0; j < board.columns; j++)
+        {
+            setTileColor(&board, i, j, (i + j) % 5);
+        }
+    }
+    printf("paint every tile 1024x1024: %.3f ms\n", nowMs() - start);
+    start = nowMs();
+    int rows = updateBoardTextures(&board);
+    printf("refresh every chunk image 1024x1024: %.3f ms (%d of %d rows)\n", nowMs() - start, rows, total_rows);
+
+    // what one frame costs with a few remote updates, a full apply budget and a stroke along a row
+    int update_counts[] = {100, 20000};
+    for (int u = 0; u < 2; u++)
+    {
+        start = nowMs();
+        for (int i = 0; i < update_counts[u]; i++)
+        {
+            setTileColor(&board, rand() % board.rows, rand() % board.columns, 1 + rand() % 4);
+        }
+        rows = updateBoardTextures(&board);
+        printf("%d scattered updates + refresh: %.3f ms (%d of %d rows, %zu KB uploaded)\n", update_counts[u],
+               nowMs() - start, rows, total_rows, (size_t)rows * CHUNK_SIZE * sizeof(Color) / 1024);
+    }
+    start = nowMs();
+    for (int j = 0; j < board.columns; j++)
+    {
+        setTileColor(&board, 500, j, PURPLE_NUM);
+    }
+    rows = updateBoardTextures(&board);
+    printf("stroke along row 500 + refresh: %.3f ms (%d of %d rows, %zu KB uploaded)\n", nowMs() - start, rows,
+           total_rows, (size_t)rows * CHUNK_SIZE * sizeof(Color) / 1024);
+
+    // a shape painted with row fills instead of a tile at a time
+    start = nowMs();
+    RemoteOp rect = {.kind = REMOTE_SHAPE, .opcode = OP_FILL_RECT, .x1 = board.columns - 1, .y1 = board.rows - 1,
+                     .color_num = GREEN_NUM};
+    applyBoardShape(&board, &rect);
+    printf("rect over every tile 1024x1024: %.3f ms\n", nowMs() - start);
+    start = nowMs();
+    for (int i = 0; i < 1000; i++)
+    {
+        RemoteOp line = {.kind = REMOTE_SHAPE, .opcode = OP_LINE, .x = rand() % board.columns, .y = rand() % board.rows,
+                         .x1 = rand() % board.columns, .y1 = rand() % board.rows, .color_num = BLUE_NUM};
+        applyBoardShape(&board, &line);
+    }
+    printf("1000 lines across 1024x1024: %.3f ms\n", nowMs() - start);
+    updateBoardTextures(&board);
+
+    // a fast stroke along row 700, 16 tiles between two frames, that used to paint every 16th tile
+    unsigned int queued = atomic_load(&outbound_ring.head);
+    int painted = 0;
+    start = nowMs();
+    for (int i = 0; i < 64; i++)
+    {
+        paintStroke(&board, 700, i * 16);
+    }
+    stroke_row = -1;
+    flushTileUpdates();
+    double stroke_ms = nowMs() - start;
+    for (int j = 0; j < board.columns; j++)
+    {
+        painted += isTileColor(&board, 700, j, selected_color_index);
+    }
+    printf("stroke of 64 samples 16 tiles apart: %.3f ms (%d tiles painted, %u commands queued)\n", stroke_ms,
+           painted, atomic_load(&outbound_ring.head) - queued);
+    while (peekOutbound() != NULL)
+    {
+        popOutbound();
+    }
+
+    // fetches from servers from before the binary protocol, one line per painted tile
+    int csv_sizes[] = {100, 1000};
+    for (int s = 0; s < 2; s++)
+    {
+        int size = csv_sizes[s];
+        char *csv = (char *)malloc((size_t)size * size * 24 + 32);
+        if (csv == NULL)
+        {
+            fprintf(stderr, "error malloc runBenchmarks\n");
+            exit(1);
+        }
+        size_t length = sprintf(csv, "%d,%d\n", size, size);
+        for (int i = 0; i < size; i++)
+        {
+            for (int j = 0; j < size; j++)
+            {
+                if ((i + j) % 5 != BLACK_NUM)
+                {
+                    length += sprintf(&csv[length], "%d,%d,%d\n", j, i, (i + j) % 5);
+                }
+            }
+        }
+        // the legacy parser splits its input in place, it gets a copy that is not timed like the
+        // zframe_strdup it used to need
+        char *copy = (char *)malloc(length + 1);
+        uint8_t *colors = (uint8_t *)malloc((size_t)size * size);
+        if (copy == NULL || colors == NULL)
+        {
+            fprintf(stderr, "error malloc runBenchmarks\n");
+            exit(1);
+        }
+        memcpy(copy, csv, length + 1);
+        start = nowMs();
+        parseBoardCSVLegacy(&board, copy);
+        double legacy_ms = nowMs() - start;
+        for (int i = 0; i < size; i++)
+        {
+            for (int j = 0; j < size; j++)
+            {
+                colors[(size_t)i * size + j] = getTileColor(&board, i, j);
+            }
+        }
+        start = nowMs();
+        parseBoardCSV(&board, csv, length);
+        double parse_ms = nowMs() - start;
+        int mismatched = 0;
+        for (int i = 0; i < size; i++)
+        {
+            for (int j = 0; j < size; j++)
+            {
+                mismatched += colors[(size_t)i * size + j] != getTileColor(&board, i, j);
+            }
+        }
+        printf("parseBoardCSV %dx%d: %.3f ms, legacy multi-pass parser %.3f ms (%zu bytes, %d tiles differ)\n",
+               size, size, parse_ms, legacy_ms, length, mismatched);
+        free(colors);
+        free(copy);
+        free(csv);
+    }
+
+    freeTiles(&board);
+    return 0;
+}
+
+int main(int argc, char **argv)
 {
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--bench") == 0)
+        {
+            return runBenchmarks();
+        }
+        if (strcmp(argv[i], "--text") == 0)
+        {
+            text_protocol = true;
+        }
+        if (strcmp(argv[i], "--latency") == 0 && i + 1 < argc)
+        {
+            injected_latency_ms = atof(argv[++i]);
+        }
+        if (strcmp(argv[i], "--batch-ms") == 0 && i + 1 < argc)
+        {
+            batch_window_ms = atof(argv[++i]);
+        }
+        if (strcmp(argv[i], "--apply-budget") == 0 && i + 1 < argc)
+        {
+            apply_budget = atoi(argv[++i]);
+            if (apply_budget < 1)
+            {
+                fprintf(stderr, "--apply-budget must be at least 1\n");
+                exit(1);
+            }
+        }
+        if (strcmp(argv[i], "--board") == 0 && i + 1 < argc)
+        {
+            board_name = argv[++i];
+            if (board_name[0] == '\0' || !isBoardName(board_name, strlen(board_name)))
+            {
+                fprintf(stderr, "--board takes 1 to %d letters, digits, '-' and '_', not %s\n", BOARD_NAME_MAX,
+                        board_name);
+                exit(1);
+            }
+        }
+    }
+    if (text_protocol && board_name[0] != '\0')
+    {
+        fprintf(stderr, "--board needs the binary protocol, text clients are always on the default board\n");
+        exit(1);
+    }
+    writeBoardTopic(all_regions_topic, board_name, text_protocol ? "" : TOPIC_REGIONS);
+    writeBoardTopic(global_topic, board_name, TOPIC_GLOBAL);
+
     // create a client ID
 
     uuid_generate_random(binuuid);
     uuid_unparse(binuuid, uuid);
+    client_id = compactClientId(uuid);
 
     // connect zeromq
 
-    requester = zsock_new(ZMQ_REQ);
+    requester = zsock_new(ZMQ_DEALER);
     zsock_connect(requester, "tcp://localhost:5555");
-    subscriber = zsock_new_sub("tcp://localhost:5556", "");
+    // every region of the board until the first frame picks the ones on screen, resizes always
+    subscriber = zsock_new_sub("tcp://localhost:5556", all_regions_topic);
+    zsock_set_subscribe(subscriber, global_topic);
 
     
+    if (!text_protocol)
+    {
+        startSession();
+    }
+
     // initialize our game state
     TileBoard board;
     initTileBoard(&board);
-    sendFetchReq(&board); 
+    // the threads are not running yet, apply the first fetch right away
+    BoardReply first_fetch;
+    if (sendFetchReq(&first_fetch, 0))
+    {
+        applyBoardReply(&board, &first_fetch);
+    }
     SetTargetFPS(60);
 
-    pthread_create(&sub_thread_id, NULL, updateSubThread, &board);
+    pthread_create(&sub_thread_id, NULL, updateSubThread, NULL);
+    pthread_create(&req_thread_id, NULL, networkThread, NULL);
     // init camera
     Camera2D camera = {0};
     camera.target = (Vector2){BOARD_X + 16 * TILE_SIZE, BOARD_Y + 16 * TILE_SIZE};
@@ -571,24 +2773,44 @@ int main(void)
     camera.zoom = 0.8f;
 
     // init selection tile rectangles
-    Tile selectionTiles[5];
+    Rectangle selectionRects[5];
     for (int i = 0; i < 5; i++)
     {
         int tileX = 20;
         int tileY = 80 + i * 60;
-        Tile *selectionTile = &selectionTiles[i];
-        selectionTile->color_num = i;
-        selectionTile->rect.x = tileX;
-        selectionTile->rect.y = tileY;
-        selectionTile->rect.width = SELECTION_BTN_SIZE;
-        selectionTile->rect.height = SELECTION_BTN_SIZE;
+        selectionRects[i] = (Rectangle){tileX, tileY, SELECTION_BTN_SIZE, SELECTION_BTN_SIZE};
     }
 
+    // the regions the board is current for, the first fetch covered all of them
+    uint64_t covered_regions = ALL_REGIONS;
     InitWindow(SCREEN_WIDTH, SCREEN_HEIGHT, "raylib collab tile editor - rewrite");
     while (!WindowShouldClose())
     {
         // UPDATE
         // -------
+        // what the other threads received since the last frame
+        applyRemoteOps(&board);
+        // catch up with what we missed while the subscriber was disconnected
+        if (atomic_exchange(&resync_requested, false))
+        {
+            // the server may have restarted and handed our session id to someone else
+            if (!text_protocol)
+            {
+                enqueueOutbound(OUTBOUND_HELLO, NULL, 0);
+            }
+            enqueueOutbound(OUTBOUND_FETCH, NULL, 0);
+        }
+        // fetch what was lost from the publish stream, the board may already be past it where
+        // the commands around the gap did arrive
+        if (atomic_exchange(&gap_resync_requested, false))
+        {
+            uint32_t since = atomic_load(&gap_since);
+            if ((int32_t)(since - board_seq) > 0)
+            {
+                since = board_seq;
+            }
+            enqueueOutbound(OUTBOUND_FETCH, &since, sizeof(since));
+        }
         // mouse position and camera update
         mouse_pos = GetMousePosition();
         mouse_world_pos = GetScreenToWorld2D(mouse_pos, camera);
@@ -601,6 +2823,10 @@ int main(void)
             camera.target.y -= 2;
         else if (IsKeyDown(KEY_DOWN))
             camera.target.y += 2;
+        if (!text_protocol)
+        {
+            updateViewportRegions(&board, camera, &covered_regions);
+        }
 
         // DRAW
         // ----
@@ -609,30 +2835,81 @@ int main(void)
 
         // Draw TileBoard with camera
         BeginMode2D(camera);
-        for (int i = 0; i < board.rows; i++)
+        drawBoard(&board, camera);
+        // find the tile under the cursor from its world position, a tile in an unallocated chunk
+        // has no rectangle to check collision against
+        int hover_row, hover_col;
+        worldToTile(mouse_world_pos, &hover_row, &hover_col);
+        if (hover_row >= 0 && hover_row < board.rows && hover_col >= 0 && hover_col < board.columns)
         {
-            for (int j = 0; j < board.columns; j++)
+            Rectangle hover_rect = getTileRectangle(hover_row, hover_col);
+            // draw highlight around targeted tile
+            DrawRectangleLinesEx(hover_rect, 2, YELLOW);
+            bool pencil = selected_tool == TOOL_PENCIL;
+            bool flood = selected_tool == TOOL_FLOOD_4 || selected_tool == TOOL_FLOOD_8;
+            bool stroking = pencil && IsMouseButtonDown(MOUSE_BUTTON_LEFT) && checkInBoundary() == true;
+            if (stroking && brush_radius == 0)
             {
-                Tile *tile = getBoardTile(&board, i, j); //&board.tiles[i][j];
-                Color color = getColor(tile->color_num);
-                DrawRectangleRec(tile->rect, color);
-                // check collision while we are here
-                if (CheckCollisionPointRec(mouse_world_pos, tile->rect))
-                {
-                    // draw highlight around targeted tile
-                    DrawRectangleLinesEx(tile->rect, 2, YELLOW);
-                    if (IsMouseButtonDown(MOUSE_BUTTON_LEFT) && checkInBoundary() == true)
-                    {
-                        if (isTileColor(&board, i, j, selected_color_index) == false)
-                        {
-                            tile->color_num = selected_color_index;
-                            printf("painting %d, %d as %d\n", j, i, selected_color_index);
-                            sendUpdateReq(j, i, selected_color_index);
-                        }
-                    }
-                }
+                paintStroke(&board, hover_row, hover_col);
+            }
+            // a brush stamps a circle once per tile the cursor moves to
+            if (stroking && brush_radius > 0 && (hover_row != stroke_row || hover_col != stroke_col))
+            {
+                RemoteOp stamp = {.kind = REMOTE_SHAPE, .opcode = OP_FILL_CIRCLE, .x = hover_col, .y = hover_row,
+                                  .radius = brush_radius, .color_num = selected_color_index};
+                applyBoardShape(&board, &stamp);
+                flushTileUpdates();
+                sendShapeReq(&board, &stamp);
+                stroke_row = hover_row;
+                stroke_col = hover_col;
+            }
+            if (!stroking)
+            {
+                stroke_row = -1;
+            }
+            if (flood && IsMouseButtonPressed(MOUSE_BUTTON_LEFT) && checkInBoundary() == true)
+            {
+                flushTileUpdates();
+                sendFloodFillReq(hover_col, hover_row, selected_color_index, selected_tool == TOOL_FLOOD_8 ? 8 : 4);
+            }
+            if (!pencil && !flood && IsMouseButtonPressed(MOUSE_BUTTON_LEFT) && checkInBoundary() == true)
+            {
+                drag_active = true;
+                drag_row = hover_row;
+                drag_col = hover_col;
+            }
+        }
+        else
+        {
+            // leaving the board ends the stroke instead of drawing a line to where the cursor comes back
+            stroke_row = -1;
+        }
+        // rect, line and circle are painted and sent once the button is released, the tile the drag ends
+        // on is the nearest one on the board
+        if (drag_active && (drag_row >= board.rows || drag_col >= board.columns))
+        {
+            drag_active = false;
+        }
+        if (drag_active)
+        {
+            int end_row = hover_row < 0 ? 0 : hover_row >= board.rows ? board.rows - 1 : hover_row;
+            int end_col = hover_col < 0 ? 0 : hover_col >= board.columns ? board.columns - 1 : hover_col;
+            RemoteOp shape = dragShape(end_row, end_col);
+            drawShapePreview(&shape);
+            if (!IsMouseButtonDown(MOUSE_BUTTON_LEFT))
+            {
+                applyBoardShape(&board, &shape);
+                flushTileUpdates();
+                sendShapeReq(&board, &shape);
+                drag_active = false;
             }
         }
+        // send the stroke so far once the batch window is over, and the rest of it when it ends
+        if (pending_count > 0 &&
+            (nowMs() - pending_since >= batch_window_ms || !IsMouseButtonDown(MOUSE_BUTTON_LEFT)))
+        {
+            flushTileUpdates();
+        }
         EndMode2D();
 
         // Draw UI outside of TileBoard
@@ -646,25 +2923,46 @@ int main(void)
         // Draw color selections
         for (int i = 0; i < 5; i++)
         {
-            Tile *selectionTile = &selectionTiles[i];
             Color tileColor = tileColors[i];
-            DrawRectangleRec(selectionTile->rect, tileColor);
+            DrawRectangleRec(selectionRects[i], tileColor);
 
             if (i == selected_color_index)
             {
-                DrawRectangleLinesEx(selectionTile->rect, 6, YELLOW);
+                DrawRectangleLinesEx(selectionRects[i], 6, YELLOW);
             }
-            DrawRectangleLinesEx(selectionTile->rect, 2, BLACK);
-            if (CheckCollisionPointRec(mouse_pos, selectionTile->rect) &&
+            DrawRectangleLinesEx(selectionRects[i], 2, BLACK);
+            if (CheckCollisionPointRec(mouse_pos, selectionRects[i]) &&
                 IsMouseButtonPressed(MOUSE_BUTTON_LEFT))
             {
-                DrawRectangleLinesEx(selectionTile->rect, 4, BLACK);
+                DrawRectangleLinesEx(selectionRects[i], 4, BLACK);
                 selected_color_index = i;
             }
         }
 
+        // tool selections
+        for (int i = 0; i < TOOL_COUNT; i++)
+        {
+            Rectangle tool_rect = {70, 80 + i * 40, 90, 30};
+            DrawRectangleRec(tool_rect, i == (int)selected_tool ? YELLOW : LIGHTGRAY);
+            DrawRectangleLinesEx(tool_rect, 2, BLACK);
+            DrawText(tool_names[i], tool_rect.x + 8, tool_rect.y + 8, 15, DARKGRAY);
+            if (CheckCollisionPointRec(mouse_pos, tool_rect) && IsMouseButtonPressed(MOUSE_BUTTON_LEFT))
+            {
+                selected_tool = i;
+            }
+        }
+        if (IsKeyPressed(KEY_RIGHT_BRACKET) && brush_radius < SHAPE_MAX_RADIUS)
+        {
+            brush_radius++;
+        }
+        if (IsKeyPressed(KEY_LEFT_BRACKET) && brush_radius > 0)
+        {
+            brush_radius--;
+        }
+        DrawText(TextFormat("brush %d ([ ])", brush_radius), 70, 325, 15, DARKGRAY);
+
         // map size change
-        DrawText("set width: (2 digits)", 20, 385, 15, DARKGRAY);
+        DrawText("set width: (max 100000)", 20, 385, 15, DARKGRAY);
         if (GuiTextBox((Rectangle){20, 400, 80, 30}, width_input_text, 16, text_box_width_edit))
         {
             text_box_width_edit = !text_box_width_edit;
@@ -684,7 +2982,7 @@ int main(void)
                 }
             }
         }
-        DrawText("set height: (2 digits)", 20, 445, 15, DARKGRAY);
+        DrawText("set height: (max 100000)", 20, 445, 15, DARKGRAY);
         if (GuiTextBox((Rectangle){20, 460, 80, 30}, height_input_text, 16,
                        text_box_height_edit))
         {
@@ -707,6 +3005,9 @@ int main(void)
         }
 
         DrawFPS(10, 600);
+        DrawText(TextFormat("backlog %u (max %u), applied %d, gaps %u", remote_backlog, remote_backlog_max,
+                            remote_ops_last_frame, (unsigned)stream_gaps),
+                 100, 604, 10, DARKGRAY);
         if (IsMouseButtonPressed(MOUSE_BUTTON_LEFT))
         {
             DrawCircle(mouse_pos.x, mouse_pos.y, 24, YELLOW);
@@ -716,6 +3017,13 @@ int main(void)
         EndDrawing();
     }
     printf("goodbye\n");
+    flushTileUpdates();
+    atomic_store(&network_running, false);
+    pthread_join(req_thread_id, NULL);
+    printf("sent %lu messages for %lu painted tiles\n", (unsigned long)messages_sent, (unsigned long)tiles_sent);
+    printf("applied %lu remote ops, backlog peaked at %u\n", (unsigned long)remote_ops_applied, remote_backlog_max);
+    printf("%u gaps in the publish stream, %u board seqs skipped, %u region batches lost\n", (unsigned)stream_gaps,
+           (unsigned)stream_seqs_missed, (unsigned)stream_batches_missed);
     freeTiles(&board);
     zsock_destroy(&requester);
     CloseWindow();
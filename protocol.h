@@ -0,0 +1,795 @@
+// wire formats shared by the client and the server
+// everything multi-byte is little-endian, the helpers below read and write it byte by byte
+// so the layout does not depend on the compiler or the platform
+
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// BOARD LAYOUT
+// ------------
+// boards are stored and sent as square chunks of CHUNK_SIZE x CHUNK_SIZE tiles
+#define CHUNK_SHIFT 6
+#define CHUNK_SIZE (1 << CHUNK_SHIFT)
+#define CHUNK_AREA (CHUNK_SIZE * CHUNK_SIZE)
+// largest number of rows or columns a board may be resized to
+#define MAX_BOARD_DIMENSION 100000
+// number of colors a tile can have, color numbers are 0 to PALETTE_SIZE - 1
+#define PALETTE_SIZE 5
+
+// BYTE HELPERS
+// ------------
+static inline void writeU16(uint8_t *out, uint16_t value)
+{
+    out[0] = value & 0xff;
+    out[1] = value >> 8;
+}
+
+static inline void writeU32(uint8_t *out, uint32_t value)
+{
+    out[0] = value & 0xff;
+    out[1] = (value >> 8) & 0xff;
+    out[2] = (value >> 16) & 0xff;
+    out[3] = value >> 24;
+}
+
+static inline void writeU64(uint8_t *out, uint64_t value)
+{
+    writeU32(out, (uint32_t)value);
+    writeU32(out + 4, (uint32_t)(value >> 32));
+}
+
+static inline uint16_t readU16(const uint8_t *in)
+{
+    return (uint16_t)(in[0] | in[1] << 8);
+}
+
+static inline uint32_t readU32(const uint8_t *in)
+{
+    return (uint32_t)in[0] | (uint32_t)in[1] << 8 | (uint32_t)in[2] << 16 | (uint32_t)in[3] << 24;
+}
+
+static inline uint64_t readU64(const uint8_t *in)
+{
+    return (uint64_t)readU32(in) | (uint64_t)readU32(in + 4) << 32;
+}
+
+// BINARY SNAPSHOT
+// ---------------
+// the reply to "client_id\nfetch\nbinary", a compact replacement of the fetch CSV
+/*
+    header (24 bytes)
+      "TSNP" | u8 version | u8 bits per tile | u16 chunk size | u32 rows | u32 columns | u32 chunk count |
+      u32 board seq, the sequence number of the last command applied to the board
+    then for every painted chunk
+      u32 cx | u32 cy | CHUNK_AREA / 2 bytes of color numbers, row-major, two tiles per byte low nibble first
+*/
+#define SNAPSHOT_MAGIC "TSNP"
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_BITS_PER_TILE 4
+#define SNAPSHOT_HEADER_SIZE 24
+#define SNAPSHOT_CHUNK_SIZE (8 + CHUNK_AREA / 2)
+
+typedef struct
+{
+    uint8_t version;
+    uint8_t bits_per_tile;
+    uint16_t chunk_size;
+    uint32_t rows;
+    uint32_t columns;
+    uint32_t chunk_count;
+    uint32_t seq;
+} SnapshotHeader;
+
+// writeSnapshotHeader
+// fills the first SNAPSHOT_HEADER_SIZE bytes of a snapshot
+static inline void writeSnapshotHeader(uint8_t *out, uint32_t rows, uint32_t columns, uint32_t chunk_count,
+                                       uint32_t seq)
+{
+    memcpy(out, SNAPSHOT_MAGIC, 4);
+    out[4] = SNAPSHOT_VERSION;
+    out[5] = SNAPSHOT_BITS_PER_TILE;
+    writeU16(&out[6], CHUNK_SIZE);
+    writeU32(&out[8], rows);
+    writeU32(&out[12], columns);
+    writeU32(&out[16], chunk_count);
+    writeU32(&out[20], seq);
+}
+
+// isSnapshot
+// true if the data starts with the snapshot magic, anything else is treated as a fetch CSV
+static inline bool isSnapshot(const uint8_t *in, size_t size)
+{
+    return size >= 4 && memcmp(in, SNAPSHOT_MAGIC, 4) == 0;
+}
+
+// readSnapshotHeader
+// validates the header against the size of the data, returns false for snapshots this build can not decode
+static inline bool readSnapshotHeader(const uint8_t *in, size_t size, SnapshotHeader *header)
+{
+    if (size < SNAPSHOT_HEADER_SIZE || !isSnapshot(in, size))
+    {
+        return false;
+    }
+    header->version = in[4];
+    header->bits_per_tile = in[5];
+    header->chunk_size = readU16(&in[6]);
+    header->rows = readU32(&in[8]);
+    header->columns = readU32(&in[12]);
+    header->chunk_count = readU32(&in[16]);
+    header->seq = readU32(&in[20]);
+    if (header->version != SNAPSHOT_VERSION || header->bits_per_tile != SNAPSHOT_BITS_PER_TILE ||
+        header->chunk_size != CHUNK_SIZE)
+    {
+        return false;
+    }
+    if (header->rows < 1 || header->rows > MAX_BOARD_DIMENSION || header->columns < 1 ||
+        header->columns > MAX_BOARD_DIMENSION)
+    {
+        return false;
+    }
+    return (size - SNAPSHOT_HEADER_SIZE) / SNAPSHOT_CHUNK_SIZE >= header->chunk_count;
+}
+
+// packChunkColors
+// packs the CHUNK_AREA color numbers of a chunk into CHUNK_AREA / 2 bytes
+static inline void packChunkColors(uint8_t *out, const uint8_t *colors)
+{
+    for (int i = 0; i < CHUNK_AREA / 2; i++)
+    {
+        out[i] = (colors[2 * i] & 0x0f) | (colors[2 * i + 1] << 4);
+    }
+}
+
+// unpackChunkColors
+// reverses packChunkColors
+static inline void unpackChunkColors(uint8_t *colors, const uint8_t *in)
+{
+    for (int i = 0; i < CHUNK_AREA / 2; i++)
+    {
+        colors[2 * i] = in[i] & 0x0f;
+        colors[2 * i + 1] = in[i] >> 4;
+    }
+}
+
+// COMMAND FRAMES
+// ---------------
+// the binary replacement of the "client_id\ncommand\nargs" strings, one command per zeromq frame
+/*
+    header (12 bytes)
+      u8 COMMAND_MAGIC | u8 opcode | u16 payload length | u32 client id | u32 sequence number
+    payload by opcode
+      OP_UPDATE  u64 packed tile (see packTile)
+      OP_RESIZE  u32 rows | u32 columns
+      OP_FETCH   u8 FETCH_CSV or FETCH_SNAPSHOT, answered with the CSV or the binary snapshot
+      OP_FETCH_SINCE  u32 board seq the client is at, answered with a delta or a binary snapshot
+      OP_BATCH_UPDATE  1 to BATCH_MAX_TILES u64 packed tiles, applied all or none
+      OP_FETCH_REGION  u16 first region x | u16 first region y | u16 last region x | u16 last region y,
+                       answered with a binary snapshot of only the chunks in those regions (see TOPICS)
+      OP_PUBLISH_BATCH  u32 board seq before the batch | 1 to PUBLISH_BATCH_MAX entries of
+                        u32 client id | u64 packed tile, only published by the server
+      OP_PUBLISH_TICK  u32 board seq before the tick | 1 to PUBLISH_BATCH_MAX u32 regions (region y << 16 |
+                       region x) in ascending order, published under TOPIC_GLOBAL after the
+                       OP_PUBLISH_BATCH frames of a tick, one per listed region
+      OP_FILL_RECT  u64 packed tile of one corner with the color | u64 packed tile of the opposite corner,
+                    whose color is ignored. paints the rectangle between them, both corners included
+      OP_LINE    u64 packed tile of the start with the color | u64 packed tile of the end, paints the tiles
+                 rasterizeLine gives for them (see SHAPES)
+      OP_FILL_CIRCLE  u64 packed tile of the center with the color | u32 radius, 0 to SHAPE_MAX_RADIUS.
+                      paints the tiles of rasterizeCircle that are on the board, a brush stamp
+      OP_FLOOD_FILL  u64 packed seed tile with the color | u8 4 or 8, paints the tiles of the color of the
+                     seed that are 4- or 8-connected to it
+      OP_FILL_SPANS  u8 color | 1 to FILL_SPANS_MAX u64 spans (see packSpan) inside one region, only
+                     published by the server for the tiles a flood fill painted
+      OP_HELLO   u32 client id derived from the uuid (see compactClientId) | 0 to BOARD_NAME_MAX bytes of
+                 board name, sent first by a binary client. every later request of the session goes to
+                 that board, no name is the default board (see BOARD NAMES)
+      OP_ACK     u8 ACK_OK or ACK_REJECTED, the server reply to an update or resize, sequence number
+                 of the command it answers
+      OP_WELCOME u32 session id, the server reply to OP_HELLO. the client uses the session id as its
+                 client id in every frame after it, session ids have SESSION_ID_FLAG set and are unique
+                 among the clients of one server run. a hello with the client id and board of an earlier
+                 one, a client reconnecting, gets the session of that hello back
+    the server publishes applied commands as command frames too, with the sequence number replaced by
+    the board seq: every applied command bumps the board seq by one, a batch by its tile count.
+    the updates applied during a publish tick go out as one OP_PUBLISH_BATCH with the board seq after
+    its last update, without the updates that a later one in the same tick painted over. resizes are
+    published on their own after the updates before them. every OP_FILL_RECT, OP_LINE and OP_FILL_CIRCLE
+    bumps the board seq by one, and the shapes applied one after the other make a tick of their own: for
+    every region one of them paints in, one message with the region topic and the frames
+    the shapes were sent as, in the order they were applied and with the board seq after the tick, then the
+    OP_PUBLISH_TICK frames listing those regions. every client rasterizes a shape the same way and paints it
+    inside the region it came for only. a flood fill also bumps the seq by one, but only the server knows the
+    whole board, so it publishes the tiles it painted as OP_FILL_SPANS frames under their region topics,
+    followed by OP_PUBLISH_TICK frames listing those regions, all of them with the board seq after the fill.
+    shapes painting more than SHAPE_MAX_TILES tiles are rejected, on a server publishing text more than
+    BATCH_MAX_TILES.
+    every subscriber gets the OP_PUBLISH_TICK frames and resizes, whose board seqs follow on from each
+    other, so a client notices a skipped tick when the seq before it is not the last one it saw, and a
+    lost batch when a region it is subscribed to is listed without its batch having arrived
+*/
+// the first byte of a text command is a hex digit of the client uuid or the f of "fetch",
+// so a frame starting with COMMAND_MAGIC is always binary
+#define COMMAND_MAGIC 0xC0
+#define COMMAND_HEADER_SIZE 12
+
+typedef enum
+{
+    OP_UPDATE = 1,
+    OP_RESIZE = 2,
+    OP_FETCH = 3,
+    OP_FETCH_SINCE = 4,
+    OP_BATCH_UPDATE = 5,
+    OP_PUBLISH_BATCH = 6,
+    OP_FETCH_REGION = 7,
+    OP_HELLO = 8,
+    OP_PUBLISH_TICK = 9,
+    OP_FILL_RECT = 10,
+    OP_LINE = 11,
+    OP_FILL_CIRCLE = 12,
+    OP_FLOOD_FILL = 13,
+    OP_FILL_SPANS = 14,
+    OP_ACK = 0x80,
+    OP_WELCOME = 0x81,
+} Opcode;
+
+typedef enum
+{
+    FETCH_CSV = 0,
+    FETCH_SNAPSHOT = 1,
+} FetchFormat;
+
+typedef enum
+{
+    ACK_OK = 0,
+    ACK_REJECTED = 1,
+} AckStatus;
+
+typedef struct
+{
+    uint8_t opcode;
+    uint16_t payload_length;
+    uint32_t client_id;
+    uint32_t seq;
+    // points into the frame, payload_length bytes
+    const uint8_t *payload;
+} CommandHeader;
+
+// set in every session id, clients without a session keep the id derived from their uuid
+#define SESSION_ID_FLAG 0x80000000u
+
+// the most tiles in one OP_BATCH_UPDATE, keeps its payload length in a u16
+#define BATCH_MAX_TILES 4096
+// the longest board name in an OP_HELLO
+#define BOARD_NAME_MAX 32
+
+// the most entries in one OP_PUBLISH_BATCH, same limit
+#define PUBLISH_BATCH_MAX 4096
+#define PUBLISH_ENTRY_SIZE 12
+
+// the most spans in one OP_FILL_SPANS
+#define FILL_SPANS_MAX 4096
+
+// commandPayloadLength
+// the payload length every frame of an opcode must have, -1 for unknown and variable length opcodes
+static inline int commandPayloadLength(uint8_t opcode)
+{
+    switch (opcode)
+    {
+    case OP_UPDATE:
+        return 8;
+    case OP_RESIZE:
+    case OP_FETCH_REGION:
+        return 8;
+    case OP_FETCH:
+    case OP_ACK:
+        return 1;
+    case OP_FETCH_SINCE:
+    case OP_WELCOME:
+        return 4;
+    case OP_FILL_RECT:
+    case OP_LINE:
+        return 16;
+    case OP_FILL_CIRCLE:
+        return 12;
+    case OP_FLOOD_FILL:
+        return 9;
+    }
+    return -1;
+}
+
+// isCommandFrame
+// true if the frame is a binary command and not a text one
+static inline bool isCommandFrame(const uint8_t *in, size_t size)
+{
+    return size >= 1 && in[0] == COMMAND_MAGIC;
+}
+
+// readCommandHeader
+// bounds checks a binary command frame, returns false if it is truncated, too long or of an unknown opcode
+static inline bool readCommandHeader(const uint8_t *in, size_t size, CommandHeader *header)
+{
+    if (size < COMMAND_HEADER_SIZE || in[0] != COMMAND_MAGIC)
+    {
+        return false;
+    }
+    header->opcode = in[1];
+    header->payload_length = readU16(&in[2]);
+    header->client_id = readU32(&in[4]);
+    header->seq = readU32(&in[8]);
+    header->payload = &in[COMMAND_HEADER_SIZE];
+    if (header->opcode == OP_BATCH_UPDATE)
+    {
+        return header->payload_length >= 8 && header->payload_length <= BATCH_MAX_TILES * 8 &&
+               header->payload_length % 8 == 0 && size == COMMAND_HEADER_SIZE + (size_t)header->payload_length;
+    }
+    if (header->opcode == OP_PUBLISH_BATCH)
+    {
+        int entries_length = header->payload_length - 4;
+        return entries_length >= PUBLISH_ENTRY_SIZE && entries_length <= PUBLISH_BATCH_MAX * PUBLISH_ENTRY_SIZE &&
+               entries_length % PUBLISH_ENTRY_SIZE == 0 &&
+               size == COMMAND_HEADER_SIZE + (size_t)header->payload_length;
+    }
+    if (header->opcode == OP_PUBLISH_TICK)
+    {
+        int regions_length = header->payload_length - 4;
+        return regions_length >= 4 && regions_length <= PUBLISH_BATCH_MAX * 4 && regions_length % 4 == 0 &&
+               size == COMMAND_HEADER_SIZE + (size_t)header->payload_length;
+    }
+    if (header->opcode == OP_FILL_SPANS)
+    {
+        int spans_length = header->payload_length - 1;
+        return spans_length >= 8 && spans_length <= FILL_SPANS_MAX * 8 && spans_length % 8 == 0 &&
+               size == COMMAND_HEADER_SIZE + (size_t)header->payload_length;
+    }
+    if (header->opcode == OP_HELLO)
+    {
+        return header->payload_length >= 4 && header->payload_length <= 4 + BOARD_NAME_MAX &&
+               size == COMMAND_HEADER_SIZE + (size_t)header->payload_length;
+    }
+    int expected_length = commandPayloadLength(header->opcode);
+    return expected_length >= 0 && header->payload_length == expected_length &&
+           size == COMMAND_HEADER_SIZE + (size_t)header->payload_length;
+}
+
+// writeCommandHeaderLength
+// fills the first COMMAND_HEADER_SIZE bytes of a frame and returns the size of the whole frame
+static inline size_t writeCommandHeaderLength(uint8_t *out, uint8_t opcode, uint16_t payload_length,
+                                              uint32_t client_id, uint32_t seq)
+{
+    out[0] = COMMAND_MAGIC;
+    out[1] = opcode;
+    writeU16(&out[2], payload_length);
+    writeU32(&out[4], client_id);
+    writeU32(&out[8], seq);
+    return COMMAND_HEADER_SIZE + payload_length;
+}
+
+// writeCommandHeader
+// writeCommandHeaderLength for the opcodes with a fixed payload length
+static inline size_t writeCommandHeader(uint8_t *out, uint8_t opcode, uint32_t client_id, uint32_t seq)
+{
+    return writeCommandHeaderLength(out, opcode, commandPayloadLength(opcode), client_id, seq);
+}
+
+// packTile
+// a tile coordinate and color in one u64, x in bits 0-23, y in bits 24-47 and the color in bits 48-55
+static inline uint64_t packTile(uint32_t x, uint32_t y, uint8_t color_num)
+{
+    return (uint64_t)(x & 0xffffff) | (uint64_t)(y & 0xffffff) << 24 | (uint64_t)color_num << 48;
+}
+
+static inline void unpackTile(uint64_t packed, int *x, int *y, int *color_num)
+{
+    *x = packed & 0xffffff;
+    *y = (packed >> 24) & 0xffffff;
+    *color_num = (packed >> 48) & 0xff;
+}
+
+// isShapeOpcode
+// true for the opcodes that paint a shape (see SHAPES)
+static inline bool isShapeOpcode(uint8_t opcode)
+{
+    return opcode == OP_FILL_RECT || opcode == OP_LINE || opcode == OP_FILL_CIRCLE || opcode == OP_FLOOD_FILL;
+}
+
+// packSpan
+// tiles x to x + length - 1 of row y in one u64, x in bits 0-23, y in bits 24-47 and length - 1 in bits 48-63
+static inline uint64_t packSpan(uint32_t x, uint32_t y, int length)
+{
+    return (uint64_t)(x & 0xffffff) | (uint64_t)(y & 0xffffff) << 24 | (uint64_t)(length - 1) << 48;
+}
+
+static inline void unpackSpan(uint64_t packed, int *x, int *y, int *length)
+{
+    *x = packed & 0xffffff;
+    *y = (packed >> 24) & 0xffffff;
+    *length = (int)(packed >> 48) + 1;
+}
+
+// the largest frame of any fixed size opcode
+#define COMMAND_FRAME_MAX (COMMAND_HEADER_SIZE + 16)
+
+static inline size_t encodeUpdate(uint8_t *out, uint32_t client_id, uint32_t seq, int x, int y, int color_num)
+{
+    writeU64(&out[COMMAND_HEADER_SIZE], packTile(x, y, color_num));
+    return writeCommandHeader(out, OP_UPDATE, client_id, seq);
+}
+
+static inline size_t encodeResize(uint8_t *out, uint32_t client_id, uint32_t seq, int rows, int columns)
+{
+    writeU32(&out[COMMAND_HEADER_SIZE], rows);
+    writeU32(&out[COMMAND_HEADER_SIZE + 4], columns);
+    return writeCommandHeader(out, OP_RESIZE, client_id, seq);
+}
+
+static inline size_t encodeFetch(uint8_t *out, uint32_t client_id, uint32_t seq, FetchFormat format)
+{
+    out[COMMAND_HEADER_SIZE] = format;
+    return writeCommandHeader(out, OP_FETCH, client_id, seq);
+}
+
+static inline size_t encodeFetchRegion(uint8_t *out, uint32_t client_id, uint32_t seq, int rx0, int ry0, int rx1,
+                                       int ry1)
+{
+    writeU16(&out[COMMAND_HEADER_SIZE], rx0);
+    writeU16(&out[COMMAND_HEADER_SIZE + 2], ry0);
+    writeU16(&out[COMMAND_HEADER_SIZE + 4], rx1);
+    writeU16(&out[COMMAND_HEADER_SIZE + 6], ry1);
+    return writeCommandHeader(out, OP_FETCH_REGION, client_id, seq);
+}
+
+static inline size_t encodeFetchSince(uint8_t *out, uint32_t client_id, uint32_t seq, uint32_t board_seq)
+{
+    writeU32(&out[COMMAND_HEADER_SIZE], board_seq);
+    return writeCommandHeader(out, OP_FETCH_SINCE, client_id, seq);
+}
+
+// batchFrameSize
+// the size of an OP_BATCH_UPDATE frame of tile_count tiles
+static inline size_t batchFrameSize(int tile_count)
+{
+    return COMMAND_HEADER_SIZE + (size_t)tile_count * 8;
+}
+
+// encodeBatchUpdate
+// out needs batchFrameSize(tile_count) bytes, tiles are packed with packTile
+static inline size_t encodeBatchUpdate(uint8_t *out, uint32_t client_id, uint32_t seq, const uint64_t *tiles,
+                                       int tile_count)
+{
+    for (int i = 0; i < tile_count; i++)
+    {
+        writeU64(&out[COMMAND_HEADER_SIZE + i * 8], tiles[i]);
+    }
+    return writeCommandHeaderLength(out, OP_BATCH_UPDATE, tile_count * 8, client_id, seq);
+}
+
+// encodeFillRect
+// the rectangle between the corners x0, y0 and x1, y1 in any order
+static inline size_t encodeFillRect(uint8_t *out, uint32_t client_id, uint32_t seq, int x0, int y0, int x1, int y1,
+                                    int color_num)
+{
+    writeU64(&out[COMMAND_HEADER_SIZE], packTile(x0, y0, color_num));
+    writeU64(&out[COMMAND_HEADER_SIZE + 8], packTile(x1, y1, 0));
+    return writeCommandHeader(out, OP_FILL_RECT, client_id, seq);
+}
+
+static inline size_t encodeLine(uint8_t *out, uint32_t client_id, uint32_t seq, int x0, int y0, int x1, int y1,
+                                int color_num)
+{
+    writeU64(&out[COMMAND_HEADER_SIZE], packTile(x0, y0, color_num));
+    writeU64(&out[COMMAND_HEADER_SIZE + 8], packTile(x1, y1, 0));
+    return writeCommandHeader(out, OP_LINE, client_id, seq);
+}
+
+static inline size_t encodeFillCircle(uint8_t *out, uint32_t client_id, uint32_t seq, int x, int y, int radius,
+                                      int color_num)
+{
+    writeU64(&out[COMMAND_HEADER_SIZE], packTile(x, y, color_num));
+    writeU32(&out[COMMAND_HEADER_SIZE + 8], radius);
+    return writeCommandHeader(out, OP_FILL_CIRCLE, client_id, seq);
+}
+
+// encodeFloodFill
+// connectivity is 4 or 8
+static inline size_t encodeFloodFill(uint8_t *out, uint32_t client_id, uint32_t seq, int x, int y, int color_num,
+                                     int connectivity)
+{
+    writeU64(&out[COMMAND_HEADER_SIZE], packTile(x, y, color_num));
+    out[COMMAND_HEADER_SIZE + 8] = connectivity;
+    return writeCommandHeader(out, OP_FLOOD_FILL, client_id, seq);
+}
+
+static inline size_t encodeAck(uint8_t *out, uint32_t client_id, uint32_t seq, AckStatus status)
+{
+    out[COMMAND_HEADER_SIZE] = status;
+    return writeCommandHeader(out, OP_ACK, client_id, seq);
+}
+
+// the size of an OP_HELLO frame with the longest board name
+#define HELLO_FRAME_MAX (COMMAND_HEADER_SIZE + 4 + BOARD_NAME_MAX)
+
+// encodeHello
+// board is the board name, "" for the default board. out needs HELLO_FRAME_MAX bytes
+static inline size_t encodeHello(uint8_t *out, uint32_t client_id, uint32_t seq, const char *board)
+{
+    size_t name_length = strlen(board);
+    writeU32(&out[COMMAND_HEADER_SIZE], client_id);
+    memcpy(&out[COMMAND_HEADER_SIZE + 4], board, name_length);
+    return writeCommandHeaderLength(out, OP_HELLO, 4 + name_length, client_id, seq);
+}
+
+static inline size_t encodeWelcome(uint8_t *out, uint32_t session_id, uint32_t seq)
+{
+    writeU32(&out[COMMAND_HEADER_SIZE], session_id);
+    return writeCommandHeader(out, OP_WELCOME, session_id, seq);
+}
+
+// SHAPES
+// -------
+// the tiles OP_FILL_RECT, OP_LINE and OP_FILL_CIRCLE paint, as runs of a row. the server and every
+// client rasterize shapes with these, so they all paint exactly the same tiles. fill_row is called
+// once per run with its row y and its columns x0 <= x1, integer math only so no platform rounds
+// differently
+
+// radius of the largest OP_FILL_CIRCLE
+#define SHAPE_MAX_RADIUS 2047
+// the most tiles one shape may paint, (2 * SHAPE_MAX_RADIUS + 1)^2 is below it
+#define SHAPE_MAX_TILES (1 << 24)
+
+typedef void (*ShapeRowFn)(void *context, int y, int x0, int x1);
+
+// rasterizeRect
+// every tile between the corners x0, y0 and x1, y1 in any order
+static inline void rasterizeRect(int x0, int y0, int x1, int y1, ShapeRowFn fill_row, void *context)
+{
+    int left = x0 < x1 ? x0 : x1;
+    int right = x0 < x1 ? x1 : x0;
+    int top = y0 < y1 ? y0 : y1;
+    int bottom = y0 < y1 ? y1 : y0;
+    for (int y = top; y <= bottom; y++)
+    {
+        fill_row(context, y, left, right);
+    }
+}
+
+// rectTileCount
+// the number of tiles rasterizeRect paints
+static inline int64_t rectTileCount(int x0, int y0, int x1, int y1)
+{
+    return ((int64_t)(x0 < x1 ? x1 - x0 : x0 - x1) + 1) * ((int64_t)(y0 < y1 ? y1 - y0 : y0 - y1) + 1);
+}
+
+// rasterizeLine
+// the tiles of a Bresenham line from x0, y0 to x1, y1, both ends included. every step moves to one of
+// the 8 neighbors of a tile, so the line never has holes. the tiles it visits in one row form a run
+static inline void rasterizeLine(int x0, int y0, int x1, int y1, ShapeRowFn fill_row, void *context)
+{
+    int dx = x0 < x1 ? x1 - x0 : x0 - x1;
+    int dy = y0 < y1 ? y0 - y1 : y1 - y0;
+    int step_x = x0 < x1 ? 1 : -1;
+    int step_y = y0 < y1 ? 1 : -1;
+    int error = dx + dy;
+    int run_x = x0;
+    while (x0 != x1 || y0 != y1)
+    {
+        int error2 = 2 * error;
+        int x = x0;
+        if (error2 >= dy)
+        {
+            error += dy;
+            x0 += step_x;
+        }
+        if (error2 <= dx)
+        {
+            error += dx;
+            fill_row(context, y0, run_x < x ? run_x : x, run_x < x ? x : run_x);
+            y0 += step_y;
+            run_x = x0;
+        }
+    }
+    fill_row(context, y0, run_x < x0 ? run_x : x0, run_x < x0 ? x0 : run_x);
+}
+
+// ceilDiv
+// n / d rounded up for d > 0
+static inline int64_t ceilDiv(int64_t n, int64_t d)
+{
+    return n <= 0 ? -(-n / d) : (n + d - 1) / d;
+}
+
+// rasterizeLineRows
+// the runs rasterizeLine paints in rows top..bottom, without walking the rest of the line. after i steps
+// in x and j in y the error of rasterizeLine is a * (j + 1) - b * (i + 1), with a and b the distances in x
+// and y, so the steps a row ends and starts with follow from the row alone
+static inline void rasterizeLineRows(int x0, int y0, int x1, int y1, int top, int bottom, ShapeRowFn fill_row,
+                                     void *context)
+{
+    int64_t a = x0 < x1 ? x1 - x0 : x0 - x1;
+    int64_t b = y0 < y1 ? y1 - y0 : y0 - y1;
+    int step_x = x0 < x1 ? 1 : -1;
+    int step_y = y0 < y1 ? 1 : -1;
+    // the rows of the line as steps j from y0
+    int64_t first_j = step_y > 0 ? top - y0 : y0 - bottom;
+    int64_t last_j = step_y > 0 ? bottom - y0 : y0 - top;
+    first_j = first_j < 0 ? 0 : first_j;
+    last_j = last_j > b ? b : last_j;
+    for (int64_t j = first_j; j <= last_j; j++)
+    {
+        int64_t first_i = 0;
+        if (j > 0)
+        {
+            // after the step in y that ends the row before, which moves in x too while the error allows it
+            int64_t before = ceilDiv(2 * a * (j - 1) + a, 2 * b) - 1;
+            before = before < 0 ? 0 : before;
+            int64_t last_x_step = (2 * a * j + b) / (2 * b);
+            first_i = before + 1 < last_x_step ? before + 1 : last_x_step;
+        }
+        // the row ends with the first step whose error lets the line move in y
+        int64_t last_i = j == b ? a : ceilDiv(2 * a * j + a, 2 * b) - 1;
+        last_i = last_i < first_i ? first_i : last_i;
+        int run_x0 = x0 + step_x * (int)first_i;
+        int run_x1 = x0 + step_x * (int)last_i;
+        fill_row(context, y0 + step_y * (int)j, run_x0 < run_x1 ? run_x0 : run_x1, run_x0 < run_x1 ? run_x1 : run_x0);
+    }
+}
+
+// rasterizeCircleRows
+// the runs rasterizeCircle paints in rows top..bottom of a board with columns columns
+static inline void rasterizeCircleRows(int x, int y, int radius, int top, int bottom, int columns,
+                                       ShapeRowFn fill_row, void *context)
+{
+    int64_t limit = (int64_t)radius * radius + radius;
+    int64_t half = 0;
+    int first_dy = top - y > -radius ? top - y : -radius;
+    int last_dy = bottom - y < radius ? bottom - y : radius;
+    for (int dy = first_dy; dy <= last_dy; dy++)
+    {
+        int64_t dy2 = (int64_t)dy * dy;
+        while ((half + 1) * (half + 1) + dy2 <= limit)
+        {
+            half++;
+        }
+        while (half * half + dy2 > limit)
+        {
+            half--;
+        }
+        int64_t x0 = x - half < 0 ? 0 : x - half;
+        int64_t x1 = x + half >= columns ? columns - 1 : x + half;
+        if (x0 <= x1)
+        {
+            fill_row(context, y + dy, (int)x0, (int)x1);
+        }
+    }
+}
+
+// rasterizeCircle
+// the tiles of a filled circle around x, y that are on a board of rows x columns, the ones whose
+// center is at most radius + 1/2 away from the center of x, y (dx^2 + dy^2 <= radius^2 + radius).
+// radius 0 is the center tile alone
+static inline void rasterizeCircle(int x, int y, int radius, int rows, int columns, ShapeRowFn fill_row,
+                                   void *context)
+{
+    rasterizeCircleRows(x, y, radius, 0, rows - 1, columns, fill_row, context);
+}
+
+// TOPICS
+// ------
+// published command frames are sent after a topic frame, one per message or every shape of a tick for a
+// region in one, so clients can subscribe to just the part of the board they look at. the updates of a
+// publish tick are split by region, REGION_SIZE x REGION_SIZE tiles, and published under
+// "r<region x>,<region y>;", and so are shapes and flood fills. resizes are published under TOPIC_GLOBAL.
+// the ';' keeps one region topic from being a prefix of another.
+// the topics of a named board start with "b<name>;", the default board keeps the bare ones
+#define REGION_SHIFT 8
+#define REGION_SIZE (1 << REGION_SHIFT)
+#define TOPIC_GLOBAL "g;"
+// the prefix every region topic of a board starts with after its board prefix
+#define TOPIC_REGIONS "r"
+#define TOPIC_MAX (BOARD_NAME_MAX + 24)
+
+// writeBoardTopic
+// write the topic with board prefix and rest into out, rest may be "" for the prefix alone
+static inline void writeBoardTopic(char *out, const char *board, const char *rest)
+{
+    snprintf(out, TOPIC_MAX, "%s%s%s%s", board[0] != '\0' ? "b" : "", board, board[0] != '\0' ? ";" : "", rest);
+}
+
+static inline void writeRegionTopic(char *out, const char *board, int rx, int ry)
+{
+    char region[24];
+    snprintf(region, sizeof(region), "r%d,%d;", rx, ry);
+    writeBoardTopic(out, board, region);
+}
+
+// BOARD NAMES
+// -----------
+// one server serves many boards, a client picks one by name in its OP_HELLO. names are 1 to
+// BOARD_NAME_MAX letters, digits, '-' and '_' so they are safe in file names and topics, the
+// empty name is the default board
+
+// isBoardName
+// true if name can name a board, "" included
+static inline bool isBoardName(const char *name, size_t length)
+{
+    if (length > BOARD_NAME_MAX)
+    {
+        return false;
+    }
+    for (size_t i = 0; i < length; i++)
+    {
+        char c = name[i];
+        if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '-' || c == '_'))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// DELTA
+// -----
+// the reply to OP_FETCH_SINCE when the server still has every command the client missed
+/*
+    header (16 bytes)
+      "TDLT" | u32 board seq the client is at | u32 board seq after the commands | u32 command count
+    then the commands in the order they were applied, as the command frames the server published
+    (COMMAND_FRAME_MAX bytes each, zero or more bytes of padding after the frame, sequence number = board
+    seq). a flood fill is not kept, a client that missed one gets a snapshot
+*/
+#define DELTA_MAGIC "TDLT"
+#define DELTA_HEADER_SIZE 16
+
+typedef struct
+{
+    uint32_t since;
+    uint32_t seq;
+    uint32_t count;
+    // points into the reply, count frames of COMMAND_FRAME_MAX bytes
+    const uint8_t *frames;
+} DeltaHeader;
+
+static inline void writeDeltaHeader(uint8_t *out, uint32_t since, uint32_t seq, uint32_t count)
+{
+    memcpy(out, DELTA_MAGIC, 4);
+    writeU32(&out[4], since);
+    writeU32(&out[8], seq);
+    writeU32(&out[12], count);
+}
+
+// readDeltaHeader
+// validates the header against the size of the reply, returns false if it is not a delta
+static inline bool readDeltaHeader(const uint8_t *in, size_t size, DeltaHeader *header)
+{
+    if (size < DELTA_HEADER_SIZE || memcmp(in, DELTA_MAGIC, 4) != 0)
+    {
+        return false;
+    }
+    header->since = readU32(&in[4]);
+    header->seq = readU32(&in[8]);
+    header->count = readU32(&in[12]);
+    header->frames = &in[DELTA_HEADER_SIZE];
+    return (size - DELTA_HEADER_SIZE) / COMMAND_FRAME_MAX >= header->count;
+}
+
+// compactClientId
+// the 32 bit client id used in command frames, the first 8 hex digits of the client uuid string,
+// which are the first 4 bytes of the binary uuid. text commands are mapped to the same id
+static inline uint32_t compactClientId(const char *uuid_str)
+{
+    uint32_t client_id = 0;
+    for (int i = 0; i < 8 && uuid_str[i] != '\0'; i++)
+    {
+        char c = uuid_str[i];
+        int digit = (c >= '0' && c <= '9') ? c - '0' : (c >= 'a' && c <= 'f') ? c - 'a' + 10 : (c >= 'A' && c <= 'F') ? c - 'A' + 10 : 0;
+        client_id = client_id << 4 | digit;
+    }
+    return client_id;
+}
+
+#endif
@@ -1 +1 @@
-gcc -fanalyzer -fsanitize=address -g -Wall -o server server.c -lczmq  #-I /usr/local/include/hiredis -lhiredis 
+gcc -fanalyzer -fsanitize=address -g -Wall -o server server.c -lczmq -lpthread  #-I /usr/local/include/hiredis -lhiredis 
@@ -1,426 +1,4691 @@
+// for sync_file_range
+#define _GNU_SOURCE
 #include <czmq.h>
 #include <hiredis/hiredis.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <signal.h>
 #include <zsock.h>
 #include <string.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "../protocol.h"
 
 // CONSTANT PROGRAM VARIABLES
 // --------------------------
 
 #define INIT_COLUMNS 32
 #define INIT_ROWS 32
+// applied commands kept for fetch_since, a client that missed more gets a snapshot. power of two
+#define OP_RING_CAPACITY 65536
 
 // redisContext* redis_context;
 // redisReply* redis_reply;
 
-zsock_t *publisher;
-zsock_t *responder;
+// the main thread publishes on the PUB socket and answers on a ROUTER socket, clients keep many requests
+// in flight and every reply is routed back by its envelope. in a worker both are PUSH sockets the main
+// thread forwards from (see WORKERS)
+_Thread_local zsock_t *publisher;
+_Thread_local zsock_t *responder;
+// set by --text-pub, publish text commands so clients from before the binary protocol keep working
+bool text_pub = false;
+// set by --tick-ms and --tick-ops, updates are published together once the first of them is tick_ms old
+// or tick_ops of them are waiting
+int tick_ms = 5;
+int tick_ops = 1024;
+// set by --stats-s, seconds between printing what every client sent, 0 to never print it
+int stats_s = 10;
+// set by --store, --board-file and --snapshot, the files of the default board. named boards keep theirs
+// in boards_dir (see DOCUMENTS)
+const char *store_path = "store.db";
+const char *board_file_path = "board.map";
+const char *snapshot_path = "snapshot.tsnf";
+// set by --msync-ms, milliseconds between starting the writeback of the dirty pages of a board file, 0 to
+// leave it to the kernel until the board is closed
+int msync_ms = 0;
+// set by --snapshot-s, seconds between background snapshots of a board that changed, 0 to never take them
+int snapshot_s = 60;
+// set by --boards-dir, --evict-s and --workers, the directory of the files of named boards, seconds a
+// board stays loaded without requests (0 to keep every board loaded) and threads the boards are spread
+// over, the number of cores by default
+const char *boards_dir = "boards";
+int evict_s = 60;
+int worker_count = 0;
+
+// the board is stored as square chunks of CHUNK_SIZE x CHUNK_SIZE tiles (see protocol.h) that are only
+// allocated once a tile in them is painted, so memory scales with the painted area and not with rows * columns
 
-// Tile struct that is different from client because it does not need to store the rectangle width/height
-typedef struct Tile
+// ChunkKey
+// chunk coordinates, chunk (cx, cy) holds columns cx * CHUNK_SIZE.. and rows cy * CHUNK_SIZE..
+typedef struct
 {
-  int x;
-  int y;
-  int color_num;
-} Tile;
+  int cx;
+  int cy;
+} ChunkKey;
+
+// SharedBuffer
+// an encoded fetch reply that is handed to zeromq without copying. the owner holds one reference and every
+// message in flight holds another, zeromq drops its reference from its io thread once the message is sent
+typedef struct
+{
+  uint8_t *data;
+  size_t size;
+  atomic_int refs;
+} SharedBuffer;
+
+// CsvChunkLayout
+// where the lines of a chunk are in a fetch CSV, lets an update find the byte of its tile color
+typedef struct
+{
+  // offset of the first line of the chunk column, the lines of column x = cx * CHUNK_SIZE
+  size_t column_offset;
+  // lines per x and the sum of the digits of their y over the whole chunk column
+  int column_rows;
+  size_t column_row_digits;
+  // the same for the chunks above this one in the chunk column
+  int rows_before;
+  size_t row_digits_before;
+} CsvChunkLayout;
 
-// Server Board struct that is similar to the client TileBoard, but the tiles do not contain rectangles with width/height
+// FetchCache
+// an encoded fetch reply and the board version it was encoded at
+typedef struct
+{
+  SharedBuffer *buffer;
+  uint32_t version;
+  // per pool chunk, only for the CSV
+  CsvChunkLayout *layout;
+} FetchCache;
+
+// Server Board struct that is similar to the client TileBoard, but it does not store rectangles.
+// every allocated chunk is a row-major CHUNK_SIZE x CHUNK_SIZE plane of color numbers inside one
+// chunk pool, a tile is a single byte and tiles in unallocated chunks have color 0
 typedef struct
 {
   int rows;
   int columns;
-  Tile **tiles;
+  // chunk pool, chunk i owns chunk_colors[i * CHUNK_AREA] and is located at chunk_keys[i]
+  int chunk_count;
+  int chunk_capacity;
+  uint8_t *chunk_colors;
+  ChunkKey *chunk_keys;
+  // chunk directory, open addressing hash table of chunk index + 1, 0 marks an empty slot
+  int directory_capacity;
+  int *directory;
+  // pool index of the chunk found by the last lookup, neighboring tiles usually share a chunk
+  int last_chunk_idx;
+  // the board file the pool is mapped from (see BOARD FILE), map is NULL while the pool is on the heap
+  int map_fd;
+  uint8_t *map;
+  size_t map_size;
+  // bumped by every applied update or resize, the board seq of protocol.h
+  uint32_t version;
+  // the published frames of the last op_count applied commands, the frame of version v is at
+  // op_frames[(v % OP_RING_CAPACITY) * COMMAND_FRAME_MAX]
+  uint8_t *op_frames;
+  uint32_t op_count;
+  // encoded fetch replies, reused until the version changes
+  FetchCache csv_cache;
+  FetchCache snapshot_cache;
 } Board;
 
-// getBoardTile
-// a way to access tiles from the TileBoard that checks for out of bounds issues
-Tile *getBoardTile(Board *board, int row_idx, int col_idx)
+// newSharedBuffer
+// takes ownership of malloc'd data, the caller holds the only reference
+SharedBuffer *newSharedBuffer(uint8_t *data, size_t size)
 {
-  if (row_idx > board->rows)
+  SharedBuffer *buffer = (SharedBuffer *)malloc(sizeof(SharedBuffer));
+  if (buffer == NULL)
   {
-    fprintf(stderr, "out of bounds access board rows\n");
+    fprintf(stderr, "error malloc newSharedBuffer\n");
     exit(1);
   }
-  if (col_idx > board->columns)
+  buffer->data = data;
+  buffer->size = size;
+  atomic_init(&buffer->refs, 1);
+  return buffer;
+}
+
+// releaseSharedBuffer
+// drop a reference, the last one frees the buffer
+void releaseSharedBuffer(SharedBuffer *buffer)
+{
+  if (atomic_fetch_sub(&buffer->refs, 1) == 1)
   {
-    fprintf(stderr, "out of bounds access board columns\n");
-    exit(1);
+    free(buffer->data);
+    free(buffer);
   }
-  return &board->tiles[row_idx][col_idx];
 }
 
-// initBoard
-// call to init with the default number of rows and columns before doing anything else
-void initBoard(Board *board)
+// releaseSentSharedBuffer
+// zmq_free_fn called by zeromq once a message sent with sendSharedBuffer is gone
+void releaseSentSharedBuffer(void *data, void *hint)
 {
-  board->columns = INIT_COLUMNS;
-  board->rows = INIT_ROWS;
-  board->tiles = (Tile **)malloc(INIT_ROWS * sizeof(Tile *));
-  if (board->tiles == NULL)
+  releaseSharedBuffer((SharedBuffer *)hint);
+}
+
+// sendSharedBuffer
+// send the buffer as a frame on the socket without copying it, the frame holds a reference until sent
+void sendSharedBuffer(zsock_t *socket, SharedBuffer *buffer)
+{
+  atomic_fetch_add(&buffer->refs, 1);
+  zmq_msg_t message;
+  zmq_msg_init_data(&message, buffer->data, buffer->size, releaseSentSharedBuffer, buffer);
+  if (zmq_msg_send(&message, zsock_resolve(socket), 0) == -1)
   {
-    fprintf(stderr, "error allocating tile rows array\n");
-    exit(1);
+    zmq_msg_close(&message);
   }
-  // allocate memory and initialize values
-  for (int i = 0; i < INIT_ROWS; i++)
+}
+
+// ReplyEnvelope
+// the routing frames in front of the request being handled: the identity the router added and the empty
+// delimiter REQ clients and binary DEALER clients send. replies go back with the same frames in front
+typedef struct
+{
+  zframe_t *identity;
+  zframe_t *delimiter;
+} ReplyEnvelope;
+
+_Thread_local ReplyEnvelope reply_envelope = {0};
+
+// sendReplyEnvelope
+// start the reply to the request being handled, the next frame sent on the responder is the reply itself
+void sendReplyEnvelope(void)
+{
+  zframe_send(&reply_envelope.identity, responder, ZFRAME_MORE | ZFRAME_REUSE);
+  if (reply_envelope.delimiter != NULL)
   {
-    board->tiles[i] = (Tile *)malloc(INIT_COLUMNS * sizeof(Tile));
-    if (board->tiles[i] == NULL)
-    {
-      fprintf(stderr, "error allocating tile columns array\n");
-      exit(1);
-    }
-    for (int j = 0; j < INIT_COLUMNS; j++)
-    {
-      Tile *tile = getBoardTile(board, i, j); // &board->tiles[i][j];
-      int color_num = rand() % 4;
-      tile->color_num = color_num;
-      tile->x = j;
-      tile->y = i;
-    }
+    zframe_send(&reply_envelope.delimiter, responder, ZFRAME_MORE | ZFRAME_REUSE);
   }
 }
 
-// resizeBoardWidth
-// take a new width and reallocate memory for it
-// initialize new values if new width is bigger than old width
-// updating board[][COLUMNS]
-void resizeBoardWidth(Board *board, int new_width)
+// makeSharedBufferWritable
+// returns a buffer with the same contents that nobody else holds, copying it if a frame still uses it
+SharedBuffer *makeSharedBufferWritable(SharedBuffer *buffer)
 {
-  int old_width = board->columns;
-  board->columns = new_width;
-
-  // resize every row to new width
-  for (int i = 0; i < board->rows; i++)
+  if (atomic_load(&buffer->refs) == 1)
   {
-    board->tiles[i] = (Tile *)realloc(board->tiles[i], new_width * sizeof(Tile));
-    // initialize data for new columns
-    for (int j = old_width; j < new_width; j++)
-    {
-      Tile *tile = getBoardTile(board, i, j);
-      tile->color_num = 0;
-      tile->x = j;
-      tile->y = i;
-    }
+    return buffer;
+  }
+  uint8_t *data = (uint8_t *)malloc(buffer->size);
+  if (data == NULL)
+  {
+    fprintf(stderr, "error malloc makeSharedBufferWritable\n");
+    exit(1);
   }
+  memcpy(data, buffer->data, buffer->size);
+  SharedBuffer *copy = newSharedBuffer(data, buffer->size);
+  releaseSharedBuffer(buffer);
+  return copy;
 }
 
-// resizeBoardHeight
-// take a new height and reallocate memory for it
-// initialize new values if new height is bigger than old height
-// pudating board[ROWS][]
-void resizeBoardHeight(Board *board, int new_height)
+// clearFetchCache
+void clearFetchCache(FetchCache *cache)
 {
-  int old_rows = board->rows;
-  // free old row data
-  if (new_height < old_rows)
+  if (cache->buffer != NULL)
   {
-    for (int i = new_height; i < old_rows; i++)
-    {
-      free(board->tiles[i]);
-    }
+    releaseSharedBuffer(cache->buffer);
   }
+  free(cache->layout);
+  memset(cache, 0, sizeof(FetchCache));
+}
 
-  board->rows = new_height;
-  // init memory for new rows
-  Tile **temp_realloc = (Tile **)realloc(board->tiles, new_height * sizeof(Tile *));
-  if (temp_realloc == NULL)
+// hashChunkKey
+// spread the chunk coordinates over the directory, capacity must be a power of two
+uint32_t hashChunkKey(int cx, int cy, int capacity)
+{
+  uint64_t key = ((uint64_t)(uint32_t)cx << 32) | (uint32_t)cy;
+  key *= 0x9E3779B97F4A7C15ull;
+  return (uint32_t)(key >> 32) & (capacity - 1);
+}
+
+// rebuildChunkDirectory
+// reinsert every chunk of the pool into a directory of the given capacity
+void rebuildChunkDirectory(Board *board, int capacity)
+{
+  int *directory = (int *)calloc(capacity, sizeof(int));
+  if (directory == NULL)
   {
-    fprintf(stderr, "error realloc height/rows\n");
+    fprintf(stderr, "error allocating chunk directory\n");
     exit(1);
   }
-  board->tiles = temp_realloc;
-
-  // initialize data for new rows
-  for (int i = old_rows; i < new_height; i++)
+  for (int i = 0; i < board->chunk_count; i++)
   {
-    board->tiles[i] = (Tile *)malloc(board->columns * sizeof(Tile));
-    if (board->tiles[i] == NULL)
+    uint32_t slot = hashChunkKey(board->chunk_keys[i].cx, board->chunk_keys[i].cy, capacity);
+    while (directory[slot] != 0)
     {
-      fprintf(stderr, "error allocating tile columns array \n");
-      exit(1);
+      slot = (slot + 1) & (capacity - 1);
     }
-    for (int j = 0; j < board->columns; j++)
+    directory[slot] = i + 1;
+  }
+  free(board->directory);
+  board->directory = directory;
+  board->directory_capacity = capacity;
+}
+
+// findChunk
+// returns the pool index of chunk (cx, cy) or -1 when nothing in it was painted yet
+int findChunk(Board *board, int cx, int cy)
+{
+  if (board->last_chunk_idx < board->chunk_count && board->chunk_keys[board->last_chunk_idx].cx == cx &&
+      board->chunk_keys[board->last_chunk_idx].cy == cy)
+  {
+    return board->last_chunk_idx;
+  }
+  uint32_t slot = hashChunkKey(cx, cy, board->directory_capacity);
+  while (board->directory[slot] != 0)
+  {
+    int chunk_idx = board->directory[slot] - 1;
+    if (board->chunk_keys[chunk_idx].cx == cx && board->chunk_keys[chunk_idx].cy == cy)
     {
-      Tile *tile = getBoardTile(board, i, j); // &board->tiles[i][j];
-      tile->color_num = 0;
-      tile->x = j;
-      tile->y = i;
+      board->last_chunk_idx = chunk_idx;
+      return chunk_idx;
     }
+    slot = (slot + 1) & (board->directory_capacity - 1);
   }
+  return -1;
 }
 
-// variable to store the running state of the program and enable stopping it
-volatile int keep_running = 1;
-// handleSigint - stops the program gracefully
-void handleSigint(int sig)
+// getChunkColors
+// returns the row-major color plane of a chunk in the pool
+uint8_t *getChunkColors(Board *board, int chunk_idx)
 {
-  keep_running = 0;
-  printf("stop running\n");
+  return &board->chunk_colors[(size_t)chunk_idx * CHUNK_AREA];
 }
 
-// boardToCSV
-// takes the board and converts the entire thing to a CSV in order to send the whole state to the client
-char *boardToCSV(Board *board)
+// BOARD FILE
+// ----------
+// the chunk pool can live in a memory mapped file (board.map, see --board-file) instead of the heap, so a
+// restart maps it and serves right away instead of replaying the whole store. layout:
+//   0                       header, BOARD_FILE_HEADER_SIZE bytes used of the first BOARD_FILE_ALIGN
+//   BOARD_FILE_ALIGN        chunk colors, chunk_capacity * CHUNK_AREA bytes
+//   after the colors        chunk keys, chunk_capacity * sizeof(ChunkKey) bytes
+// the colors start on a 2 MB boundary and grow in 2 MB steps so they can be backed by huge pages. the
+// header only describes the pool after a clean shutdown, while the server runs it is marked dirty and a
+// crash leaves it that way, then the board is rebuilt from the store
+
+#define BOARD_FILE_MAGIC "TMAP"
+#define BOARD_FILE_VERSION 1
+#define BOARD_FILE_HEADER_SIZE 48
+#define BOARD_FILE_ALIGN (2 << 20)
+// chunks in one BOARD_FILE_ALIGN step, the pool capacity is always a multiple of it
+#define BOARD_FILE_CHUNK_STEP (BOARD_FILE_ALIGN / CHUNK_AREA)
+
+// boardFileSize
+// size of a board file with room for capacity chunks
+size_t boardFileSize(int capacity)
 {
-  // 10 bytes per line with rows*boards tiles + dimensions
-  char *buffer = (char *)malloc(10 * board->rows * board->columns * sizeof(char) + 10);
-  if (buffer == NULL)
+  return BOARD_FILE_ALIGN + (size_t)capacity * (CHUNK_AREA + sizeof(ChunkKey));
+}
+
+// mapBoardFile
+// map the board file at the size for capacity chunks and point the pool into it
+void mapBoardFile(Board *board, int capacity)
+{
+  size_t size = boardFileSize(capacity);
+  if (ftruncate(board->map_fd, size) != 0)
   {
-    fprintf(stderr, "error malloc boardToCSV buffer\n");
+    fprintf(stderr, "error growing the board file to %zu bytes: %s\n", size, strerror(errno));
+    exit(1);
+  }
+  uint8_t *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, board->map_fd, 0);
+  if (map == MAP_FAILED)
+  {
+    fprintf(stderr, "error mapping the board file: %s\n", strerror(errno));
     exit(1);
   }
-  buffer[0] = '\0';
-  // start with a line containing rows,columns
-  char temp[10];
-  sprintf(temp, "%d,%d\n", board->rows, board->columns);
-  strcat(buffer, temp);
+  madvise(&map[BOARD_FILE_ALIGN], (size_t)capacity * CHUNK_AREA, MADV_HUGEPAGE);
+  board->map = map;
+  board->map_size = size;
+  board->chunk_capacity = capacity;
+  board->chunk_colors = &map[BOARD_FILE_ALIGN];
+  board->chunk_keys = (ChunkKey *)&map[BOARD_FILE_ALIGN + (size_t)capacity * CHUNK_AREA];
+}
+
+// growBoardFile
+// the mapped version of growing the pool, the keys move behind the larger color area
+void growBoardFile(Board *board, int new_capacity)
+{
+  int old_capacity = board->chunk_capacity;
+  size_t old_keys_offset = BOARD_FILE_ALIGN + (size_t)old_capacity * CHUNK_AREA;
+  munmap(board->map, board->map_size);
+  mapBoardFile(board, new_capacity);
+  // the new key area starts past the end of the old file, the two never overlap
+  memcpy(board->chunk_keys, &board->map[old_keys_offset], board->chunk_count * sizeof(ChunkKey));
+}
 
-  for (int i = 0; i < board->columns; i++)
+// checksumBoardFile
+// 64 bit FNV-1a over the used keys and colors of the pool, a word at a time
+uint64_t checksumBoardFile(Board *board)
+{
+  uint64_t hash = 0xcbf29ce484222325ull;
+  const uint8_t *areas[2] = {board->chunk_colors, (const uint8_t *)board->chunk_keys};
+  size_t sizes[2] = {(size_t)board->chunk_count * CHUNK_AREA, board->chunk_count * sizeof(ChunkKey)};
+  for (int a = 0; a < 2; a++)
   {
-    for (int j = 0; j < board->rows; j++)
+    for (size_t i = 0; i < sizes[a]; i += 8)
     {
-      char temp[36];
-      sprintf(temp, "%d,%d,%d\n", board->tiles[j][i].x, board->tiles[j][i].y, board->tiles[j][i].color_num);
-      strcat(buffer, temp);
+      uint64_t word;
+      memcpy(&word, &areas[a][i], 8);
+      hash = (hash ^ word) * 0x100000001b3ull;
     }
   }
-  return buffer;
+  return hash;
 }
 
-// parseBoardUpdate
-// take received update string, parse it, and apply update to the board tiles state
-void parseBoardUpdate(Board *board, char *received_str)
+// writeBoardFileHeader
+// fill in the header of the board file, store_offset is the end of the store the board is current with
+void writeBoardFileHeader(Board *board, bool clean, uint64_t store_offset, uint64_t checksum)
 {
-  printf("parsing input %s\n", received_str);
-  // char * publish_str = strdup(received_str);
-  char *token;
-  token = strtok(received_str, ",");
-  int x = -1;
-  int y = -1;
-  int color_num = -1;
-  int i = 0;
-  while (token != NULL)
+  uint8_t *header = board->map;
+  memcpy(header, BOARD_FILE_MAGIC, 4);
+  writeU32(&header[4], BOARD_FILE_VERSION);
+  writeU32(&header[8], board->rows);
+  writeU32(&header[12], board->columns);
+  writeU32(&header[16], board->version);
+  writeU32(&header[20], board->chunk_count);
+  writeU32(&header[24], board->chunk_capacity);
+  writeU32(&header[28], clean);
+  writeU64(&header[32], store_offset);
+  writeU64(&header[40], checksum);
+}
+
+// syncBoardFile
+// msync size bytes from the start of the board file
+void syncBoardFile(Board *board, size_t size)
+{
+  if (msync(board->map, size, MS_SYNC) != 0)
   {
-    if (i == 0)
+    fprintf(stderr, "error syncing the board file: %s\n", strerror(errno));
+    exit(1);
+  }
+}
+
+// openBoardFile
+// move the chunk pool of a freshly initialized board into the board file. a board file that was closed
+// cleanly replaces the board instead, then the return value is the store offset to replay from, 0 to
+// replay the whole store
+uint64_t openBoardFile(Board *board, const char *path)
+{
+  board->map_fd = open(path, O_RDWR | O_CREAT, 0644);
+  if (board->map_fd < 0)
+  {
+    fprintf(stderr, "error opening %s: %s\n", path, strerror(errno));
+    exit(1);
+  }
+  uint8_t header[BOARD_FILE_HEADER_SIZE];
+  off_t size = lseek(board->map_fd, 0, SEEK_END);
+  if (size > 0)
+  {
+    int capacity = -1;
+    bool clean = false;
+    int rows = 0;
+    int columns = 0;
+    int chunk_count = 0;
+    if (size >= BOARD_FILE_ALIGN && pread(board->map_fd, header, BOARD_FILE_HEADER_SIZE, 0) == BOARD_FILE_HEADER_SIZE &&
+        memcmp(header, BOARD_FILE_MAGIC, 4) == 0 && readU32(&header[4]) == BOARD_FILE_VERSION)
     {
-      x = atoi(token);
+      capacity = readU32(&header[24]);
+      clean = readU32(&header[28]) == 1;
+      rows = readU32(&header[8]);
+      columns = readU32(&header[12]);
+      chunk_count = readU32(&header[20]);
     }
-    if (i == 1)
+    if (clean && capacity > 0 && capacity % BOARD_FILE_CHUNK_STEP == 0 && (size_t)size == boardFileSize(capacity) &&
+        chunk_count <= capacity && rows >= 1 && rows <= MAX_BOARD_DIMENSION && columns >= 1 &&
+        columns <= MAX_BOARD_DIMENSION)
     {
-      y = atoi(token);
+      uint8_t *heap_colors = board->chunk_colors;
+      ChunkKey *heap_keys = board->chunk_keys;
+      int heap_capacity = board->chunk_capacity;
+      int heap_count = board->chunk_count;
+      mapBoardFile(board, capacity);
+      board->chunk_count = chunk_count;
+      if (checksumBoardFile(board) == readU64(&header[40]))
+      {
+        free(heap_colors);
+        free(heap_keys);
+        board->rows = rows;
+        board->columns = columns;
+        board->version = readU32(&header[16]);
+        board->last_chunk_idx = 0;
+        int directory_capacity = 64;
+        while (directory_capacity < chunk_count * 2)
+        {
+          directory_capacity *= 2;
+        }
+        rebuildChunkDirectory(board, directory_capacity);
+        // dirty until the next clean shutdown
+        writeBoardFileHeader(board, false, 0, 0);
+        syncBoardFile(board, BOARD_FILE_HEADER_SIZE);
+        printf("mapped %s: board %dx%d at seq %u, %d chunks\n", path, rows, columns, board->version, chunk_count);
+        return readU64(&header[32]);
+      }
+      munmap(board->map, board->map_size);
+      board->map = NULL;
+      board->chunk_colors = heap_colors;
+      board->chunk_keys = heap_keys;
+      board->chunk_capacity = heap_capacity;
+      board->chunk_count = heap_count;
     }
-    if (i == 2)
+    fprintf(stderr, "%s is not a cleanly closed board file, rebuilding the board from the store\n", path);
+    // drop the old contents so the file does not keep their blocks
+    if (ftruncate(board->map_fd, 0) != 0)
     {
-      color_num = atoi(token);
+      fprintf(stderr, "error truncating %s: %s\n", path, strerror(errno));
+      exit(1);
     }
-    token = strtok(NULL, ",");
-    i++;
   }
-  printf("setting %d, %d to %d\n", x, y, color_num);
-  Tile *tile = getBoardTile(board, y, x); // &board->tiles[y][x];
-  tile->color_num = color_num;
+  uint8_t *heap_colors = board->chunk_colors;
+  ChunkKey *heap_keys = board->chunk_keys;
+  int capacity = BOARD_FILE_CHUNK_STEP;
+  while (capacity < board->chunk_count)
+  {
+    capacity += BOARD_FILE_CHUNK_STEP;
+  }
+  mapBoardFile(board, capacity);
+  memcpy(board->chunk_colors, heap_colors, (size_t)board->chunk_count * CHUNK_AREA);
+  memcpy(board->chunk_keys, heap_keys, board->chunk_count * sizeof(ChunkKey));
+  free(heap_colors);
+  free(heap_keys);
+  writeBoardFileHeader(board, false, 0, 0);
+  syncBoardFile(board, BOARD_FILE_HEADER_SIZE);
+  return 0;
+}
 
+// startBoardFileWriteback
+// start writing the dirty pages of the board file without waiting for them, the --msync-ms cadence.
+// keeps the sync at shutdown short and the dirty pages of a busy board from piling up
+void startBoardFileWriteback(Board *board)
+{
+  if (sync_file_range(board->map_fd, 0, 0, SYNC_FILE_RANGE_WRITE) != 0)
+  {
+    fprintf(stderr, "error writing back the board file: %s\n", strerror(errno));
+  }
 }
 
-// parseBoardResize
-// take received resize string, parse it, and apply resize to the board tile state
-void parseBoardResize(Board *board, char *received_str)
+// closeBoardFile
+// write the whole board file out and mark it clean, current with the store up to store_offset
+void closeBoardFile(Board *board, uint64_t store_offset)
 {
-  printf("parsing resize string %s\n", received_str);
-  char *token;
-  token = strtok(received_str, ",");
-  int new_rows = 32;
-  int new_cols = 32;
-  int i = 0;
-  while (token != NULL)
+  writeBoardFileHeader(board, false, store_offset, checksumBoardFile(board));
+  syncBoardFile(board, board->map_size);
+  // the clean flag goes out only after everything it vouches for
+  writeU32(&board->map[28], 1);
+  syncBoardFile(board, BOARD_FILE_HEADER_SIZE);
+  munmap(board->map, board->map_size);
+  close(board->map_fd);
+  board->map = NULL;
+  board->map_fd = -1;
+  board->chunk_colors = NULL;
+  board->chunk_keys = NULL;
+}
+
+// SNAPSHOTS
+// ---------
+// every --snapshot-s seconds a background thread writes the board as it was at one seq to a snapshot file,
+// which bounds the replay after a crash to the store written since. the command loop keeps changing the
+// board meanwhile: the first write to a chunk of the snapshot copies that chunk aside unless the thread
+// already encoded it (copy on write at chunk granularity), so the thread only ever sees the board of the
+// snapshot seq and the loop never waits for more than the encoding of one chunk
+
+typedef enum
+{
+  // not touched since the snapshot started, the thread encodes it from the pool
+  SNAPSHOT_CHUNK_LIVE,
+  // the thread is encoding it from the pool right now
+  SNAPSHOT_CHUNK_READING,
+  // the command loop copied it to saved before writing to it
+  SNAPSHOT_CHUNK_SAVED,
+  // the thread is done with it
+  SNAPSHOT_CHUNK_WRITTEN,
+} SnapshotChunkState;
+
+typedef struct
+{
+  const char *path;
+  // the board when the snapshot started, chunk_count is 0 while no snapshot is written
+  int rows;
+  int columns;
+  uint32_t version;
+  uint64_t store_offset;
+  // the store the offset is in and where the offset is in its ring, the thread has the store on disk up to
+  // there before the snapshot replaces the last one. NULL while the store is not running
+  struct Store *store;
+  size_t store_position;
+  int chunk_count;
+  ChunkKey *keys;
+  // the pool when the snapshot started, only read by the thread for LIVE chunks
+  const uint8_t *colors;
+  // SnapshotChunkState of every chunk, owned by whoever moves it out of LIVE
+  _Atomic uint8_t *chunk_states;
+  // room for saved_capacity chunks, chunk i at saved[i * CHUNK_AREA]
+  uint8_t *saved;
+  size_t saved_capacity;
+  pthread_t thread;
+  // set by the command loop while a snapshot thread runs, done by the thread once its file is in place
+  bool active;
+  atomic_bool done;
+  double started;
+  unsigned long chunks_saved;
+} SnapshotWriter;
+
+// the snapshot writer of the board being worked on, set together with store
+_Thread_local SnapshotWriter *snapshot_writer;
+
+// saveChunkForSnapshot
+// called before the command loop writes to chunk_idx of a snapshot in progress, keeps what the chunk
+// looked like for the snapshot thread unless it already took it
+void saveChunkForSnapshot(Board *board, int chunk_idx)
+{
+  _Atomic uint8_t *state = &snapshot_writer->chunk_states[chunk_idx];
+  uint8_t current = atomic_load_explicit(state, memory_order_acquire);
+  if (current == SNAPSHOT_CHUNK_SAVED || current == SNAPSHOT_CHUNK_WRITTEN)
   {
-    if (i == 0)
-    {
-      new_rows = atoi(token);
-    }
-    if (i == 1)
+    return;
+  }
+  if (current == SNAPSHOT_CHUNK_LIVE)
+  {
+    // only this thread writes the pool, copying before claiming the chunk is safe
+    memcpy(&snapshot_writer->saved[(size_t)chunk_idx * CHUNK_AREA], getChunkColors(board, chunk_idx), CHUNK_AREA);
+    if (atomic_compare_exchange_strong_explicit(state, &current, SNAPSHOT_CHUNK_SAVED, memory_order_release,
+                                                memory_order_acquire))
     {
-      new_cols = atoi(token);
+      snapshot_writer->chunks_saved++;
+      return;
     }
-    token = strtok(NULL, ",");
-    i++;
   }
-  if (board->rows != new_rows)
+  // the thread is encoding it from the pool, one chunk takes microseconds. yield so it can finish when
+  // both threads share a core
+  while (atomic_load_explicit(state, memory_order_acquire) == SNAPSHOT_CHUNK_READING)
   {
-    resizeBoardHeight(board, new_rows);
+    sched_yield();
   }
-  if (board->columns != new_cols)
+}
+
+// saveAllChunksForSnapshot
+// called before the pool moves or compacts, after it the snapshot thread never reads the pool again
+void saveAllChunksForSnapshot(Board *board)
+{
+  for (int i = 0; i < snapshot_writer->chunk_count; i++)
   {
-    resizeBoardWidth(board, new_cols);
+    saveChunkForSnapshot(board, i);
   }
 }
 
-// parseCommand
-void parseCommand(Board *board, char *command_str)
+// createChunk
+// appends a zeroed chunk to the pool and registers it in the directory
+int createChunk(Board *board, int cx, int cy)
 {
-  /*
-    client_id\n
-    command\n
-    c,s,v
-  */
-  zsock_send(publisher, "s", command_str);
-  char *token;
-  char *client_id_str;
-  char *command_name;
-  char *command_args;
-  int i = 0;
-  token = strtok(command_str, "\n");
-  while (token != NULL)
+  if (board->chunk_count == board->chunk_capacity)
   {
-    if (i == 0)
-    {
-      client_id_str = token;
-    }
-    if (i == 1)
-    {
-      command_name = token;
-    }
-    if (i == 2)
+    saveAllChunksForSnapshot(board);
+  }
+  if (board->chunk_count == board->chunk_capacity && board->map != NULL)
+  {
+    growBoardFile(board, board->chunk_capacity * 2);
+  }
+  if (board->chunk_count == board->chunk_capacity)
+  {
+    int new_capacity = board->chunk_capacity * 2;
+    uint8_t *colors_realloc = (uint8_t *)realloc(board->chunk_colors, (size_t)new_capacity * CHUNK_AREA);
+    ChunkKey *keys_realloc = (ChunkKey *)realloc(board->chunk_keys, new_capacity * sizeof(ChunkKey));
+    if (colors_realloc == NULL || keys_realloc == NULL)
     {
-      command_args = token;
+      fprintf(stderr, "error realloc chunk pool\n");
+      exit(1);
     }
-    token = strtok(NULL, "\n");
-    i++;
+    board->chunk_colors = colors_realloc;
+    board->chunk_keys = keys_realloc;
+    board->chunk_capacity = new_capacity;
   }
-  printf("%s: %s: %s\n", client_id_str, command_name, command_args);
+  int chunk_idx = board->chunk_count++;
+  board->chunk_keys[chunk_idx].cx = cx;
+  board->chunk_keys[chunk_idx].cy = cy;
+  memset(getChunkColors(board, chunk_idx), 0, CHUNK_AREA);
 
-  if (strcmp(command_name, "update") == 0)
+  // keep the directory at most half full so probe sequences stay short
+  if (board->chunk_count * 2 > board->directory_capacity)
   {
-    parseBoardUpdate(board, command_args);
+    rebuildChunkDirectory(board, board->directory_capacity * 2);
   }
-  if (strcmp(command_name, "resize") == 0)
+  else
   {
-    parseBoardResize(board, command_args);
+    uint32_t slot = hashChunkKey(cx, cy, board->directory_capacity);
+    while (board->directory[slot] != 0)
+    {
+      slot = (slot + 1) & (board->directory_capacity - 1);
+    }
+    board->directory[slot] = chunk_idx + 1;
   }
+  return chunk_idx;
 }
 
-// different from server parseBoard - doesnt store exact X/Y/height/width
-void parseBoardCSV(Board *board, char *boardCSV)
+// checkBoardBounds
+// exits when a tile coordinate is outside of the board
+void checkBoardBounds(Board *board, int row_idx, int col_idx)
 {
-  char *token;
-  token = strtok(boardCSV, "\n");
-  char **lines = (char **)malloc(board->columns * board->rows * sizeof(char *)); //[columns*rows];
-  if (lines == NULL)
+  if (row_idx < 0 || row_idx >= board->rows)
   {
-    fprintf(stderr, "error malloc in parseBoardCSV\n");
+    fprintf(stderr, "out of bounds access board rows\n");
     exit(1);
   }
-  int lineIdx = 0;
-  while (token != NULL)
+  if (col_idx < 0 || col_idx >= board->columns)
   {
-    lines[lineIdx] = token;
-    token = strtok(NULL, "\n");
-    lineIdx++;
+    fprintf(stderr, "out of bounds access board columns\n");
+    exit(1);
   }
-  for (int i = 0; i < lineIdx; i++)
-  {
-    char *line = lines[i];
-    // printf("%s\n", line);
-    char *dataToken;
-    // int lineData[3];
-    dataToken = strtok(line, ",");
-    int dataIdx = 0;
-    int colorNum = -1;
-    int x = -1;
-    int y = -1;
-    while (dataToken != NULL)
-    {
-      switch (dataIdx)
-      {
-      case 0: // x value
-        x = atoi(dataToken);
-        break;
-      case 1: // y value
-        y = atoi(dataToken);
-        break;
-      case 2: // colorNum
-        colorNum = atoi(dataToken);
-        break;
-      }
-      //  lineData[dataIdx] = atoi(dataToken);
-      dataToken = strtok(NULL, ",");
-      dataIdx++;
-    }
-    //   Tile * lineTile = &board[x][y];
+}
 
-    Tile *tile = &board->tiles[x][y];
-    tile->x = x;
-    tile->y = y;
-    tile->color_num = colorNum;
+// getBoardColor
+// read a tile color without allocating its chunk, unpainted tiles are 0
+uint8_t getBoardColor(Board *board, int row_idx, int col_idx)
+{
+  checkBoardBounds(board, row_idx, col_idx);
+  int chunk_idx = findChunk(board, col_idx >> CHUNK_SHIFT, row_idx >> CHUNK_SHIFT);
+  if (chunk_idx < 0)
+  {
+    return 0;
   }
+  return getChunkColors(board, chunk_idx)[(row_idx & (CHUNK_SIZE - 1)) * CHUNK_SIZE + (col_idx & (CHUNK_SIZE - 1))];
 }
 
-
-int main(void)
+// getWritableChunk
+// the colors of chunk cx, cy for writing, allocated on first access and saved for a snapshot in progress
+// first. the pointer is valid until the next chunk is created
+uint8_t *getWritableChunk(Board *board, int cx, int cy)
 {
-  Board board;
-  initBoard(&board);
-
-  // Initialization of board
-  //
-  //--------------------------------------------------------------------------------------
-  // getBoardState(&board);
-  // char* boardCSV = boardToCSV(board);
-  // size_t csv_size = strlen(boardCSV) * sizeof(char);
-  // printf("%zu \n", csv_size);
-  // exit program on ctrl-c
-  if (signal(SIGINT, handleSigint) == SIG_ERR)
+  int chunk_idx = findChunk(board, cx, cy);
+  if (chunk_idx < 0)
   {
-    printf("error setting up signal handler \n");
-    return 1;
+    chunk_idx = createChunk(board, cx, cy);
   }
+  if (chunk_idx < snapshot_writer->chunk_count)
+  {
+    saveChunkForSnapshot(board, chunk_idx);
+  }
+  return getChunkColors(board, chunk_idx);
+}
 
-  responder = zsock_new(ZMQ_REP);
-  int rc = zsock_bind(responder, "tcp://*:5555");
-  assert(rc == 5555);
-  printf("tcp req-resp listening on 5555 \n");
+// getBoardTile
+// a way to access tiles from the Board for writing that checks for out of bounds issues
+// allocates the chunk of the tile on first access, the pointer is valid until the next chunk is created
+uint8_t *getBoardTile(Board *board, int row_idx, int col_idx)
+{
+  checkBoardBounds(board, row_idx, col_idx);
+  uint8_t *colors = getWritableChunk(board, col_idx >> CHUNK_SHIFT, row_idx >> CHUNK_SHIFT);
+  return &colors[(row_idx & (CHUNK_SIZE - 1)) * CHUNK_SIZE + (col_idx & (CHUNK_SIZE - 1))];
+}
 
-  // publisher socket
-  publisher = zsock_new_pub("tcp://*:5556");
-  if (!publisher)
+// fillBoardRow
+// paint columns x0..x1 of row y, which are known to be on the board, with one memset per chunk the
+// run crosses
+void fillBoardRow(Board *board, int y, int x0, int x1, int color_num)
+{
+  int row = (y & (CHUNK_SIZE - 1)) * CHUNK_SIZE;
+  while (x0 <= x1)
   {
-    printf("Error: Unable to create publisher socket\n");
-    return 1;
+    int end = (x0 | (CHUNK_SIZE - 1)) < x1 ? x0 | (CHUNK_SIZE - 1) : x1;
+    uint8_t *colors = getWritableChunk(board, x0 >> CHUNK_SHIFT, y >> CHUNK_SHIFT);
+    memset(&colors[row + (x0 & (CHUNK_SIZE - 1))], color_num, end - x0 + 1);
+    x0 = end + 1;
   }
-  printf("tcp pub-sub listening on 5556\n");
+}
 
-  while (keep_running)
+// initBoard
+// call to init with the default number of rows and columns before doing anything else
+void initBoard(Board *board)
+{
+  board->columns = INIT_COLUMNS;
+  board->rows = INIT_ROWS;
+  board->chunk_count = 0;
+  board->chunk_capacity = 16;
+  board->chunk_colors = (uint8_t *)malloc((size_t)board->chunk_capacity * CHUNK_AREA);
+  board->chunk_keys = (ChunkKey *)malloc(board->chunk_capacity * sizeof(ChunkKey));
+  if (board->chunk_colors == NULL || board->chunk_keys == NULL)
   {
-    char *received_str = zstr_recv(responder);
-    if (received_str)
-    {
-
-      printf("received %s \n", received_str);
-      if (strcmp(received_str, "fetch") == 0)
+    fprintf(stderr, "error allocating chunk pool\n");
+    exit(1);
+  }
+  board->directory = NULL;
+  board->last_chunk_idx = 0;
+  board->map_fd = -1;
+  board->map = NULL;
+  board->map_size = 0;
+  rebuildChunkDirectory(board, 64);
+  board->version = 0;
+  board->op_frames = (uint8_t *)malloc((size_t)OP_RING_CAPACITY * COMMAND_FRAME_MAX);
+  board->op_count = 0;
+  if (board->op_frames == NULL)
+  {
+    fprintf(stderr, "error allocating op ring\n");
+    exit(1);
+  }
+  memset(&board->csv_cache, 0, sizeof(FetchCache));
+  memset(&board->snapshot_cache, 0, sizeof(FetchCache));
+
+  // initialize values
+  for (int i = 0; i < INIT_ROWS; i++)
+  {
+    for (int j = 0; j < INIT_COLUMNS; j++)
+    {
+      *getBoardTile(board, i, j) = rand() % 4;
+    }
+  }
+}
+
+// freeBoard
+void freeBoard(Board *board)
+{
+  if (board->map != NULL)
+  {
+    munmap(board->map, board->map_size);
+    close(board->map_fd);
+    board->map = NULL;
+  }
+  else
+  {
+    free(board->chunk_colors);
+    free(board->chunk_keys);
+  }
+  free(board->directory);
+  free(board->op_frames);
+  board->chunk_colors = NULL;
+  board->chunk_keys = NULL;
+  board->directory = NULL;
+  board->op_frames = NULL;
+  board->chunk_count = 0;
+  clearFetchCache(&board->csv_cache);
+  clearFetchCache(&board->snapshot_cache);
+}
+
+// trimBoardChunks
+// after a shrink, drop the chunks that are now fully outside of the board and clear the tiles
+// outside of the board in the chunks on the edge so growing again shows color 0 there
+void trimBoardChunks(Board *board)
+{
+  saveAllChunksForSnapshot(board);
+  int kept = 0;
+  for (int i = 0; i < board->chunk_count; i++)
+  {
+    ChunkKey key = board->chunk_keys[i];
+    int first_col = key.cx * CHUNK_SIZE;
+    int first_row = key.cy * CHUNK_SIZE;
+    if (first_col >= board->columns || first_row >= board->rows)
+    {
+      continue;
+    }
+    if (kept != i)
+    {
+      memcpy(getChunkColors(board, kept), getChunkColors(board, i), CHUNK_AREA);
+      board->chunk_keys[kept] = key;
+    }
+    uint8_t *colors = getChunkColors(board, kept);
+    int valid_cols = board->columns - first_col;
+    int valid_rows = board->rows - first_row;
+    if (valid_cols < CHUNK_SIZE)
+    {
+      for (int row = 0; row < CHUNK_SIZE; row++)
+      {
+        memset(&colors[row * CHUNK_SIZE + valid_cols], 0, CHUNK_SIZE - valid_cols);
+      }
+    }
+    if (valid_rows < CHUNK_SIZE)
+    {
+      memset(&colors[valid_rows * CHUNK_SIZE], 0, (CHUNK_SIZE - valid_rows) * CHUNK_SIZE);
+    }
+    kept++;
+  }
+  if (kept != board->chunk_count)
+  {
+    board->chunk_count = kept;
+    rebuildChunkDirectory(board, board->directory_capacity);
+  }
+}
+
+// resizeBoardWidth
+// take a new width, chunks are allocated lazily so only shrinking has to touch memory
+// updating board[][COLUMNS]
+void resizeBoardWidth(Board *board, int new_width)
+{
+  int old_width = board->columns;
+  board->columns = new_width;
+  if (new_width < old_width)
+  {
+    trimBoardChunks(board);
+  }
+}
+
+// resizeBoardHeight
+// take a new height, chunks are allocated lazily so only shrinking has to touch memory
+// updating board[ROWS][]
+void resizeBoardHeight(Board *board, int new_height)
+{
+  int old_rows = board->rows;
+  board->rows = new_height;
+  if (new_height < old_rows)
+  {
+    trimBoardChunks(board);
+  }
+}
+
+// compareChunkKeys
+// qsort comparator for chunk pool indices, orders by chunk column then chunk row
+// thread local, workers sort the chunks of their own boards at the same time
+_Thread_local ChunkKey *sort_chunk_keys;
+int compareChunkKeys(const void *a, const void *b)
+{
+  ChunkKey key_a = sort_chunk_keys[*(const int *)a];
+  ChunkKey key_b = sort_chunk_keys[*(const int *)b];
+  if (key_a.cx != key_b.cx)
+  {
+    return key_a.cx < key_b.cx ? -1 : 1;
+  }
+  if (key_a.cy != key_b.cy)
+  {
+    return key_a.cy < key_b.cy ? -1 : 1;
+  }
+  return 0;
+}
+
+// sortBoardChunks
+// returns the pool indices of all allocated chunks ordered by chunk column, then chunk row,
+// so the painted part of the board can be iterated in the same order as a dense scan
+// the caller frees the returned array
+int *sortBoardChunks(Board *board)
+{
+  int *order = (int *)malloc((board->chunk_count + 1) * sizeof(int));
+  if (order == NULL)
+  {
+    fprintf(stderr, "error malloc sortBoardChunks\n");
+    exit(1);
+  }
+  for (int i = 0; i < board->chunk_count; i++)
+  {
+    order[i] = i;
+  }
+  sort_chunk_keys = board->chunk_keys;
+  qsort(order, board->chunk_count, sizeof(int), compareChunkKeys);
+  return order;
+}
+
+// variable to store the running state of the program and enable stopping it
+volatile int keep_running = 1;
+// nowMs
+// monotonic clock in milliseconds for publish ticks and timing the benchmarks
+double nowMs(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+// handleSigint - stops the program gracefully
+void handleSigint(int sig)
+{
+  keep_running = 0;
+  printf("stop running\n");
+}
+
+// countDigits
+// number of decimal digits of a non-negative int
+int countDigits(int value)
+{
+  int digits = 1;
+  while (value >= 10)
+  {
+    value /= 10;
+    digits++;
+  }
+  return digits;
+}
+
+// writeDigits
+// writes a non-negative int at cursor without a terminator and returns the cursor past it
+char *writeDigits(char *cursor, int value)
+{
+  int digits = countDigits(value);
+  for (int i = digits - 1; i >= 0; i--)
+  {
+    cursor[i] = '0' + value % 10;
+    value /= 10;
+  }
+  return cursor + digits;
+}
+
+// boardToCSV
+// takes the board and converts the painted part of it to a CSV in order to send the whole state to the client
+// tiles of unallocated chunks are left out and have color 0 on the client. the lines are ordered by x and
+// then y, so a fully painted board produces the same CSV as a dense scan column by column
+// the output is sized exactly up front and written through a cursor in one pass, csv_length may be NULL
+// layout may be NULL, otherwise it receives board->chunk_count entries for patching the CSV later
+char *boardToCSV(Board *board, size_t *csv_length, CsvChunkLayout *layout)
+{
+  int *order = sortBoardChunks(board);
+
+  // every line is "x,y,c\n", so its length only depends on the digits of x and y
+  // size the buffer from one pass over the chunk keys: start with a line containing rows,columns
+  size_t size = countDigits(board->rows) + 1 + countDigits(board->columns) + 1;
+  int widest_column = 0;
+  for (int first = 0; first < board->chunk_count;)
+  {
+    int cx = board->chunk_keys[order[first]].cx;
+    size_t column_rows = 0;
+    size_t column_row_digits = 0;
+    int last = first;
+    for (; last < board->chunk_count && board->chunk_keys[order[last]].cx == cx; last++)
+    {
+      if (layout != NULL)
+      {
+        layout[order[last]].column_offset = size;
+        layout[order[last]].rows_before = column_rows;
+        layout[order[last]].row_digits_before = column_row_digits;
+      }
+      int cy = board->chunk_keys[order[last]].cy;
+      for (int j = cy * CHUNK_SIZE; j < (cy + 1) * CHUNK_SIZE && j < board->rows; j++)
+      {
+        column_rows++;
+        column_row_digits += countDigits(j);
+      }
+    }
+    for (int k = first; layout != NULL && k < last; k++)
+    {
+      layout[order[k]].column_rows = column_rows;
+      layout[order[k]].column_row_digits = column_row_digits;
+    }
+    for (int i = cx * CHUNK_SIZE; i < (cx + 1) * CHUNK_SIZE && i < board->columns; i++)
+    {
+      size += column_rows * (countDigits(i) + 4) + column_row_digits;
+    }
+    if (last - first > widest_column)
+    {
+      widest_column = last - first;
+    }
+    first = last;
+  }
+
+  char *buffer = (char *)malloc(size + 1);
+  // one column of chunks transposed so that every x reads its tiles sequentially
+  uint8_t *strip = (uint8_t *)malloc((size_t)widest_column * CHUNK_AREA + 1);
+  if (buffer == NULL || strip == NULL)
+  {
+    fprintf(stderr, "error malloc boardToCSV buffer\n");
+    exit(1);
+  }
+  char *cursor = buffer;
+  cursor = writeDigits(cursor, board->rows);
+  *cursor++ = ',';
+  cursor = writeDigits(cursor, board->columns);
+  *cursor++ = '\n';
+
+  // walk one column of chunks at a time
+  for (int first = 0; first < board->chunk_count;)
+  {
+    int cx = board->chunk_keys[order[first]].cx;
+    int last = first;
+    while (last < board->chunk_count && board->chunk_keys[order[last]].cx == cx)
+    {
+      last++;
+    }
+    int chunks = last - first;
+    // strip[(local x * chunks + k) * CHUNK_SIZE + local y] is the tile of the k-th chunk of the column
+    for (int k = 0; k < chunks; k++)
+    {
+      uint8_t *colors = getChunkColors(board, order[first + k]);
+      for (int row = 0; row < CHUNK_SIZE; row++)
+      {
+        for (int col = 0; col < CHUNK_SIZE; col++)
+        {
+          strip[((size_t)col * chunks + k) * CHUNK_SIZE + row] = colors[row * CHUNK_SIZE + col];
+        }
+      }
+    }
+    for (int i = cx * CHUNK_SIZE; i < (cx + 1) * CHUNK_SIZE && i < board->columns; i++)
+    {
+      char x_prefix[16];
+      int x_length = writeDigits(x_prefix, i) - x_prefix;
+      x_prefix[x_length++] = ',';
+      for (int k = 0; k < chunks; k++)
+      {
+        int cy = board->chunk_keys[order[first + k]].cy;
+        uint8_t *column = &strip[((size_t)(i & (CHUNK_SIZE - 1)) * chunks + k) * CHUNK_SIZE];
+        for (int j = cy * CHUNK_SIZE; j < (cy + 1) * CHUNK_SIZE && j < board->rows; j++)
+        {
+          memcpy(cursor, x_prefix, x_length);
+          cursor = writeDigits(cursor + x_length, j);
+          cursor[0] = ',';
+          cursor[1] = '0' + column[j & (CHUNK_SIZE - 1)];
+          cursor[2] = '\n';
+          cursor += 3;
+        }
+      }
+    }
+    first = last;
+  }
+  assert((size_t)(cursor - buffer) == size);
+  *cursor = '\0';
+  if (csv_length != NULL)
+  {
+    *csv_length = cursor - buffer;
+  }
+  free(strip);
+  free(order);
+  return buffer;
+}
+
+// boardToSnapshot
+// takes the board and encodes its painted chunks in the binary snapshot format from protocol.h
+// a compact alternative to boardToCSV for clients that ask for it, snapshot_length may not be NULL
+uint8_t *boardToSnapshot(Board *board, size_t *snapshot_length)
+{
+  size_t size = SNAPSHOT_HEADER_SIZE + (size_t)board->chunk_count * SNAPSHOT_CHUNK_SIZE;
+  uint8_t *buffer = (uint8_t *)malloc(size);
+  if (buffer == NULL)
+  {
+    fprintf(stderr, "error malloc boardToSnapshot buffer\n");
+    exit(1);
+  }
+  writeSnapshotHeader(buffer, board->rows, board->columns, board->chunk_count, board->version);
+  uint8_t *cursor = buffer + SNAPSHOT_HEADER_SIZE;
+  for (int i = 0; i < board->chunk_count; i++)
+  {
+    writeU32(&cursor[0], board->chunk_keys[i].cx);
+    writeU32(&cursor[4], board->chunk_keys[i].cy);
+    packChunkColors(&cursor[8], getChunkColors(board, i));
+    cursor += SNAPSHOT_CHUNK_SIZE;
+  }
+  *snapshot_length = size;
+  return buffer;
+}
+
+// boardToRegionSnapshot
+// the snapshot of only the painted chunks inside regions rx0..rx1, ry0..ry1 (see TOPICS in protocol.h),
+// what a client needs when a region scrolls into view. not cached, regions are small
+uint8_t *boardToRegionSnapshot(Board *board, int rx0, int ry0, int rx1, int ry1, size_t *snapshot_length)
+{
+  int shift = REGION_SHIFT - CHUNK_SHIFT;
+  int chunk_count = 0;
+  for (int i = 0; i < board->chunk_count; i++)
+  {
+    int rx = board->chunk_keys[i].cx >> shift;
+    int ry = board->chunk_keys[i].cy >> shift;
+    chunk_count += rx >= rx0 && rx <= rx1 && ry >= ry0 && ry <= ry1;
+  }
+  size_t size = SNAPSHOT_HEADER_SIZE + (size_t)chunk_count * SNAPSHOT_CHUNK_SIZE;
+  uint8_t *buffer = (uint8_t *)malloc(size);
+  if (buffer == NULL)
+  {
+    fprintf(stderr, "error malloc boardToRegionSnapshot buffer\n");
+    exit(1);
+  }
+  writeSnapshotHeader(buffer, board->rows, board->columns, chunk_count, board->version);
+  uint8_t *cursor = buffer + SNAPSHOT_HEADER_SIZE;
+  for (int i = 0; i < board->chunk_count; i++)
+  {
+    int rx = board->chunk_keys[i].cx >> shift;
+    int ry = board->chunk_keys[i].cy >> shift;
+    if (rx < rx0 || rx > rx1 || ry < ry0 || ry > ry1)
+    {
+      continue;
+    }
+    writeU32(&cursor[0], board->chunk_keys[i].cx);
+    writeU32(&cursor[4], board->chunk_keys[i].cy);
+    packChunkColors(&cursor[8], getChunkColors(board, i));
+    cursor += SNAPSHOT_CHUNK_SIZE;
+  }
+  *snapshot_length = size;
+  return buffer;
+}
+
+// csvColorOffset
+// the offset of the color digit of tile x, y in a fetch CSV encoded with the given layout
+size_t csvColorOffset(Board *board, CsvChunkLayout *layout, int x, int y)
+{
+  CsvChunkLayout *chunk_layout = &layout[findChunk(board, x >> CHUNK_SHIFT, y >> CHUNK_SHIFT)];
+  size_t offset = chunk_layout->column_offset;
+  for (int i = x & ~(CHUNK_SIZE - 1); i < x; i++)
+  {
+    offset += (size_t)chunk_layout->column_rows * (countDigits(i) + 4) + chunk_layout->column_row_digits;
+  }
+  int x_digits = countDigits(x);
+  offset += (size_t)chunk_layout->rows_before * (x_digits + 4) + chunk_layout->row_digits_before;
+  for (int j = y & ~(CHUNK_SIZE - 1); j < y; j++)
+  {
+    offset += x_digits + 4 + countDigits(j);
+  }
+  return offset + x_digits + 1 + countDigits(y) + 1;
+}
+
+// getFetchReply
+// returns the encoded fetch reply in the given format, only encoding the board again if it changed
+// since the cached one. the board keeps the reference, sendSharedBuffer takes its own
+SharedBuffer *getFetchReply(Board *board, FetchFormat format)
+{
+  FetchCache *cache = format == FETCH_SNAPSHOT ? &board->snapshot_cache : &board->csv_cache;
+  if (cache->buffer != NULL && cache->version == board->version)
+  {
+    return cache->buffer;
+  }
+  clearFetchCache(cache);
+  size_t size;
+  uint8_t *data;
+  if (format == FETCH_SNAPSHOT)
+  {
+    data = boardToSnapshot(board, &size);
+  }
+  else
+  {
+    cache->layout = (CsvChunkLayout *)malloc((board->chunk_count + 1) * sizeof(CsvChunkLayout));
+    if (cache->layout == NULL)
+    {
+      fprintf(stderr, "error malloc getFetchReply layout\n");
+      exit(1);
+    }
+    data = (uint8_t *)boardToCSV(board, &size, cache->layout);
+  }
+  cache->buffer = newSharedBuffer(data, size);
+  cache->version = board->version;
+  return cache->buffer;
+}
+
+// patchFetchCaches
+// called after a single tile changed without creating a chunk, so the cached replies only differ in
+// the color of that tile. rewrites it in place and keeps the caches current
+void patchFetchCaches(Board *board, int x, int y, int color_num)
+{
+  FetchCache *cache = &board->snapshot_cache;
+  if (cache->buffer != NULL && cache->version == board->version - 1)
+  {
+    cache->buffer = makeSharedBufferWritable(cache->buffer);
+    int chunk_idx = findChunk(board, x >> CHUNK_SHIFT, y >> CHUNK_SHIFT);
+    int tile_idx = (y & (CHUNK_SIZE - 1)) * CHUNK_SIZE + (x & (CHUNK_SIZE - 1));
+    uint8_t *packed = &cache->buffer->data[SNAPSHOT_HEADER_SIZE + (size_t)chunk_idx * SNAPSHOT_CHUNK_SIZE + 8 + tile_idx / 2];
+    *packed = tile_idx % 2 == 0 ? (*packed & 0xf0) | color_num : (*packed & 0x0f) | color_num << 4;
+    writeU32(&cache->buffer->data[20], board->version);
+    cache->version = board->version;
+  }
+  cache = &board->csv_cache;
+  if (cache->buffer != NULL && cache->version == board->version - 1)
+  {
+    cache->buffer = makeSharedBufferWritable(cache->buffer);
+    cache->buffer->data[csvColorOffset(board, cache->layout, x, y)] = '0' + color_num;
+    cache->version = board->version;
+  }
+}
+
+// requestsBinarySnapshot
+// true for "client_id\nfetch\nbinary", the fetch of a client that can decode boardToSnapshot.
+// an older server treats it as an unknown command, which tells the client to fall back to "fetch"
+bool requestsBinarySnapshot(char *received_str)
+{
+  char *command = strchr(received_str, '\n');
+  return command != NULL && strcmp(command + 1, "fetch\nbinary") == 0;
+}
+
+// Command
+// an update, resize or shape of the text or the binary protocol, parsed so it can be applied and
+// published the same way no matter how it arrived
+typedef struct
+{
+  uint8_t opcode;
+  uint32_t client_id;
+  uint32_t seq;
+  // OP_UPDATE, the first corner or end of OP_FILL_RECT and OP_LINE, the center of OP_FILL_CIRCLE and
+  // the seed of OP_FLOOD_FILL
+  int x;
+  int y;
+  int color_num;
+  // OP_RESIZE
+  int rows;
+  int columns;
+  // OP_BATCH_UPDATE, little endian packed tiles (see packTile) inside the received frame
+  int tile_count;
+  const uint8_t *tiles;
+  // the other corner or end of OP_FILL_RECT and OP_LINE
+  int x1;
+  int y1;
+  // OP_FILL_CIRCLE
+  int radius;
+  // OP_FLOOD_FILL, 4 or 8
+  int connectivity;
+} Command;
+
+// encodeCommand
+// the binary command frame of an update, resize or shape, frame needs COMMAND_FRAME_MAX bytes.
+// batches are not encoded here, their frame is as large as their tiles
+size_t encodeCommand(Command *command, uint8_t *frame)
+{
+  switch (command->opcode)
+  {
+  case OP_UPDATE:
+    return encodeUpdate(frame, command->client_id, command->seq, command->x, command->y, command->color_num);
+  case OP_FILL_RECT:
+    return encodeFillRect(frame, command->client_id, command->seq, command->x, command->y, command->x1, command->y1,
+                          command->color_num);
+  case OP_LINE:
+    return encodeLine(frame, command->client_id, command->seq, command->x, command->y, command->x1, command->y1,
+                      command->color_num);
+  case OP_FILL_CIRCLE:
+    return encodeFillCircle(frame, command->client_id, command->seq, command->x, command->y, command->radius,
+                            command->color_num);
+  case OP_FLOOD_FILL:
+    return encodeFloodFill(frame, command->client_id, command->seq, command->x, command->y, command->color_num,
+                           command->connectivity);
+  }
+  return encodeResize(frame, command->client_id, command->seq, command->rows, command->columns);
+}
+
+// readShape
+// fill in the shape fields of a command from its frame, false if the frame is not a shape
+bool readShape(Command *command, CommandHeader *header)
+{
+  if (!isShapeOpcode(header->opcode))
+  {
+    return false;
+  }
+  unpackTile(readU64(header->payload), &command->x, &command->y, &command->color_num);
+  if (header->opcode == OP_FILL_RECT || header->opcode == OP_LINE)
+  {
+    int unused;
+    unpackTile(readU64(&header->payload[8]), &command->x1, &command->y1, &unused);
+  }
+  if (header->opcode == OP_FILL_CIRCLE)
+  {
+    command->radius = (int)(readU32(&header->payload[8]) & 0x7fffffff);
+  }
+  if (header->opcode == OP_FLOOD_FILL)
+  {
+    command->connectivity = header->payload[8];
+  }
+  return true;
+}
+
+// recordCommand
+// stamp an applied command with the new board version and keep its frame for fetch_since,
+// overwriting the oldest one once the ring is full
+void recordCommand(Board *board, Command *command)
+{
+  command->seq = board->version;
+  encodeCommand(command, &board->op_frames[(size_t)(board->version % OP_RING_CAPACITY) * COMMAND_FRAME_MAX]);
+  if (board->op_count < OP_RING_CAPACITY)
+  {
+    board->op_count++;
+  }
+}
+
+// getDeltaReply
+// the reply to a fetch_since from a client at board version since: the frames it missed if they are
+// all still in the ring, NULL if it has to fetch a snapshot instead
+SharedBuffer *getDeltaReply(Board *board, uint32_t since)
+{
+  // wraps around to a huge count for a client ahead of the board, e.g. after a server restart
+  uint32_t missed = board->version - since;
+  if (missed > board->op_count)
+  {
+    return NULL;
+  }
+  // clients can not repeat a flood fill, they may not have the whole board
+  for (uint32_t seq = since + 1; seq != board->version + 1; seq++)
+  {
+    if (board->op_frames[(size_t)(seq % OP_RING_CAPACITY) * COMMAND_FRAME_MAX + 1] == OP_FLOOD_FILL)
+    {
+      return NULL;
+    }
+  }
+  size_t size = DELTA_HEADER_SIZE + (size_t)missed * COMMAND_FRAME_MAX;
+  uint8_t *data = (uint8_t *)malloc(size);
+  if (data == NULL)
+  {
+    fprintf(stderr, "error malloc getDeltaReply\n");
+    exit(1);
+  }
+  writeDeltaHeader(data, since, board->version, missed);
+  uint8_t *cursor = data + DELTA_HEADER_SIZE;
+  for (uint32_t seq = since + 1; seq != board->version + 1; seq++)
+  {
+    memcpy(cursor, &board->op_frames[(size_t)(seq % OP_RING_CAPACITY) * COMMAND_FRAME_MAX], COMMAND_FRAME_MAX);
+    cursor += COMMAND_FRAME_MAX;
+  }
+  return newSharedBuffer(data, size);
+}
+
+// sendFetchSince
+// send the delta from since to the current board version, or the snapshot if the ring has wrapped past it
+void sendFetchSince(Board *board, uint32_t since)
+{
+  SharedBuffer *delta = getDeltaReply(board, since);
+  if (delta == NULL)
+  {
+    printf("fetch since %u: not all in the ring, sending snapshot at %u\n", since, board->version);
+    sendReplyEnvelope();
+    sendSharedBuffer(responder, getFetchReply(board, FETCH_SNAPSHOT));
+    return;
+  }
+  sendReplyEnvelope();
+  sendSharedBuffer(responder, delta);
+  releaseSharedBuffer(delta);
+}
+
+// parseFetchSince
+// true for "client_id\nfetch_since\nseq", the text form of OP_FETCH_SINCE
+bool parseFetchSince(char *received_str, uint32_t *since)
+{
+  char *command = strchr(received_str, '\n');
+  if (command == NULL || strncmp(command + 1, "fetch_since\n", 12) != 0)
+  {
+    return false;
+  }
+  *since = (uint32_t)strtoul(command + 13, NULL, 10);
+  return true;
+}
+
+// parseBoardUpdate
+// take received update string "x,y,color" and parse it into the command
+void parseBoardUpdate(Command *command, char *received_str)
+{
+  printf("parsing input %s\n", received_str);
+  char *token;
+  token = strtok(received_str, ",");
+  int x = -1;
+  int y = -1;
+  int color_num = -1;
+  int i = 0;
+  while (token != NULL)
+  {
+    if (i == 0)
+    {
+      x = atoi(token);
+    }
+    if (i == 1)
+    {
+      y = atoi(token);
+    }
+    if (i == 2)
+    {
+      color_num = atoi(token);
+    }
+    token = strtok(NULL, ",");
+    i++;
+  }
+  command->opcode = OP_UPDATE;
+  command->x = x;
+  command->y = y;
+  command->color_num = color_num;
+}
+
+// parseBoardResize
+// take received resize string "rows,columns" and parse it into the command
+void parseBoardResize(Command *command, char *received_str)
+{
+  printf("parsing resize string %s\n", received_str);
+  char *token;
+  token = strtok(received_str, ",");
+  int new_rows = 32;
+  int new_cols = 32;
+  int i = 0;
+  while (token != NULL)
+  {
+    if (i == 0)
+    {
+      new_rows = atoi(token);
+    }
+    if (i == 1)
+    {
+      new_cols = atoi(token);
+    }
+    token = strtok(NULL, ",");
+    i++;
+  }
+  command->opcode = OP_RESIZE;
+  command->rows = new_rows;
+  command->columns = new_cols;
+}
+
+// parseBoardShape
+// take received shape arguments and parse them into the command: "x0,y0,x1,y1,color" for rect and line,
+// "x,y,radius,color" for circle and "x,y,color" or "x,y,color,connectivity" for flood, 4-connected if
+// it is left out
+void parseBoardShape(Command *command, uint8_t opcode, char *received_str)
+{
+  printf("parsing shape string %s\n", received_str);
+  int values[5] = {-1, -1, -1, -1, -1};
+  int i = 0;
+  char *token = strtok(received_str, ",");
+  while (token != NULL && i < 5)
+  {
+    values[i] = atoi(token);
+    token = strtok(NULL, ",");
+    i++;
+  }
+  command->opcode = opcode;
+  command->x = values[0];
+  command->y = values[1];
+  if (opcode == OP_FILL_RECT || opcode == OP_LINE)
+  {
+    command->x1 = values[2];
+    command->y1 = values[3];
+    command->color_num = values[4];
+  }
+  if (opcode == OP_FILL_CIRCLE)
+  {
+    command->radius = values[2];
+    command->color_num = values[3];
+  }
+  if (opcode == OP_FLOOD_FILL)
+  {
+    command->color_num = values[2];
+    command->connectivity = values[3] == -1 ? 4 : values[3];
+  }
+}
+
+// WRITE-AHEAD LOG
+// ---------------
+// every applied command is appended to the store of its board (store.db for the default board, see
+// DOCUMENTS) as its binary command frame, stamped with the board version after applying it, and replayed
+// when the board is loaded. the worker of the board only copies frames into a ring, a separate I/O thread
+// writes out everything queued in one write and fdatasync (group commit) so the command loop never waits
+// on the disk
+
+#define STORE_MAGIC "TWAL"
+#define STORE_VERSION 1
+#define STORE_HEADER_SIZE 8
+// bytes of frames waiting for the I/O thread, holds a few hundred full batches. power of two
+#define STORE_RING_CAPACITY (1 << 22)
+#define STORE_WRITE_MAX (1 << 20)
+// queued bytes that wake the I/O thread before its next write in the modes that write on a timer
+#define STORE_RING_FLUSH (STORE_RING_CAPACITY / 4)
+
+typedef enum
+{
+  // the reply to a command is only sent once the command is on disk
+  DURABILITY_ALWAYS,
+  // commands are written and synced every durability_ms, replies do not wait for it
+  DURABILITY_INTERVAL,
+  // written every durability_ms without syncing, the OS decides when it reaches the disk
+  DURABILITY_OFF,
+} Durability;
+
+// PendingReply
+// the reply to a command, held back in DURABILITY_ALWAYS until the store is synced up to its version
+typedef struct
+{
+  zmsg_t *reply;
+  uint32_t version;
+} PendingReply;
+
+typedef struct Store
+{
+  const char *path;
+  int fd;
+  Durability durability;
+  int durability_ms;
+  // set while startup replays the log, keeps applyCommand quiet and from logging the commands again
+  bool replaying;
+  // size of the store when startStore started the thread and once stopStore closed it
+  uint64_t start_offset;
+  uint64_t end_offset;
+  // worker -> I/O thread frames, head and tail count bytes and only ever grow
+  uint8_t *ring;
+  atomic_size_t head;
+  atomic_size_t tail;
+  sem_t wakeup;
+  pthread_t thread;
+  atomic_bool running;
+  // the board version every command up to is on disk, set by the I/O thread after each sync
+  atomic_uint durable_version;
+  // the I/O thread signals durable_writer after every sync, the worker polls durable_reader
+  zsock_t *durable_reader;
+  zsock_t *durable_writer;
+  PendingReply *pending;
+  int pending_first;
+  int pending_count;
+  int pending_capacity;
+  // written by the I/O thread, read once it is joined
+  unsigned long records_written;
+  unsigned long bytes_written;
+  unsigned long writes;
+  unsigned long syncs;
+  // how often the worker found the ring full and had to wait for the I/O thread
+  unsigned long stalls;
+} Store;
+
+// the store of the board being worked on, every thread that touches a board points it at the store of
+// that board first (see useDocument)
+_Thread_local Store *store;
+// set by --durability, the mode every store starts in
+Durability durability = DURABILITY_ALWAYS;
+int durability_ms = 10;
+
+// parseDurability
+// --durability always, off or a number of milliseconds between syncs
+void parseDurability(const char *value)
+{
+  if (strcmp(value, "always") == 0)
+  {
+    durability = DURABILITY_ALWAYS;
+    return;
+  }
+  if (strcmp(value, "off") == 0)
+  {
+    durability = DURABILITY_OFF;
+    return;
+  }
+  durability_ms = atoi(value);
+  if (durability_ms <= 0)
+  {
+    fprintf(stderr, "--durability takes always, off or a number of milliseconds, not %s\n", value);
+    exit(1);
+  }
+  durability = DURABILITY_INTERVAL;
+}
+
+// writeAll
+// write the whole buffer to fd, retrying short writes. path names the file in the error
+void writeAll(int fd, const uint8_t *data, size_t size, const char *path)
+{
+  while (size > 0)
+  {
+    ssize_t written = write(fd, data, size);
+    if (written < 0 && errno == EINTR)
+    {
+      continue;
+    }
+    if (written < 0)
+    {
+      fprintf(stderr, "error writing %s: %s\n", path, strerror(errno));
+      exit(1);
+    }
+    data += written;
+    size -= written;
+  }
+}
+
+// syncStore
+// fdatasync the store and tell the worker which version is on disk now
+void syncStore(uint32_t version)
+{
+  if (fdatasync(store->fd) != 0)
+  {
+    fprintf(stderr, "error syncing %s: %s\n", store->path, strerror(errno));
+    exit(1);
+  }
+  store->syncs++;
+  atomic_store_explicit(&store->durable_version, version, memory_order_release);
+  if (store->durable_writer != NULL)
+  {
+    zsock_signal(store->durable_writer, 0);
+  }
+}
+
+// copyFromStoreRing
+// copy size bytes starting at byte position of the ring, wrapping around its end
+void copyFromStoreRing(uint8_t *out, size_t position, size_t size)
+{
+  size_t offset = position & (STORE_RING_CAPACITY - 1);
+  size_t first = size < STORE_RING_CAPACITY - offset ? size : STORE_RING_CAPACITY - offset;
+  memcpy(out, &store->ring[offset], first);
+  memcpy(&out[first], store->ring, size - first);
+}
+
+// runStoreThread
+// the I/O thread: waits for frames, gathers every whole frame queued into one write and syncs as the
+// durability mode asks. in DURABILITY_ALWAYS the next group of frames queues up while one fdatasync runs.
+// arg is the store
+void *runStoreThread(void *arg)
+{
+  store = (Store *)arg;
+  uint8_t *buffer = malloc(STORE_WRITE_MAX);
+  if (buffer == NULL)
+  {
+    fprintf(stderr, "error malloc in runStoreThread\n");
+    exit(1);
+  }
+  uint32_t written_version = atomic_load(&store->durable_version);
+  bool unsynced = false;
+  double next_flush = nowMs() + store->durability_ms;
+  for (;;)
+  {
+    bool running = atomic_load(&store->running);
+    size_t tail = atomic_load_explicit(&store->tail, memory_order_relaxed);
+    size_t queued = atomic_load_explicit(&store->head, memory_order_acquire) - tail;
+    if (running && store->durability == DURABILITY_ALWAYS && queued == 0)
+    {
+      sem_wait(&store->wakeup);
+    }
+    else if (running && store->durability != DURABILITY_ALWAYS && queued < STORE_RING_FLUSH &&
+             nowMs() < next_flush)
+    {
+      // the other modes write every durability_ms, or sooner once the ring fills up
+      double remaining = next_flush - nowMs();
+      struct timespec deadline;
+      clock_gettime(CLOCK_REALTIME, &deadline);
+      long nsec = deadline.tv_nsec + (long)(remaining * 1000000.0);
+      deadline.tv_sec += nsec / 1000000000;
+      deadline.tv_nsec = nsec % 1000000000;
+      sem_timedwait(&store->wakeup, &deadline);
+    }
+    // one wakeup covers every frame queued so far
+    while (sem_trywait(&store->wakeup) == 0)
+    {
+    }
+
+    size_t head = atomic_load_explicit(&store->head, memory_order_acquire);
+    while (tail != head)
+    {
+      size_t size = 0;
+      while (tail != head)
+      {
+        uint8_t header[COMMAND_HEADER_SIZE];
+        copyFromStoreRing(header, tail, COMMAND_HEADER_SIZE);
+        size_t frame_size = COMMAND_HEADER_SIZE + readU16(&header[2]);
+        if (size + frame_size > STORE_WRITE_MAX)
+        {
+          break;
+        }
+        copyFromStoreRing(&buffer[size], tail, frame_size);
+        written_version = readU32(&header[8]);
+        size += frame_size;
+        tail += frame_size;
+        store->records_written++;
+      }
+      writeAll(store->fd, buffer, size, store->path);
+      store->bytes_written += size;
+      store->writes++;
+      atomic_store_explicit(&store->tail, tail, memory_order_release);
+      unsynced = true;
+    }
+
+    if (store->durability != DURABILITY_ALWAYS && nowMs() >= next_flush)
+    {
+      next_flush = nowMs() + store->durability_ms;
+    }
+    if (unsynced && store->durability == DURABILITY_OFF)
+    {
+      atomic_store(&store->durable_version, written_version);
+      unsynced = false;
+    }
+    if (unsynced)
+    {
+      syncStore(written_version);
+      unsynced = false;
+    }
+    if (!running && tail == atomic_load(&store->head))
+    {
+      break;
+    }
+  }
+  free(buffer);
+  return NULL;
+}
+
+// appendStoreRecord
+// queue a command frame for the I/O thread, the header and payload may be apart. only waits if the
+// I/O thread is STORE_RING_CAPACITY bytes behind
+void appendStoreRecord(const uint8_t *header, const uint8_t *payload, size_t payload_length)
+{
+  size_t size = COMMAND_HEADER_SIZE + payload_length;
+  size_t head = atomic_load_explicit(&store->head, memory_order_relaxed);
+  if (head + size - atomic_load_explicit(&store->tail, memory_order_acquire) > STORE_RING_CAPACITY)
+  {
+    store->stalls++;
+    while (head + size - atomic_load_explicit(&store->tail, memory_order_acquire) > STORE_RING_CAPACITY)
+    {
+      sem_post(&store->wakeup);
+      usleep(100);
+    }
+  }
+  const uint8_t *parts[2] = {header, payload};
+  size_t part_sizes[2] = {COMMAND_HEADER_SIZE, payload_length};
+  size_t position = head;
+  for (int p = 0; p < 2; p++)
+  {
+    size_t offset = position & (STORE_RING_CAPACITY - 1);
+    size_t first = part_sizes[p] < STORE_RING_CAPACITY - offset ? part_sizes[p] : STORE_RING_CAPACITY - offset;
+    memcpy(&store->ring[offset], parts[p], first);
+    memcpy(store->ring, parts[p] + first, part_sizes[p] - first);
+    position += part_sizes[p];
+  }
+  atomic_store_explicit(&store->head, position, memory_order_release);
+  if (store->durability == DURABILITY_ALWAYS ||
+      position - atomic_load_explicit(&store->tail, memory_order_relaxed) >= STORE_RING_FLUSH)
+  {
+    sem_post(&store->wakeup);
+  }
+}
+
+// storeCommand
+// log an applied command, its seq is already the board version after it. batches keep their
+// tiles together in one frame so a crash never replays half of one
+void storeCommand(Command *command)
+{
+  if (!atomic_load_explicit(&store->running, memory_order_relaxed))
+  {
+    return;
+  }
+  uint8_t frame[COMMAND_FRAME_MAX];
+  if (command->opcode == OP_BATCH_UPDATE)
+  {
+    writeCommandHeaderLength(frame, OP_BATCH_UPDATE, command->tile_count * 8, command->client_id, command->seq);
+    appendStoreRecord(frame, command->tiles, (size_t)command->tile_count * 8);
+    return;
+  }
+  size_t size = encodeCommand(command, frame);
+  appendStoreRecord(frame, &frame[COMMAND_HEADER_SIZE], size - COMMAND_HEADER_SIZE);
+}
+
+// openStore
+// open or create the store, writing the header of a new one. returns the file contents from file offset
+// from on for replayStore, *length bytes of them
+uint8_t *openStore(uint64_t from, size_t *length)
+{
+  store->fd = open(store->path, O_RDWR | O_CREAT | O_APPEND, 0644);
+  if (store->fd < 0)
+  {
+    fprintf(stderr, "error opening %s: %s\n", store->path, strerror(errno));
+    exit(1);
+  }
+  off_t size = lseek(store->fd, 0, SEEK_END);
+  uint8_t header[STORE_HEADER_SIZE];
+  if (size == 0)
+  {
+    memcpy(header, STORE_MAGIC, 4);
+    writeU32(&header[4], STORE_VERSION);
+    writeAll(store->fd, header, STORE_HEADER_SIZE, store->path);
+    size = STORE_HEADER_SIZE;
+  }
+  else if (size < STORE_HEADER_SIZE || pread(store->fd, header, STORE_HEADER_SIZE, 0) != STORE_HEADER_SIZE ||
+           memcmp(header, STORE_MAGIC, 4) != 0 || readU32(&header[4]) != STORE_VERSION)
+  {
+    fprintf(stderr, "%s is not a tile log of version %d, move it away to start a new one\n", store->path,
+            STORE_VERSION);
+    exit(1);
+  }
+  if (from > (uint64_t)size)
+  {
+    fprintf(stderr, "%s ends before the board file or the snapshot, move them away to rebuild the board from it\n",
+            store->path);
+    exit(1);
+  }
+  *length = size - from;
+  uint8_t *contents = malloc(*length > 0 ? *length : 1);
+  if (contents == NULL)
+  {
+    fprintf(stderr, "error malloc in openStore\n");
+    exit(1);
+  }
+  size_t read_size = 0;
+  while (read_size < *length)
+  {
+    ssize_t got = pread(store->fd, &contents[read_size], *length - read_size, from + read_size);
+    if (got <= 0)
+    {
+      fprintf(stderr, "error reading %s: %s\n", store->path, got < 0 ? strerror(errno) : "file shrank");
+      exit(1);
+    }
+    read_size += got;
+  }
+  return contents;
+}
+
+// startStore
+// start the I/O thread, everything replayed so far counts as on disk
+void startStore(uint32_t version)
+{
+  store->ring = malloc(STORE_RING_CAPACITY);
+  if (store->ring == NULL)
+  {
+    fprintf(stderr, "error malloc in startStore\n");
+    exit(1);
+  }
+  atomic_store(&store->head, 0);
+  atomic_store(&store->tail, 0);
+  store->start_offset = lseek(store->fd, 0, SEEK_END);
+  atomic_store(&store->durable_version, version);
+  sem_init(&store->wakeup, 0, 0);
+  atomic_store(&store->running, true);
+  if (pthread_create(&store->thread, NULL, runStoreThread, store) != 0)
+  {
+    fprintf(stderr, "error starting the store thread\n");
+    exit(1);
+  }
+}
+
+// stopStore
+// write out whatever is still queued and sync it unless durability is off, then close the store
+void stopStore(void)
+{
+  atomic_store(&store->running, false);
+  sem_post(&store->wakeup);
+  pthread_join(store->thread, NULL);
+  sem_destroy(&store->wakeup);
+  store->end_offset = lseek(store->fd, 0, SEEK_END);
+  close(store->fd);
+  store->fd = -1;
+  free(store->ring);
+  store->ring = NULL;
+}
+
+// sendCommandReply
+// send the reply to the command being handled, in DURABILITY_ALWAYS it is held back until the board
+// version it left is on disk. replies of rejected commands wait too so a client gets them in order
+void sendCommandReply(Board *board, const void *data, size_t size)
+{
+  uint32_t durable_version = atomic_load_explicit(&store->durable_version, memory_order_acquire);
+  if (store->durability != DURABILITY_ALWAYS || store->durable_reader == NULL ||
+      (store->pending_count == 0 && (int32_t)(durable_version - board->version) >= 0))
+  {
+    sendReplyEnvelope();
+    zsock_send(responder, "b", data, size);
+    return;
+  }
+  if (store->pending_count == store->pending_capacity)
+  {
+    // reuse the slots of replies already sent before growing
+    if (store->pending_first > 0)
+    {
+      memmove(store->pending, &store->pending[store->pending_first],
+              (store->pending_count - store->pending_first) * sizeof(PendingReply));
+      store->pending_count -= store->pending_first;
+      store->pending_first = 0;
+    }
+    else
+    {
+      store->pending_capacity = store->pending_capacity > 0 ? store->pending_capacity * 2 : 256;
+      store->pending = realloc(store->pending, store->pending_capacity * sizeof(PendingReply));
+      if (store->pending == NULL)
+      {
+        fprintf(stderr, "error realloc in sendCommandReply\n");
+        exit(1);
+      }
+    }
+  }
+  zmsg_t *reply = zmsg_new();
+  zframe_t *identity = zframe_dup(reply_envelope.identity);
+  zmsg_append(reply, &identity);
+  if (reply_envelope.delimiter != NULL)
+  {
+    zframe_t *delimiter = zframe_dup(reply_envelope.delimiter);
+    zmsg_append(reply, &delimiter);
+  }
+  zmsg_addmem(reply, data, size);
+  store->pending[store->pending_count++] = (PendingReply){.reply = reply, .version = board->version};
+}
+
+// sendDurableReplies
+// send the held back replies of every command that is on disk now
+void sendDurableReplies(void)
+{
+  uint32_t durable_version = atomic_load_explicit(&store->durable_version, memory_order_acquire);
+  while (store->pending_first < store->pending_count &&
+         (int32_t)(durable_version - store->pending[store->pending_first].version) >= 0)
+  {
+    zmsg_send(&store->pending[store->pending_first].reply, responder);
+    store->pending_first++;
+  }
+  if (store->pending_first == store->pending_count)
+  {
+    store->pending_first = 0;
+    store->pending_count = 0;
+  }
+}
+
+// handleStoreSyncs
+// take the signals of the syncs the store thread finished and send the replies they made durable,
+// checked between requests too so a busy responder does not hold them back
+void handleStoreSyncs(void)
+{
+  if (store->durable_reader == NULL || !(zsock_events(store->durable_reader) & ZMQ_POLLIN))
+  {
+    return;
+  }
+  while (zsock_events(store->durable_reader) & ZMQ_POLLIN)
+  {
+    zsock_wait(store->durable_reader);
+  }
+  sendDurableReplies();
+}
+
+// isUpdateInBounds
+bool isUpdateInBounds(Board *board, int x, int y, int color_num)
+{
+  return x >= 0 && x < board->columns && y >= 0 && y < board->rows && color_num >= 0 && color_num < PALETTE_SIZE;
+}
+
+// applyUpdate
+// set a tile that is known to be in bounds and record it as its own update for fetch_since
+void applyUpdate(Board *board, Command *update)
+{
+  int chunk_count = board->chunk_count;
+  *getBoardTile(board, update->y, update->x) = update->color_num;
+  board->version++;
+  recordCommand(board, update);
+  if (board->chunk_count == chunk_count)
+  {
+    patchFetchCaches(board, update->x, update->y, update->color_num);
+  }
+}
+
+// SHAPES
+// ------
+// rectangles, lines and circles are rasterized into row runs (see SHAPES in protocol.h) and every run is
+// painted with fillBoardRow. a flood fill is a queue based scanline fill: a queued seed grows into the
+// run of the old color around it, which is painted with one fillBoardRow, and the runs of the old color
+// touching it in the rows above and below are queued
+
+// ShapeFill
+// what fillShapeRow paints with
+typedef struct
+{
+  Board *board;
+  int color_num;
+} ShapeFill;
+
+// fillShapeRow
+// ShapeRowFn painting a run of a shape
+void fillShapeRow(void *context, int y, int x0, int x1)
+{
+  ShapeFill *fill = (ShapeFill *)context;
+  fillBoardRow(fill->board, y, x0, x1, fill->color_num);
+}
+
+// FillSpan
+// columns x0..x1 of row y, painted by a flood fill
+typedef struct
+{
+  int y;
+  int x0;
+  int x1;
+} FillSpan;
+
+// the runs the last flood fill painted, published after it, and the queue of x, y seeds of a flood
+// fill. thread local, every worker fills its own boards
+_Thread_local FillSpan *fill_spans;
+_Thread_local int fill_span_count;
+_Thread_local int fill_span_capacity;
+_Thread_local int *fill_seeds;
+_Thread_local int fill_seed_capacity;
+// the most tiles a shape on the board being worked on may paint, set with the store (see useDocument)
+_Thread_local int64_t shape_tile_limit = SHAPE_MAX_TILES;
+
+// growFillBuffer
+// double the capacity of a flood fill or publish buffer of items of item_size bytes
+void *growFillBuffer(void *buffer, int *capacity, size_t item_size)
+{
+  *capacity = *capacity == 0 ? 1024 : *capacity * 2;
+  buffer = realloc(buffer, (size_t)*capacity * item_size);
+  if (buffer == NULL)
+  {
+    fprintf(stderr, "error realloc flood fill buffer\n");
+    exit(1);
+  }
+  return buffer;
+}
+
+// freeFillBuffers
+// call before a thread that applied commands exits
+void freeFillBuffers(void)
+{
+  free(fill_spans);
+  free(fill_seeds);
+  fill_spans = NULL;
+  fill_seeds = NULL;
+  fill_span_capacity = 0;
+  fill_seed_capacity = 0;
+}
+
+// floodRow
+// the colors of row y of the chunk holding column x, NULL while the chunk is unpainted and all color 0.
+// lets a flood fill scan a row without looking up the chunk of every tile
+const uint8_t *floodRow(Board *board, int y, int x)
+{
+  int chunk_idx = findChunk(board, x >> CHUNK_SHIFT, y >> CHUNK_SHIFT);
+  return chunk_idx < 0 ? NULL : &getChunkColors(board, chunk_idx)[(y & (CHUNK_SIZE - 1)) * CHUNK_SIZE];
+}
+
+// shapeTileLimit
+// the most tiles one shape may paint, the store is replayed without the limit of --text-pub
+int64_t shapeTileLimit(void)
+{
+  return store->replaying ? SHAPE_MAX_TILES : shape_tile_limit;
+}
+
+// countShapeRow
+// ShapeRowFn adding up the tiles of a shape instead of painting them
+void countShapeRow(void *context, int y, int x0, int x1)
+{
+  *(int64_t *)context += x1 - x0 + 1;
+}
+
+// floodFillBoard
+// paint the tiles of the color of the seed that are 4- or 8-connected to it, keeping the runs in
+// fill_spans. returns false and leaves the colors and chunks as they were if it would paint more than
+// shapeTileLimit tiles or nothing at all
+bool floodFillBoard(Board *board, Command *command)
+{
+  int64_t limit = shapeTileLimit();
+  // chunks are appended to the pool, the ones at and after this were created by the fill
+  int chunk_count = board->chunk_count;
+  int old_color = getBoardColor(board, command->y, command->x);
+  fill_span_count = 0;
+  if (old_color == command->color_num)
+  {
+    return false;
+  }
+  // neighbors of a run in the rows above and below it, one more tile to each side for diagonals
+  int reach = command->connectivity == 8;
+  int64_t painted = 0;
+  // seeds are x, y pairs, taken at head and added at tail
+  int head = 0;
+  int tail = 0;
+  if (fill_seed_capacity == 0)
+  {
+    fill_seeds = (int *)growFillBuffer(fill_seeds, &fill_seed_capacity, sizeof(int));
+  }
+  fill_seeds[tail++] = command->x;
+  fill_seeds[tail++] = command->y;
+  while (head < tail)
+  {
+    int x = fill_seeds[head++];
+    int y = fill_seeds[head++];
+    if (getBoardColor(board, y, x) != old_color)
+    {
+      continue;
+    }
+    int x0 = x;
+    int x1 = x;
+    const uint8_t *row = floodRow(board, y, x);
+    while (x0 > 0)
+    {
+      if ((x0 & (CHUNK_SIZE - 1)) == 0)
+      {
+        row = floodRow(board, y, x0 - 1);
+      }
+      if ((row != NULL ? row[(x0 - 1) & (CHUNK_SIZE - 1)] : 0) != old_color)
+      {
+        break;
+      }
+      x0--;
+    }
+    row = floodRow(board, y, x);
+    while (x1 < board->columns - 1)
+    {
+      if (((x1 + 1) & (CHUNK_SIZE - 1)) == 0)
+      {
+        row = floodRow(board, y, x1 + 1);
+      }
+      if ((row != NULL ? row[(x1 + 1) & (CHUNK_SIZE - 1)] : 0) != old_color)
+      {
+        break;
+      }
+      x1++;
+    }
+    fillBoardRow(board, y, x0, x1, command->color_num);
+    if (fill_span_count == fill_span_capacity)
+    {
+      fill_spans = (FillSpan *)growFillBuffer(fill_spans, &fill_span_capacity, sizeof(FillSpan));
+    }
+    fill_spans[fill_span_count++] = (FillSpan){y, x0, x1};
+    painted += x1 - x0 + 1;
+    if (painted > limit)
+    {
+      for (int i = 0; i < fill_span_count; i++)
+      {
+        fillBoardRow(board, fill_spans[i].y, fill_spans[i].x0, fill_spans[i].x1, old_color);
+      }
+      fill_span_count = 0;
+      // a chunk only gets created for unpainted tiles, so the created ones are all color 0 again. drop
+      // them like trimBoardChunks does, a rejected fill must not leave memory or board file chunks behind
+      if (board->chunk_count != chunk_count)
+      {
+        board->chunk_count = chunk_count;
+        rebuildChunkDirectory(board, board->directory_capacity);
+      }
+      return false;
+    }
+    for (int ny = y - 1; ny <= y + 1; ny += 2)
+    {
+      if (ny < 0 || ny >= board->rows)
+      {
+        continue;
+      }
+      int from = x0 - reach < 0 ? 0 : x0 - reach;
+      int to = x1 + reach >= board->columns ? board->columns - 1 : x1 + reach;
+      bool in_run = false;
+      row = floodRow(board, ny, from);
+      for (int nx = from; nx <= to; nx++)
+      {
+        if (nx != from && (nx & (CHUNK_SIZE - 1)) == 0)
+        {
+          row = floodRow(board, ny, nx);
+        }
+        bool matches = (row != NULL ? row[nx & (CHUNK_SIZE - 1)] : 0) == old_color;
+        if (matches && !in_run)
+        {
+          // move the queue to the front before growing it
+          if (tail + 2 > fill_seed_capacity && head > 0)
+          {
+            memmove(fill_seeds, &fill_seeds[head], (size_t)(tail - head) * sizeof(int));
+            tail -= head;
+            head = 0;
+          }
+          if (tail + 2 > fill_seed_capacity)
+          {
+            fill_seeds = (int *)growFillBuffer(fill_seeds, &fill_seed_capacity, sizeof(int));
+          }
+          fill_seeds[tail++] = nx;
+          fill_seeds[tail++] = ny;
+        }
+        in_run = matches;
+      }
+    }
+  }
+  return true;
+}
+
+// applyShape
+// paint a shape, returns false without painting if a corner, end, center or seed is off the board,
+// the radius or connectivity is invalid or it would paint more than shapeTileLimit tiles
+bool applyShape(Board *board, Command *command)
+{
+  if (!isUpdateInBounds(board, command->x, command->y, command->color_num))
+  {
+    return false;
+  }
+  ShapeFill fill = {board, command->color_num};
+  int64_t limit = shapeTileLimit();
+  int64_t tiles = 0;
+  switch (command->opcode)
+  {
+  case OP_FILL_RECT:
+    if (!isUpdateInBounds(board, command->x1, command->y1, command->color_num) ||
+        rectTileCount(command->x, command->y, command->x1, command->y1) > limit)
+    {
+      return false;
+    }
+    rasterizeRect(command->x, command->y, command->x1, command->y1, fillShapeRow, &fill);
+    return true;
+  case OP_LINE:
+    if (!isUpdateInBounds(board, command->x1, command->y1, command->color_num) ||
+        abs(command->x1 - command->x) + 1 > limit || abs(command->y1 - command->y) + 1 > limit)
+    {
+      return false;
+    }
+    rasterizeLine(command->x, command->y, command->x1, command->y1, fillShapeRow, &fill);
+    return true;
+  case OP_FILL_CIRCLE:
+    if (command->radius < 0 || command->radius > SHAPE_MAX_RADIUS)
+    {
+      return false;
+    }
+    if (limit < SHAPE_MAX_TILES)
+    {
+      rasterizeCircle(command->x, command->y, command->radius, board->rows, board->columns, countShapeRow, &tiles);
+      if (tiles > limit)
+      {
+        return false;
+      }
+    }
+    rasterizeCircle(command->x, command->y, command->radius, board->rows, board->columns, fillShapeRow, &fill);
+    return true;
+  case OP_FLOOD_FILL:
+    return (command->connectivity == 4 || command->connectivity == 8) && floodFillBoard(board, command);
+  }
+  return false;
+}
+
+// applyCommand
+// apply an update, batch, resize or shape to the board tiles state, returns false and leaves the board
+// alone if the command is out of bounds. a batch is only applied if all of its tiles are in bounds
+bool applyCommand(Board *board, Command *command)
+{
+  if (command->opcode == OP_UPDATE)
+  {
+    if (!isUpdateInBounds(board, command->x, command->y, command->color_num))
+    {
+      fprintf(stderr, "ignoring update of %d, %d to %d\n", command->x, command->y, command->color_num);
+      return false;
+    }
+    if (!store->replaying)
+    {
+      printf("setting %d, %d to %d\n", command->x, command->y, command->color_num);
+    }
+    applyUpdate(board, command);
+    storeCommand(command);
+    return true;
+  }
+  if (command->opcode == OP_BATCH_UPDATE)
+  {
+    Command update = {.opcode = OP_UPDATE, .client_id = command->client_id};
+    for (int i = 0; i < command->tile_count; i++)
+    {
+      unpackTile(readU64(&command->tiles[i * 8]), &update.x, &update.y, &update.color_num);
+      if (!isUpdateInBounds(board, update.x, update.y, update.color_num))
+      {
+        fprintf(stderr, "ignoring batch of %d tiles, update of %d, %d to %d\n", command->tile_count, update.x,
+                update.y, update.color_num);
+        return false;
+      }
+    }
+    if (!store->replaying)
+    {
+      printf("setting batch of %d tiles\n", command->tile_count);
+    }
+    for (int i = 0; i < command->tile_count; i++)
+    {
+      unpackTile(readU64(&command->tiles[i * 8]), &update.x, &update.y, &update.color_num);
+      applyUpdate(board, &update);
+    }
+    command->seq = board->version;
+    storeCommand(command);
+    return true;
+  }
+  if (command->opcode == OP_RESIZE)
+  {
+    if (command->rows < 1 || command->rows > MAX_BOARD_DIMENSION || command->columns < 1 ||
+        command->columns > MAX_BOARD_DIMENSION)
+    {
+      fprintf(stderr, "ignoring resize to %d, %d\n", command->rows, command->columns);
+      return false;
+    }
+    if (board->rows != command->rows)
+    {
+      resizeBoardHeight(board, command->rows);
+    }
+    if (board->columns != command->columns)
+    {
+      resizeBoardWidth(board, command->columns);
+    }
+    board->version++;
+    recordCommand(board, command);
+    storeCommand(command);
+    return true;
+  }
+  if (isShapeOpcode(command->opcode))
+  {
+    if (!applyShape(board, command))
+    {
+      fprintf(stderr, "ignoring shape %d at %d, %d to %d\n", command->opcode, command->x, command->y,
+              command->color_num);
+      return false;
+    }
+    if (!store->replaying)
+    {
+      printf("painting shape %d at %d, %d to %d\n", command->opcode, command->x, command->y, command->color_num);
+    }
+    board->version++;
+    recordCommand(board, command);
+    storeCommand(command);
+    return true;
+  }
+  return false;
+}
+
+// replayStore
+// apply the commands of the store to a new board before serving it, starting at file offset from, 0 for
+// the whole store. the log ends at the first frame that is cut off or does not follow the one before it,
+// what a crash in the middle of a write leaves, and that tail is cut off so new commands continue a
+// valid log
+void replayStore(Board *board, uint64_t from)
+{
+  size_t length;
+  uint64_t base = from > 0 ? from : STORE_HEADER_SIZE;
+  uint8_t *log = openStore(base, &length);
+  if (from == 0 && length == 0)
+  {
+    // a new store starts with the random tiles of initBoard, as a batch of seq 0 that no client sent
+    uint64_t tiles[INIT_ROWS * INIT_COLUMNS];
+    for (int i = 0; i < INIT_ROWS; i++)
+    {
+      for (int j = 0; j < INIT_COLUMNS; j++)
+      {
+        tiles[i * INIT_COLUMNS + j] = packTile(j, i, getBoardColor(board, i, j));
+      }
+    }
+    uint8_t frame[batchFrameSize(INIT_ROWS * INIT_COLUMNS)];
+    writeAll(store->fd, frame, encodeBatchUpdate(frame, 0, 0, tiles, INIT_ROWS * INIT_COLUMNS), store->path);
+  }
+  double start = nowMs();
+  unsigned long replayed = 0;
+  size_t offset = 0;
+  store->replaying = true;
+  while (offset + COMMAND_HEADER_SIZE <= length)
+  {
+    CommandHeader header;
+    size_t frame_size = COMMAND_HEADER_SIZE + readU16(&log[offset + 2]);
+    if (offset + frame_size > length || !readCommandHeader(&log[offset], frame_size, &header))
+    {
+      break;
+    }
+    Command command = {.opcode = header.opcode, .client_id = header.client_id};
+    if (header.opcode == OP_UPDATE)
+    {
+      unpackTile(readU64(header.payload), &command.x, &command.y, &command.color_num);
+    }
+    else if (header.opcode == OP_RESIZE)
+    {
+      command.rows = readU32(&header.payload[0]);
+      command.columns = readU32(&header.payload[4]);
+    }
+    else if (header.opcode == OP_BATCH_UPDATE)
+    {
+      command.tile_count = header.payload_length / 8;
+      command.tiles = header.payload;
+    }
+    else if (!readShape(&command, &header))
+    {
+      break;
+    }
+    // the first frame sets the version the log starts at, every later one has to follow it
+    int tiles = header.opcode == OP_BATCH_UPDATE ? command.tile_count : 1;
+    if (from == 0 && offset == 0 && header.opcode == OP_BATCH_UPDATE && header.seq == 0)
+    {
+      // the tiles the board started with
+      for (int i = 0; i < command.tile_count; i++)
+      {
+        unpackTile(readU64(&command.tiles[i * 8]), &command.x, &command.y, &command.color_num);
+        if (isUpdateInBounds(board, command.x, command.y, command.color_num))
+        {
+          *getBoardTile(board, command.y, command.x) = command.color_num;
+        }
+      }
+      offset += frame_size;
+      continue;
+    }
+    if (replayed == 0 && from == 0)
+    {
+      board->version = header.seq - tiles;
+    }
+    if (header.seq - board->version != (uint32_t)tiles && replayed == 0 && from > 0)
+    {
+      fprintf(stderr, "%s goes on at seq %u after the board at seq %u, move the board file and the snapshot "
+              "away to rebuild the board from the store\n", store->path, header.seq, board->version);
+      exit(1);
+    }
+    if (header.seq - board->version != (uint32_t)tiles || !applyCommand(board, &command))
+    {
+      break;
+    }
+    offset += frame_size;
+    replayed++;
+  }
+  store->replaying = false;
+  if (offset < length)
+  {
+    fprintf(stderr, "%s: dropping %zu bytes after the last whole command\n", store->path, length - offset);
+    if (ftruncate(store->fd, base + offset) != 0)
+    {
+      fprintf(stderr, "error truncating %s: %s\n", store->path, strerror(errno));
+      exit(1);
+    }
+  }
+  free(log);
+  printf("replayed %lu commands from %s in %.3f ms, board %dx%d at seq %u\n", replayed, store->path, nowMs() - start,
+         board->rows, board->columns, board->version);
+}
+
+// SNAPSHOT WRITER
+// ---------------
+// a snapshot file is the TSNP image of protocol.h behind a small header:
+//   "TSNF" | u32 version | u64 store offset, the store after the command of the image seq
+
+#define SNAPSHOT_FILE_MAGIC "TSNF"
+#define SNAPSHOT_FILE_VERSION 1
+#define SNAPSHOT_FILE_HEADER_SIZE 16
+// chunks encoded between two writes of the snapshot thread
+#define SNAPSHOT_WRITE_CHUNKS 512
+
+// syncStoreUpTo
+// called from the snapshot thread, returns once the I/O thread wrote target up to ring position position
+// and it is synced. whatever the durability mode, a snapshot only names a store offset that is on disk
+void syncStoreUpTo(Store *target, size_t position)
+{
+  while ((ssize_t)(position - atomic_load_explicit(&target->tail, memory_order_acquire)) > 0)
+  {
+    sem_post(&target->wakeup);
+    usleep(1000);
+  }
+  if (fdatasync(target->fd) != 0)
+  {
+    fprintf(stderr, "error syncing %s: %s\n", target->path, strerror(errno));
+    exit(1);
+  }
+}
+
+// runSnapshotThread
+// encode every chunk of the snapshot, from the pool or from its saved copy, write the image next to the
+// snapshot file and move it over it once it is on disk. arg is the snapshot writer
+void *runSnapshotThread(void *arg)
+{
+  snapshot_writer = (SnapshotWriter *)arg;
+  size_t path_length = strlen(snapshot_writer->path);
+  char *tmp_path = malloc(path_length + 5);
+  size_t buffer_size = SNAPSHOT_FILE_HEADER_SIZE + SNAPSHOT_HEADER_SIZE + SNAPSHOT_WRITE_CHUNKS * SNAPSHOT_CHUNK_SIZE;
+  uint8_t *buffer = malloc(buffer_size);
+  if (tmp_path == NULL || buffer == NULL)
+  {
+    fprintf(stderr, "error malloc in runSnapshotThread\n");
+    exit(1);
+  }
+  memcpy(tmp_path, snapshot_writer->path, path_length);
+  memcpy(&tmp_path[path_length], ".tmp", 5);
+  int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+  {
+    fprintf(stderr, "error opening %s: %s\n", tmp_path, strerror(errno));
+    exit(1);
+  }
+  memcpy(buffer, SNAPSHOT_FILE_MAGIC, 4);
+  writeU32(&buffer[4], SNAPSHOT_FILE_VERSION);
+  writeU64(&buffer[8], snapshot_writer->store_offset);
+  writeSnapshotHeader(&buffer[SNAPSHOT_FILE_HEADER_SIZE], snapshot_writer->rows, snapshot_writer->columns,
+                      snapshot_writer->chunk_count, snapshot_writer->version);
+  size_t size = SNAPSHOT_FILE_HEADER_SIZE + SNAPSHOT_HEADER_SIZE;
+  for (int i = 0; i < snapshot_writer->chunk_count; i++)
+  {
+    uint8_t *cursor = &buffer[size];
+    writeU32(&cursor[0], snapshot_writer->keys[i].cx);
+    writeU32(&cursor[4], snapshot_writer->keys[i].cy);
+    _Atomic uint8_t *state = &snapshot_writer->chunk_states[i];
+    uint8_t expected = SNAPSHOT_CHUNK_LIVE;
+    if (atomic_compare_exchange_strong_explicit(state, &expected, SNAPSHOT_CHUNK_READING, memory_order_acquire,
+                                                memory_order_acquire))
+    {
+      packChunkColors(&cursor[8], &snapshot_writer->colors[(size_t)i * CHUNK_AREA]);
+      atomic_store_explicit(state, SNAPSHOT_CHUNK_WRITTEN, memory_order_release);
+    }
+    else
+    {
+      // the command loop saved it before changing it
+      packChunkColors(&cursor[8], &snapshot_writer->saved[(size_t)i * CHUNK_AREA]);
+    }
+    size += SNAPSHOT_CHUNK_SIZE;
+    if (size + SNAPSHOT_CHUNK_SIZE > buffer_size)
+    {
+      writeAll(fd, buffer, size, tmp_path);
+      size = 0;
+    }
+  }
+  writeAll(fd, buffer, size, tmp_path);
+  if (snapshot_writer->store != NULL)
+  {
+    syncStoreUpTo(snapshot_writer->store, snapshot_writer->store_position);
+  }
+  if (fdatasync(fd) != 0 || close(fd) != 0 || rename(tmp_path, snapshot_writer->path) != 0)
+  {
+    fprintf(stderr, "error writing %s: %s\n", snapshot_writer->path, strerror(errno));
+    exit(1);
+  }
+  free(tmp_path);
+  free(buffer);
+  atomic_store(&snapshot_writer->done, true);
+  return NULL;
+}
+
+// startSnapshot
+// start writing the board as it is now in the background, the store offset is where the store will be
+// once the I/O thread wrote every command applied so far
+void startSnapshot(Board *board)
+{
+  snapshot_writer->rows = board->rows;
+  snapshot_writer->columns = board->columns;
+  snapshot_writer->version = board->version;
+  snapshot_writer->store = atomic_load(&store->running) ? store : NULL;
+  snapshot_writer->store_position = atomic_load_explicit(&store->head, memory_order_relaxed);
+  snapshot_writer->store_offset =
+      snapshot_writer->store != NULL ? store->start_offset + snapshot_writer->store_position : 0;
+  size_t count = board->chunk_count;
+  snapshot_writer->keys = malloc(count * sizeof(ChunkKey) + 1);
+  snapshot_writer->chunk_states = calloc(count + 1, 1);
+  // kept from one snapshot to the next so saving a chunk does not page fault once the board stopped growing
+  if (count > snapshot_writer->saved_capacity)
+  {
+    free(snapshot_writer->saved);
+    snapshot_writer->saved = malloc(count * CHUNK_AREA);
+    snapshot_writer->saved_capacity = count;
+  }
+  if (snapshot_writer->keys == NULL || snapshot_writer->chunk_states == NULL ||
+      (count > 0 && snapshot_writer->saved == NULL))
+  {
+    fprintf(stderr, "error malloc in startSnapshot\n");
+    exit(1);
+  }
+  memcpy(snapshot_writer->keys, board->chunk_keys, count * sizeof(ChunkKey));
+  snapshot_writer->colors = board->chunk_colors;
+  snapshot_writer->chunks_saved = 0;
+  snapshot_writer->started = nowMs();
+  atomic_store(&snapshot_writer->done, false);
+  snapshot_writer->active = true;
+  // from here on the command loop saves chunks before writing to them
+  snapshot_writer->chunk_count = count;
+  if (pthread_create(&snapshot_writer->thread, NULL, runSnapshotThread, snapshot_writer) != 0)
+  {
+    fprintf(stderr, "error starting the snapshot thread\n");
+    exit(1);
+  }
+  // only run it on cores the command loop leaves idle
+  struct sched_param param = {0};
+  pthread_setschedparam(snapshot_writer->thread, SCHED_IDLE, &param);
+}
+
+// finishSnapshot
+// clean up after the snapshot thread once it is done, waiting for it if wait is set
+void finishSnapshot(bool wait)
+{
+  if (!snapshot_writer->active || (!wait && !atomic_load(&snapshot_writer->done)))
+  {
+    return;
+  }
+  pthread_join(snapshot_writer->thread, NULL);
+  printf("snapshot of seq %u to %s: %d chunks in %.3f ms, %lu copied before a write\n", snapshot_writer->version,
+         snapshot_writer->path, snapshot_writer->chunk_count, nowMs() - snapshot_writer->started,
+         snapshot_writer->chunks_saved);
+  snapshot_writer->chunk_count = 0;
+  snapshot_writer->active = false;
+  free(snapshot_writer->keys);
+  free((void *)snapshot_writer->chunk_states);
+}
+
+// loadSnapshotFile
+// replace the board with the snapshot file if there is a valid one, returns the store offset to replay
+// from or 0 to replay the whole store
+uint64_t loadSnapshotFile(Board *board)
+{
+  int fd = open(snapshot_writer->path, O_RDONLY);
+  if (fd < 0)
+  {
+    return 0;
+  }
+  off_t size = lseek(fd, 0, SEEK_END);
+  uint8_t *data = malloc(size > 0 ? size : 1);
+  if (data == NULL)
+  {
+    fprintf(stderr, "error malloc in loadSnapshotFile\n");
+    exit(1);
+  }
+  bool read_all = size > 0 && pread(fd, data, size, 0) == size;
+  close(fd);
+  SnapshotHeader header;
+  if (!read_all || size < SNAPSHOT_FILE_HEADER_SIZE || memcmp(data, SNAPSHOT_FILE_MAGIC, 4) != 0 ||
+      readU32(&data[4]) != SNAPSHOT_FILE_VERSION || readU64(&data[8]) < STORE_HEADER_SIZE ||
+      !readSnapshotHeader(&data[SNAPSHOT_FILE_HEADER_SIZE], size - SNAPSHOT_FILE_HEADER_SIZE, &header))
+  {
+    fprintf(stderr, "ignoring %s, it is not a snapshot file\n", snapshot_writer->path);
+    free(data);
+    return 0;
+  }
+  // a store that lost its tail in a crash, the snapshot is newer than anything left to replay after it
+  uint64_t store_offset = readU64(&data[8]);
+  struct stat store_stat;
+  if (stat(store->path, &store_stat) != 0 || store_offset > (uint64_t)store_stat.st_size)
+  {
+    fprintf(stderr, "ignoring %s, %s ends before it, replaying the whole store\n", snapshot_writer->path,
+            store->path);
+    free(data);
+    return 0;
+  }
+  board->chunk_count = 0;
+  board->last_chunk_idx = 0;
+  rebuildChunkDirectory(board, board->directory_capacity);
+  board->rows = header.rows;
+  board->columns = header.columns;
+  board->version = header.seq;
+  const uint8_t *cursor = &data[SNAPSHOT_FILE_HEADER_SIZE + SNAPSHOT_HEADER_SIZE];
+  for (uint32_t i = 0; i < header.chunk_count; i++, cursor += SNAPSHOT_CHUNK_SIZE)
+  {
+    int cx = readU32(&cursor[0]);
+    int cy = readU32(&cursor[4]);
+    if (cx < 0 || cy < 0 || cx > (board->columns - 1) >> CHUNK_SHIFT || cy > (board->rows - 1) >> CHUNK_SHIFT ||
+        findChunk(board, cx, cy) >= 0)
+    {
+      continue;
+    }
+    unpackChunkColors(getChunkColors(board, createChunk(board, cx, cy)), &cursor[8]);
+  }
+  free(data);
+  printf("loaded %s: board %dx%d at seq %u, %d chunks\n", snapshot_writer->path, board->rows, board->columns,
+         board->version, board->chunk_count);
+  return store_offset;
+}
+
+// CLIENT SESSIONS
+// ---------------
+// binary clients say OP_HELLO first and get a session id (see protocol.h). every client id the server
+// sees, session or not, counts what it sent in a ClientStats slot
+
+// ClientStats
+// what one client id sent since the server started
+typedef struct
+{
+  bool used;
+  uint32_t client_id;
+  // the id derived from the uuid of a session client, 0 without a session
+  uint32_t hello_id;
+  // the board a session client said hello to, only kept by the main thread to route its requests
+  char board[BOARD_NAME_MAX + 1];
+  uint64_t commands;
+  uint64_t rejected;
+  uint64_t tiles;
+  uint64_t bytes;
+  // commands when the stats were last printed, only clients that sent something since are printed
+  uint64_t commands_printed;
+} ClientStats;
+
+// ClientTable
+// open addressing hash of client id to stats, at most half full
+typedef struct
+{
+  ClientStats *slots;
+  int capacity;
+  int count;
+  // the next session id without SESSION_ID_FLAG
+  uint32_t next_session;
+  // when the stats are printed next
+  double next_print;
+} ClientTable;
+
+// the main thread keeps the sessions, every worker the stats of the clients that sent to its boards
+_Thread_local ClientTable client_table = {0};
+
+// findClientSlot
+// the slot of a client id, or the empty slot it would go in
+ClientStats *findClientSlot(uint32_t client_id)
+{
+  uint32_t slot = (uint32_t)(((uint64_t)client_id * 0x9E3779B97F4A7C15ull) >> 32) & (client_table.capacity - 1);
+  while (client_table.slots[slot].used && client_table.slots[slot].client_id != client_id)
+  {
+    slot = (slot + 1) & (client_table.capacity - 1);
+  }
+  return &client_table.slots[slot];
+}
+
+// getClientStats
+// the stats of a client id, added the first time the id is seen
+ClientStats *getClientStats(uint32_t client_id)
+{
+  if ((client_table.count + 1) * 2 > client_table.capacity)
+  {
+    ClientStats *old_slots = client_table.slots;
+    int old_capacity = client_table.capacity;
+    client_table.capacity = old_capacity == 0 ? 64 : old_capacity * 2;
+    client_table.slots = (ClientStats *)calloc(client_table.capacity, sizeof(ClientStats));
+    if (client_table.slots == NULL)
+    {
+      fprintf(stderr, "error calloc client table\n");
+      exit(1);
+    }
+    for (int i = 0; i < old_capacity; i++)
+    {
+      if (old_slots[i].used)
+      {
+        *findClientSlot(old_slots[i].client_id) = old_slots[i];
+      }
+    }
+    free(old_slots);
+  }
+  ClientStats *stats = findClientSlot(client_id);
+  if (!stats->used)
+  {
+    memset(stats, 0, sizeof(ClientStats));
+    stats->used = true;
+    stats->client_id = client_id;
+    client_table.count++;
+  }
+  return stats;
+}
+
+// findSession
+// the session a client with hello_id already started on board, or NULL. a client says hello again on
+// every reconnect, handing it a new session each time would grow the table without bound
+ClientStats *findSession(uint32_t hello_id, const char *board)
+{
+  for (int i = 0; i < client_table.capacity; i++)
+  {
+    ClientStats *stats = &client_table.slots[i];
+    if (stats->used && (stats->client_id & SESSION_ID_FLAG) && stats->hello_id == hello_id &&
+        strcmp(stats->board, board) == 0)
+    {
+      return stats;
+    }
+  }
+  return NULL;
+}
+
+// startSession
+// hand out the session id of a client that says hello again, or the next session id no client has used
+// yet. hello_id is the id the client had before and board the name of the board its requests go to
+uint32_t startSession(uint32_t hello_id, const char *board)
+{
+  ClientStats *known = findSession(hello_id, board);
+  if (known != NULL)
+  {
+    printf("client %08x resumed session %08x on %s\n", hello_id, known->client_id,
+           board[0] != '\0' ? board : "the default board");
+    return known->client_id;
+  }
+  uint32_t session_id;
+  do
+  {
+    session_id = SESSION_ID_FLAG | ++client_table.next_session;
+  } while (client_table.capacity > 0 && findClientSlot(session_id)->used);
+  ClientStats *stats = getClientStats(session_id);
+  stats->hello_id = hello_id;
+  snprintf(stats->board, sizeof(stats->board), "%s", board);
+  printf("client %08x started session %08x on %s\n", hello_id, session_id,
+         board[0] != '\0' ? board : "the default board");
+  return session_id;
+}
+
+// countClientCommand
+// add a command of size bytes painting tiles tiles to the stats of its client
+void countClientCommand(uint32_t client_id, size_t size, int tiles, bool applied)
+{
+  ClientStats *stats = getClientStats(client_id);
+  stats->commands++;
+  stats->bytes += size;
+  if (applied)
+  {
+    stats->tiles += tiles;
+  }
+  else
+  {
+    stats->rejected++;
+  }
+}
+
+// printClientStats
+// print the clients that sent commands since the last print, or every client with all
+void printClientStats(bool all)
+{
+  for (int i = 0; i < client_table.capacity; i++)
+  {
+    ClientStats *stats = &client_table.slots[i];
+    if (!stats->used || (!all && stats->commands == stats->commands_printed))
+    {
+      continue;
+    }
+    printf("client %08x: %lu commands (%lu rejected), %lu tiles, %lu bytes\n", stats->client_id,
+           (unsigned long)stats->commands, (unsigned long)stats->rejected, (unsigned long)stats->tiles,
+           (unsigned long)stats->bytes);
+    stats->commands_printed = stats->commands;
+  }
+  client_table.next_print = nowMs() + stats_s * 1000.0;
+}
+
+void freeClientTable(void)
+{
+  free(client_table.slots);
+  client_table.slots = NULL;
+  client_table.capacity = 0;
+  client_table.count = 0;
+}
+
+// PUBLISH TICKS
+// -------------
+// instead of one message per update, the updates applied during a tick are published as one
+// OP_PUBLISH_BATCH frame (see protocol.h), and an update painted over within the tick is dropped
+
+// PublishSlot
+// tile index slot, the slot is only valid for the tick it was written in
+typedef struct
+{
+  uint64_t tile;
+  int entry;
+  uint32_t tick;
+} PublishSlot;
+
+// the most region pieces, a shape in a region, a tick of shapes gathers before it is published. a line
+// across the largest board paints in about 800 regions, so a shape always fits in an empty tick
+#define SHAPE_PIECES_MAX 4096
+
+// PublishBatch
+// the OP_PUBLISH_BATCH frame being filled and an index of the tiles already in it
+typedef struct
+{
+  // the name of the board, its topics start with it (see protocol.h)
+  const char *board;
+  uint8_t *frame;
+  int count;
+  // the frame of one region while the tick is split up by region
+  uint8_t *region_frame;
+  // the OP_PUBLISH_TICK frame listing the regions of the tick
+  uint8_t *tick_frame;
+  // the shapes of the tick, a tick holds either updates or shapes so every region gets them in the order
+  // they were applied
+  Command *shapes;
+  int shape_count;
+  // the regions the shapes of the tick paint in, region << 32 | shape index
+  uint64_t *shape_pieces;
+  int shape_piece_count;
+  int shape_piece_capacity;
+  // board seq before the first and after the last update or shape in the tick
+  uint32_t since;
+  uint32_t seq;
+  // when the frame has to be published
+  double deadline;
+  // open addressing hash of packTile(x, y, 0) to entry, at most half full
+  PublishSlot *slots;
+  int slot_capacity;
+  uint32_t tick;
+  // updates queued and published and messages published, for the benchmarks
+  uint64_t updates_queued;
+  uint64_t updates_published;
+  uint64_t messages_published;
+} PublishBatch;
+
+// the publish batch of the board being worked on, set together with store
+_Thread_local PublishBatch *publish_batch;
+
+// initPublishBatch
+// call after parsing the flags, tick_ops decides the size of the frame
+void initPublishBatch(const char *board)
+{
+  publish_batch->board = board;
+  publish_batch->frame = (uint8_t *)malloc(COMMAND_HEADER_SIZE + 4 + (size_t)tick_ops * PUBLISH_ENTRY_SIZE);
+  publish_batch->region_frame = (uint8_t *)malloc(COMMAND_HEADER_SIZE + 4 + (size_t)tick_ops * PUBLISH_ENTRY_SIZE);
+  publish_batch->tick_frame = (uint8_t *)malloc(COMMAND_HEADER_SIZE + 4 + (size_t)tick_ops * 4);
+  publish_batch->shapes = (Command *)malloc((size_t)tick_ops * sizeof(Command));
+  publish_batch->shape_piece_capacity = SHAPE_PIECES_MAX * 2;
+  publish_batch->shape_pieces = (uint64_t *)malloc((size_t)publish_batch->shape_piece_capacity * sizeof(uint64_t));
+  publish_batch->slot_capacity = 16;
+  while (publish_batch->slot_capacity < tick_ops * 2)
+  {
+    publish_batch->slot_capacity *= 2;
+  }
+  publish_batch->slots = (PublishSlot *)calloc(publish_batch->slot_capacity, sizeof(PublishSlot));
+  if (publish_batch->frame == NULL || publish_batch->region_frame == NULL || publish_batch->tick_frame == NULL ||
+      publish_batch->shapes == NULL || publish_batch->shape_pieces == NULL || publish_batch->slots == NULL)
+  {
+    fprintf(stderr, "error allocating publish batch\n");
+    exit(1);
+  }
+  // slots start at tick 0, so the first tick is 1
+  publish_batch->tick = 1;
+}
+
+// freePublishBatch
+void freePublishBatch(void)
+{
+  free(publish_batch->frame);
+  free(publish_batch->region_frame);
+  free(publish_batch->tick_frame);
+  free(publish_batch->shapes);
+  free(publish_batch->shape_pieces);
+  free(publish_batch->slots);
+  publish_batch->frame = NULL;
+  publish_batch->region_frame = NULL;
+  publish_batch->tick_frame = NULL;
+  publish_batch->shapes = NULL;
+  publish_batch->shape_pieces = NULL;
+  publish_batch->slots = NULL;
+}
+
+// entryRegion
+// the region of a publish batch entry as one sortable number, region y in the high bits
+uint32_t entryRegion(const uint8_t *entry)
+{
+  int x, y, color_num;
+  unpackTile(readU64(&entry[4]), &x, &y, &color_num);
+  return (uint32_t)(y >> REGION_SHIFT) << 16 | (uint32_t)(x >> REGION_SHIFT);
+}
+
+// compareEntryRegions
+// qsort callback that orders publish batch entries by region
+int compareEntryRegions(const void *a, const void *b)
+{
+  uint32_t region_a = entryRegion((const uint8_t *)a);
+  uint32_t region_b = entryRegion((const uint8_t *)b);
+  return region_a < region_b ? -1 : region_a > region_b;
+}
+
+// compareShapePieces
+// qsort callback that orders the pieces of flushPublishShapes by region and then by shape
+int compareShapePieces(const void *a, const void *b)
+{
+  uint64_t piece_a = *(const uint64_t *)a;
+  uint64_t piece_b = *(const uint64_t *)b;
+  return piece_a < piece_b ? -1 : piece_a > piece_b;
+}
+
+// flushPublishShapes
+// publish the shapes of the tick like its updates: one message per region they paint in, with the topic of
+// the region and a frame per shape in the order they were applied, stamped with the board seq after the
+// tick. then OP_PUBLISH_TICK frames listing those regions, up to tick_ops in one. clients paint a shape
+// inside the region it came for
+void flushPublishShapes(void)
+{
+  uint64_t *pieces = publish_batch->shape_pieces;
+  int piece_count = publish_batch->shape_piece_count;
+  qsort(pieces, piece_count, sizeof(uint64_t), compareShapePieces);
+  uint8_t *tick_frame = publish_batch->tick_frame;
+  writeU32(&tick_frame[COMMAND_HEADER_SIZE], publish_batch->since);
+  uint8_t frame[COMMAND_FRAME_MAX];
+  char topic[TOPIC_MAX];
+  int region_count = 0;
+  int first = 0;
+  while (first < piece_count)
+  {
+    uint32_t region = (uint32_t)(pieces[first] >> 32);
+    writeRegionTopic(topic, publish_batch->board, region & 0xffff, region >> 16);
+    zmsg_t *message = zmsg_new();
+    zmsg_addstr(message, topic);
+    int last = first;
+    while (last < piece_count && (uint32_t)(pieces[last] >> 32) == region)
+    {
+      Command command = publish_batch->shapes[pieces[last] & 0xffffffff];
+      command.seq = publish_batch->seq;
+      zmsg_addmem(message, frame, encodeCommand(&command, frame));
+      last++;
+    }
+    zmsg_send(&message, publisher);
+    publish_batch->messages_published++;
+    writeU32(&tick_frame[COMMAND_HEADER_SIZE + 4 + region_count * 4], region);
+    region_count++;
+    first = last;
+    if (region_count == tick_ops || first == piece_count)
+    {
+      writeBoardTopic(topic, publish_batch->board, TOPIC_GLOBAL);
+      zsock_send(publisher, "sb", topic, tick_frame,
+                 writeCommandHeaderLength(tick_frame, OP_PUBLISH_TICK, 4 + region_count * 4, 0, publish_batch->seq));
+      region_count = 0;
+    }
+  }
+  publish_batch->shape_count = 0;
+  publish_batch->shape_piece_count = 0;
+}
+
+// flushPublishBatch
+// publish the updates of the tick, if there are any, as one frame per region under its topic and
+// then the OP_PUBLISH_TICK frame listing those regions under TOPIC_GLOBAL. a tick of shapes goes out
+// with flushPublishShapes
+void flushPublishBatch(void)
+{
+  if (publish_batch->shape_count > 0)
+  {
+    flushPublishShapes();
+    return;
+  }
+  if (publish_batch->count == 0)
+  {
+    return;
+  }
+  uint8_t *entries = &publish_batch->frame[COMMAND_HEADER_SIZE + 4];
+  qsort(entries, publish_batch->count, PUBLISH_ENTRY_SIZE, compareEntryRegions);
+  uint8_t *frame = publish_batch->region_frame;
+  writeU32(&frame[COMMAND_HEADER_SIZE], publish_batch->since);
+  uint8_t *tick_frame = publish_batch->tick_frame;
+  writeU32(&tick_frame[COMMAND_HEADER_SIZE], publish_batch->since);
+  char topic[TOPIC_MAX];
+  int region_count = 0;
+  int first = 0;
+  while (first < publish_batch->count)
+  {
+    uint32_t region = entryRegion(&entries[first * PUBLISH_ENTRY_SIZE]);
+    int last = first + 1;
+    while (last < publish_batch->count && entryRegion(&entries[last * PUBLISH_ENTRY_SIZE]) == region)
+    {
+      last++;
+    }
+    int payload_length = 4 + (last - first) * PUBLISH_ENTRY_SIZE;
+    memcpy(&frame[COMMAND_HEADER_SIZE + 4], &entries[first * PUBLISH_ENTRY_SIZE],
+           (size_t)(last - first) * PUBLISH_ENTRY_SIZE);
+    writeCommandHeaderLength(frame, OP_PUBLISH_BATCH, payload_length, 0, publish_batch->seq);
+    writeRegionTopic(topic, publish_batch->board, region & 0xffff, region >> 16);
+    zsock_send(publisher, "sb", topic, frame, COMMAND_HEADER_SIZE + (size_t)payload_length);
+    publish_batch->messages_published++;
+    writeU32(&tick_frame[COMMAND_HEADER_SIZE + 4 + region_count * 4], region);
+    region_count++;
+    first = last;
+  }
+  writeBoardTopic(topic, publish_batch->board, TOPIC_GLOBAL);
+  zsock_send(publisher, "sb", topic, tick_frame,
+             writeCommandHeaderLength(tick_frame, OP_PUBLISH_TICK, 4 + region_count * 4, 0, publish_batch->seq));
+  publish_batch->updates_published += publish_batch->count;
+  publish_batch->count = 0;
+  publish_batch->tick++;
+}
+
+// queuePublishUpdate
+// add an applied update with board seq seq to the tick, painting over the entry of the same tile if
+// it is already in there
+void queuePublishUpdate(uint32_t client_id, int x, int y, int color_num, uint32_t seq)
+{
+  if (publish_batch->shape_count > 0)
+  {
+    flushPublishShapes();
+  }
+  if (publish_batch->count == 0)
+  {
+    publish_batch->since = seq - 1;
+    publish_batch->deadline = nowMs() + tick_ms;
+  }
+  publish_batch->seq = seq;
+  publish_batch->updates_queued++;
+  uint64_t tile = packTile(x, y, 0);
+  uint32_t slot_idx = (uint32_t)((tile * 0x9E3779B97F4A7C15ull) >> 32) & (publish_batch->slot_capacity - 1);
+  while (publish_batch->slots[slot_idx].tick == publish_batch->tick && publish_batch->slots[slot_idx].tile != tile)
+  {
+    slot_idx = (slot_idx + 1) & (publish_batch->slot_capacity - 1);
+  }
+  PublishSlot *slot = &publish_batch->slots[slot_idx];
+  if (slot->tick != publish_batch->tick)
+  {
+    slot->tile = tile;
+    slot->tick = publish_batch->tick;
+    slot->entry = publish_batch->count++;
+  }
+  uint8_t *entry = &publish_batch->frame[COMMAND_HEADER_SIZE + 4 + (size_t)slot->entry * PUBLISH_ENTRY_SIZE];
+  writeU32(&entry[0], client_id);
+  writeU64(&entry[4], packTile(x, y, color_num));
+  if (publish_batch->count == tick_ops)
+  {
+    flushPublishBatch();
+  }
+}
+
+// ShapeRegions
+// the regions of the shape gathered by addShapeRegions. runs come row by row, and in the rows of one region
+// row a rectangle, line or circle paints in every region between its leftmost and rightmost run
+typedef struct
+{
+  uint32_t shape;
+  int ry;
+  int rx0;
+  int rx1;
+} ShapeRegions;
+
+// addShapePieces
+// add the regions of the region row gathered so far to the pieces of the tick
+void addShapePieces(ShapeRegions *regions)
+{
+  for (int rx = regions->rx0; rx <= regions->rx1; rx++)
+  {
+    if (publish_batch->shape_piece_count == publish_batch->shape_piece_capacity)
+    {
+      publish_batch->shape_pieces = (uint64_t *)growFillBuffer(
+          publish_batch->shape_pieces, &publish_batch->shape_piece_capacity, sizeof(uint64_t));
+    }
+    uint32_t region = (uint32_t)regions->ry << 16 | (uint32_t)rx;
+    publish_batch->shape_pieces[publish_batch->shape_piece_count++] = (uint64_t)region << 32 | regions->shape;
+  }
+}
+
+// addShapeRegions
+// ShapeRowFn gathering the regions a run paints in
+void addShapeRegions(void *context, int y, int x0, int x1)
+{
+  ShapeRegions *regions = (ShapeRegions *)context;
+  if (regions->ry != y >> REGION_SHIFT)
+  {
+    if (regions->ry >= 0)
+    {
+      addShapePieces(regions);
+    }
+    regions->ry = y >> REGION_SHIFT;
+    regions->rx0 = x0 >> REGION_SHIFT;
+    regions->rx1 = x1 >> REGION_SHIFT;
+    return;
+  }
+  regions->rx0 = x0 >> REGION_SHIFT < regions->rx0 ? x0 >> REGION_SHIFT : regions->rx0;
+  regions->rx1 = x1 >> REGION_SHIFT > regions->rx1 ? x1 >> REGION_SHIFT : regions->rx1;
+}
+
+// queuePublishShape
+// add an applied rectangle, line or circle to the tick, after publishing the updates applied before it.
+// the tick is published early once it has tick_ops shapes or SHAPE_PIECES_MAX pieces
+void queuePublishShape(Board *board, Command *command)
+{
+  if (publish_batch->count > 0)
+  {
+    flushPublishBatch();
+  }
+  if (publish_batch->shape_count == 0)
+  {
+    publish_batch->since = command->seq - 1;
+    publish_batch->deadline = nowMs() + tick_ms;
+  }
+  publish_batch->seq = command->seq;
+  ShapeRegions regions = {(uint32_t)publish_batch->shape_count, -1, 0, 0};
+  publish_batch->shapes[publish_batch->shape_count++] = *command;
+  if (command->opcode == OP_FILL_RECT)
+  {
+    rasterizeRect(command->x, command->y, command->x1, command->y1, addShapeRegions, &regions);
+  }
+  if (command->opcode == OP_LINE)
+  {
+    rasterizeLine(command->x, command->y, command->x1, command->y1, addShapeRegions, &regions);
+  }
+  if (command->opcode == OP_FILL_CIRCLE)
+  {
+    rasterizeCircle(command->x, command->y, command->radius, board->rows, board->columns, addShapeRegions,
+                    &regions);
+  }
+  if (regions.ry >= 0)
+  {
+    addShapePieces(&regions);
+  }
+  if (publish_batch->shape_count == tick_ops || publish_batch->shape_piece_count >= SHAPE_PIECES_MAX)
+  {
+    flushPublishShapes();
+  }
+}
+
+// RegionSpan
+// a flood fill run cut at region borders, with the region it is in (see entryRegion)
+typedef struct
+{
+  uint32_t region;
+  uint64_t span;
+} RegionSpan;
+
+// compareRegionSpans
+// qsort callback that orders runs by region
+int compareRegionSpans(const void *a, const void *b)
+{
+  uint32_t region_a = ((const RegionSpan *)a)->region;
+  uint32_t region_b = ((const RegionSpan *)b)->region;
+  return region_a < region_b ? -1 : region_a > region_b;
+}
+
+// publishFillSpans
+// publish the runs of an applied flood fill like the updates of a tick: OP_FILL_SPANS frames under the
+// topics of the regions it painted, then OP_PUBLISH_TICK frames listing those regions, up to
+// PUBLISH_BATCH_MAX in one
+void publishFillSpans(Command *command)
+{
+  int piece_count = 0;
+  for (int i = 0; i < fill_span_count; i++)
+  {
+    piece_count += (fill_spans[i].x1 >> REGION_SHIFT) - (fill_spans[i].x0 >> REGION_SHIFT) + 1;
+  }
+  RegionSpan *pieces = (RegionSpan *)malloc((size_t)piece_count * sizeof(RegionSpan));
+  uint8_t *frame = (uint8_t *)malloc(COMMAND_HEADER_SIZE + 1 + FILL_SPANS_MAX * 8);
+  uint8_t *tick_frame = (uint8_t *)malloc(COMMAND_HEADER_SIZE + 4 + PUBLISH_BATCH_MAX * 4);
+  if (pieces == NULL || frame == NULL || tick_frame == NULL)
+  {
+    fprintf(stderr, "error malloc publishFillSpans\n");
+    exit(1);
+  }
+  int piece = 0;
+  for (int i = 0; i < fill_span_count; i++)
+  {
+    FillSpan *span = &fill_spans[i];
+    for (int x0 = span->x0; x0 <= span->x1; x0 = (x0 | (REGION_SIZE - 1)) + 1)
+    {
+      int x1 = (x0 | (REGION_SIZE - 1)) < span->x1 ? x0 | (REGION_SIZE - 1) : span->x1;
+      pieces[piece].region = (uint32_t)(span->y >> REGION_SHIFT) << 16 | (uint32_t)(x0 >> REGION_SHIFT);
+      pieces[piece].span = packSpan(x0, span->y, x1 - x0 + 1);
+      piece++;
+    }
+  }
+  qsort(pieces, piece_count, sizeof(RegionSpan), compareRegionSpans);
+  frame[COMMAND_HEADER_SIZE] = command->color_num;
+  writeU32(&tick_frame[COMMAND_HEADER_SIZE], command->seq - 1);
+  char topic[TOPIC_MAX];
+  int region_count = 0;
+  int first = 0;
+  while (first < piece_count)
+  {
+    uint32_t region = pieces[first].region;
+    int last = first + 1;
+    while (last < piece_count && pieces[last].region == region && last - first < FILL_SPANS_MAX)
+    {
+      last++;
+    }
+    for (int i = first; i < last; i++)
+    {
+      writeU64(&frame[COMMAND_HEADER_SIZE + 1 + (i - first) * 8], pieces[i].span);
+    }
+    int payload_length = 1 + (last - first) * 8;
+    writeCommandHeaderLength(frame, OP_FILL_SPANS, payload_length, command->client_id, command->seq);
+    writeRegionTopic(topic, publish_batch->board, region & 0xffff, region >> 16);
+    zsock_send(publisher, "sb", topic, frame, COMMAND_HEADER_SIZE + (size_t)payload_length);
+    publish_batch->messages_published++;
+    // a region with more runs than fit in one frame is listed once
+    bool listed = region_count > 0 && readU32(&tick_frame[COMMAND_HEADER_SIZE + region_count * 4]) == region;
+    if (!listed)
+    {
+      writeU32(&tick_frame[COMMAND_HEADER_SIZE + 4 + region_count * 4], region);
+      region_count++;
+    }
+    first = last;
+    if (region_count == PUBLISH_BATCH_MAX || first == piece_count)
+    {
+      writeBoardTopic(topic, publish_batch->board, TOPIC_GLOBAL);
+      zsock_send(publisher, "sb", topic, tick_frame,
+                 writeCommandHeaderLength(tick_frame, OP_PUBLISH_TICK, 4 + region_count * 4, 0, command->seq));
+      region_count = 0;
+    }
+  }
+  free(pieces);
+  free(frame);
+  free(tick_frame);
+}
+
+// publishTextRow
+// ShapeRowFn publishing every tile of a run as a text update, for --text-pub
+void publishTextRow(void *context, int y, int x0, int x1)
+{
+  Command *command = (Command *)context;
+  char publish_str[64];
+  for (int x = x0; x <= x1; x++)
+  {
+    snprintf(publish_str, sizeof(publish_str), "%08x\nupdate\n%d,%d,%d", command->client_id, x, y,
+             command->color_num);
+    zsock_send(publisher, "s", publish_str);
+  }
+}
+
+// publishCommand
+// send an applied command to every subscriber. binary frames stamped with the board version by default,
+// with updates held back for the next publish tick. with --text-pub the default board publishes the
+// "client_id\ncommand\nargs" strings that clients from before the binary protocol understand.
+// original_str is the command as a text client sent it, NULL for binary commands
+void publishCommand(Board *board, Command *command, char *original_str)
+{
+  if (text_pub && publish_batch->board[0] == '\0')
+  {
+    // text clients from before shapes only know updates and resizes
+    if (original_str != NULL && !isShapeOpcode(command->opcode))
+    {
+      zsock_send(publisher, "s", original_str);
+      return;
+    }
+    // binary clients only have a compact id, text clients compare it against their uuid and never match
+    char publish_str[64];
+    if (command->opcode == OP_BATCH_UPDATE)
+    {
+      // text clients have no batches, they get every tile as an update
+      for (int i = 0; i < command->tile_count; i++)
+      {
+        int x, y, color_num;
+        unpackTile(readU64(&command->tiles[i * 8]), &x, &y, &color_num);
+        snprintf(publish_str, sizeof(publish_str), "%08x\nupdate\n%d,%d,%d", command->client_id, x, y, color_num);
+        zsock_send(publisher, "s", publish_str);
+      }
+      return;
+    }
+    if (command->opcode == OP_FLOOD_FILL)
+    {
+      for (int i = 0; i < fill_span_count; i++)
+      {
+        publishTextRow(command, fill_spans[i].y, fill_spans[i].x0, fill_spans[i].x1);
+      }
+      return;
+    }
+    // nor shapes, they get every tile of the shape as well
+    if (command->opcode == OP_FILL_RECT)
+    {
+      rasterizeRect(command->x, command->y, command->x1, command->y1, publishTextRow, command);
+      return;
+    }
+    if (command->opcode == OP_LINE)
+    {
+      rasterizeLine(command->x, command->y, command->x1, command->y1, publishTextRow, command);
+      return;
+    }
+    if (command->opcode == OP_FILL_CIRCLE)
+    {
+      rasterizeCircle(command->x, command->y, command->radius, board->rows, board->columns, publishTextRow, command);
+      return;
+    }
+    if (command->opcode == OP_UPDATE)
+    {
+      snprintf(publish_str, sizeof(publish_str), "%08x\nupdate\n%d,%d,%d", command->client_id, command->x,
+               command->y, command->color_num);
+    }
+    else
+    {
+      snprintf(publish_str, sizeof(publish_str), "%08x\nresize\n%d,%d", command->client_id, command->rows,
+               command->columns);
+    }
+    zsock_send(publisher, "s", publish_str);
+    return;
+  }
+  if (command->opcode == OP_UPDATE)
+  {
+    queuePublishUpdate(command->client_id, command->x, command->y, command->color_num, command->seq);
+    return;
+  }
+  if (command->opcode == OP_BATCH_UPDATE)
+  {
+    uint32_t first_seq = command->seq - command->tile_count + 1;
+    for (int i = 0; i < command->tile_count; i++)
+    {
+      int x, y, color_num;
+      unpackTile(readU64(&command->tiles[i * 8]), &x, &y, &color_num);
+      queuePublishUpdate(command->client_id, x, y, color_num, first_seq + i);
+    }
+    return;
+  }
+  if (command->opcode == OP_FILL_RECT || command->opcode == OP_LINE || command->opcode == OP_FILL_CIRCLE)
+  {
+    queuePublishShape(board, command);
+    return;
+  }
+  // a resize or flood fill must reach subscribers after the updates and shapes applied before it
+  flushPublishBatch();
+  if (command->opcode == OP_FLOOD_FILL)
+  {
+    publishFillSpans(command);
+    return;
+  }
+  uint8_t frame[COMMAND_FRAME_MAX];
+  char topic[TOPIC_MAX];
+  writeBoardTopic(topic, publish_batch->board, TOPIC_GLOBAL);
+  zsock_send(publisher, "sb", topic, frame, encodeCommand(command, frame));
+}
+
+// parseCommand
+void parseCommand(Board *board, char *command_str)
+{
+  /*
+    client_id\n
+    command\n
+    c,s,v
+  */
+  // keep the original string to publish for --text-pub, strtok cuts it up
+  char *original_str = strdup(command_str);
+  char *token;
+  char *client_id_str = NULL;
+  char *command_name = NULL;
+  char *command_args = NULL;
+  int i = 0;
+  token = strtok(command_str, "\n");
+  while (token != NULL)
+  {
+    if (i == 0)
+    {
+      client_id_str = token;
+    }
+    if (i == 1)
+    {
+      command_name = token;
+    }
+    if (i == 2)
+    {
+      command_args = token;
+    }
+    token = strtok(NULL, "\n");
+    i++;
+  }
+  if (client_id_str == NULL || command_name == NULL || command_args == NULL)
+  {
+    fprintf(stderr, "ignoring malformed command\n");
+    free(original_str);
+    return;
+  }
+  printf("%s: %s: %s\n", client_id_str, command_name, command_args);
+
+  Command command = {0};
+  command.client_id = compactClientId(client_id_str);
+  if (strcmp(command_name, "update") == 0)
+  {
+    parseBoardUpdate(&command, command_args);
+  }
+  if (strcmp(command_name, "resize") == 0)
+  {
+    parseBoardResize(&command, command_args);
+  }
+  if (strcmp(command_name, "rect") == 0)
+  {
+    parseBoardShape(&command, OP_FILL_RECT, command_args);
+  }
+  if (strcmp(command_name, "line") == 0)
+  {
+    parseBoardShape(&command, OP_LINE, command_args);
+  }
+  if (strcmp(command_name, "circle") == 0)
+  {
+    parseBoardShape(&command, OP_FILL_CIRCLE, command_args);
+  }
+  if (strcmp(command_name, "flood") == 0)
+  {
+    parseBoardShape(&command, OP_FLOOD_FILL, command_args);
+  }
+  bool applied = applyCommand(board, &command);
+  if (applied)
+  {
+    publishCommand(board, &command, original_str);
+  }
+  countClientCommand(command.client_id, strlen(original_str), command.opcode == OP_UPDATE, applied);
+  free(original_str);
+}
+
+// handleCommandFrame
+// decode a binary command frame (see protocol.h), apply and publish it and send the reply
+void handleCommandFrame(Board *board, uint8_t *frame, size_t frame_size)
+{
+  CommandHeader header;
+  uint8_t reply[COMMAND_FRAME_MAX];
+  if (!readCommandHeader(frame, frame_size, &header))
+  {
+    fprintf(stderr, "ignoring malformed command frame of %zu bytes\n", frame_size);
+    sendReplyEnvelope();
+    zsock_send(responder, "b", reply, encodeAck(reply, 0, 0, ACK_REJECTED));
+    return;
+  }
+  if (header.opcode == OP_FETCH)
+  {
+    sendReplyEnvelope();
+    sendSharedBuffer(responder, getFetchReply(board, header.payload[0] == FETCH_SNAPSHOT ? FETCH_SNAPSHOT : FETCH_CSV));
+    return;
+  }
+  if (header.opcode == OP_FETCH_SINCE)
+  {
+    sendFetchSince(board, readU32(header.payload));
+    return;
+  }
+  if (header.opcode == OP_FETCH_REGION)
+  {
+    size_t size;
+    uint8_t *data = boardToRegionSnapshot(board, readU16(&header.payload[0]), readU16(&header.payload[2]),
+                                          readU16(&header.payload[4]), readU16(&header.payload[6]), &size);
+    SharedBuffer *region = newSharedBuffer(data, size);
+    sendReplyEnvelope();
+    sendSharedBuffer(responder, region);
+    releaseSharedBuffer(region);
+    return;
+  }
+
+  Command command = {0};
+  command.opcode = header.opcode;
+  command.client_id = header.client_id;
+  command.seq = header.seq;
+  if (header.opcode == OP_UPDATE)
+  {
+    unpackTile(readU64(header.payload), &command.x, &command.y, &command.color_num);
+  }
+  else if (header.opcode == OP_RESIZE)
+  {
+    command.rows = readU32(&header.payload[0]);
+    command.columns = readU32(&header.payload[4]);
+  }
+  else if (header.opcode == OP_BATCH_UPDATE)
+  {
+    command.tile_count = header.payload_length / 8;
+    command.tiles = header.payload;
+  }
+  else
+  {
+    readShape(&command, &header);
+  }
+  bool applied = applyCommand(board, &command);
+  if (applied)
+  {
+    publishCommand(board, &command, NULL);
+  }
+  int tiles = header.opcode == OP_BATCH_UPDATE ? command.tile_count : header.opcode == OP_UPDATE;
+  countClientCommand(header.client_id, frame_size, tiles, applied);
+  sendCommandReply(board, reply, encodeAck(reply, header.client_id, header.seq, applied ? ACK_OK : ACK_REJECTED));
+}
+
+// handleRequest
+// split off the envelope of a request the main thread routed to the board and answer it, takes the request
+void handleRequest(Board *board, zmsg_t *request)
+{
+  reply_envelope.identity = zmsg_pop(request);
+  zframe_t *received_frame = zmsg_pop(request);
+  if (received_frame != NULL && zframe_size(received_frame) == 0 && zmsg_size(request) > 0)
+  {
+    reply_envelope.delimiter = received_frame;
+    received_frame = zmsg_pop(request);
+  }
+  zmsg_destroy(&request);
+  if (received_frame == NULL)
+  {
+    fprintf(stderr, "ignoring request without a body\n");
+    zframe_destroy(&reply_envelope.identity);
+    zframe_destroy(&reply_envelope.delimiter);
+    return;
+  }
+
+  uint8_t *frame_data = zframe_data(received_frame);
+  size_t frame_size = zframe_size(received_frame);
+  if (isCommandFrame(frame_data, frame_size))
+  {
+    handleCommandFrame(board, frame_data, frame_size);
+  }
+  else
+  {
+    // text protocol
+    uint32_t since;
+    char *received_str = strndup((char *)frame_data, frame_size);
+    printf("received %s \n", received_str);
+    if (strcmp(received_str, "fetch") == 0)
+    {
+      sendReplyEnvelope();
+      sendSharedBuffer(responder, getFetchReply(board, FETCH_CSV));
+    }
+    else if (requestsBinarySnapshot(received_str))
+    {
+      sendReplyEnvelope();
+      sendSharedBuffer(responder, getFetchReply(board, FETCH_SNAPSHOT));
+    }
+    else if (parseFetchSince(received_str, &since))
+    {
+      sendFetchSince(board, since);
+    }
+    else
+    {
+      parseCommand(board, received_str);
+      /*
+      command\n
+      client_id\n
+      c,s,v
+      */
+      sendCommandReply(board, "received command", strlen("received command"));
+    }
+    free(received_str);
+  }
+  zframe_destroy(&received_frame);
+  zframe_destroy(&reply_envelope.identity);
+  zframe_destroy(&reply_envelope.delimiter);
+}
+
+// DOCUMENTS
+// ---------
+// one server serves many boards by name (see BOARD NAMES in protocol.h). a document is a board with
+// everything that goes with it: its store, board file, snapshot writer and publish batch. the default
+// board keeps the files of --store, --board-file and --snapshot, a named board <name>.db, <name>.map
+// and <name>.tsnf in --boards-dir. documents are loaded by the first request for their board and
+// closed again, board file marked clean, once they got no request for --evict-s
+
+typedef struct
+{
+  // "" for the default board
+  char name[BOARD_NAME_MAX + 1];
+  char *store_path;
+  char *board_file_path;
+  char *snapshot_path;
+  Board board;
+  Store store;
+  SnapshotWriter snapshot_writer;
+  PublishBatch publish_batch;
+  // when the last request for the board was handled
+  double last_used;
+  double next_snapshot;
+  double next_msync;
+  // the board version of the last snapshot started
+  uint32_t snapshot_version;
+} Document;
+
+// tells the inproc endpoints of the durable signals of the stores apart
+atomic_uint document_serial = 0;
+
+// useDocument
+// point the thread at the store, snapshot writer and publish batch of a document, call before touching
+// its board
+void useDocument(Document *document)
+{
+  store = &document->store;
+  snapshot_writer = &document->snapshot_writer;
+  publish_batch = &document->publish_batch;
+  // --text-pub servers publish a shape on the default board as an update per tile, so they keep those
+  // to a batch worth of tiles
+  shape_tile_limit = text_pub && document->name[0] == '\0' ? BATCH_MAX_TILES : SHAPE_MAX_TILES;
+}
+
+// documentPath
+// default_path for the default board, <boards_dir>/<name><extension> for a named one
+char *documentPath(const char *name, const char *default_path, const char *extension)
+{
+  size_t size = name[0] == '\0' ? strlen(default_path) + 1 : strlen(boards_dir) + strlen(name) + strlen(extension) + 2;
+  char *path = malloc(size);
+  if (path == NULL)
+  {
+    fprintf(stderr, "error malloc in documentPath\n");
+    exit(1);
+  }
+  if (name[0] == '\0')
+  {
+    memcpy(path, default_path, size);
+  }
+  else
+  {
+    snprintf(path, size, "%s/%s%s", boards_dir, name, extension);
+  }
+  return path;
+}
+
+// openDocument
+// load a board from its files, a new board if it has none yet, and start its store
+Document *openDocument(const char *name)
+{
+  Document *document = (Document *)calloc(1, sizeof(Document));
+  if (document == NULL)
+  {
+    fprintf(stderr, "error calloc in openDocument\n");
+    exit(1);
+  }
+  snprintf(document->name, sizeof(document->name), "%s", name);
+  document->store_path = documentPath(name, store_path, ".db");
+  document->board_file_path = documentPath(name, board_file_path, ".map");
+  document->snapshot_path = documentPath(name, snapshot_path, ".tsnf");
+  document->store.path = document->store_path;
+  document->store.fd = -1;
+  document->store.durability = durability;
+  document->store.durability_ms = durability_ms;
+  document->snapshot_writer.path = document->snapshot_path;
+  useDocument(document);
+  initPublishBatch(document->name);
+
+  Board *board = &document->board;
+  initBoard(board);
+  // a board file closed cleanly is the board, after a crash the last snapshot is
+  uint64_t replay_from = openBoardFile(board, document->board_file_path);
+  if (replay_from == 0)
+  {
+    replay_from = loadSnapshotFile(board);
+  }
+  replayStore(board, replay_from);
+  // the store thread signals after every sync, replies held back for it go out then
+  if (store->durability == DURABILITY_ALWAYS)
+  {
+    char endpoint[64];
+    snprintf(endpoint, sizeof(endpoint), "@inproc://store-durable-%u", atomic_fetch_add(&document_serial, 1));
+    store->durable_reader = zsock_new_pair(endpoint);
+    endpoint[0] = '>';
+    store->durable_writer = zsock_new_pair(endpoint);
+  }
+  startStore(board->version);
+
+  document->last_used = nowMs();
+  document->next_snapshot = nowMs() + snapshot_s * 1000.0;
+  document->next_msync = nowMs() + msync_ms;
+  document->snapshot_version = board->version;
+  return document;
+}
+
+// tendDocument
+// the timers of a document: the end of its publish tick, its snapshots, the writeback of its board file
+// and the replies its store made durable. returns when it needs tending next, -1 for never
+double tendDocument(Document *document)
+{
+  useDocument(document);
+  Board *board = &document->board;
+  handleStoreSyncs();
+  if ((publish_batch->count > 0 || publish_batch->shape_count > 0) && nowMs() >= publish_batch->deadline)
+  {
+    flushPublishBatch();
+  }
+  finishSnapshot(false);
+  if (snapshot_s > 0 && nowMs() >= document->next_snapshot)
+  {
+    if (!snapshot_writer->active && board->version != document->snapshot_version)
+    {
+      startSnapshot(board);
+      document->snapshot_version = board->version;
+    }
+    document->next_snapshot = nowMs() + snapshot_s * 1000.0;
+  }
+  if (msync_ms > 0 && nowMs() >= document->next_msync)
+  {
+    startBoardFileWriteback(board);
+    document->next_msync = nowMs() + msync_ms;
+  }
+  double deadline = msync_ms > 0 ? document->next_msync : -1;
+  // look for the end of a snapshot every 100 ms
+  double snapshot_deadline = snapshot_writer->active ? nowMs() + 100 : document->next_snapshot;
+  if (snapshot_s > 0 && (deadline < 0 || snapshot_deadline < deadline))
+  {
+    deadline = snapshot_deadline;
+  }
+  bool publish_pending = publish_batch->count > 0 || publish_batch->shape_count > 0;
+  if (publish_pending && (deadline < 0 || publish_batch->deadline < deadline))
+  {
+    deadline = publish_batch->deadline;
+  }
+  double evict_deadline = document->last_used + evict_s * 1000.0;
+  if (evict_s > 0 && (deadline < 0 || evict_deadline < deadline))
+  {
+    deadline = evict_deadline;
+  }
+  return deadline;
+}
+
+// closeDocument
+// publish and write out everything of a document, mark its board file clean and free it
+void closeDocument(Document *document)
+{
+  useDocument(document);
+  flushPublishBatch();
+  finishSnapshot(true);
+  stopStore();
+  sendDurableReplies();
+  closeBoardFile(&document->board, store->end_offset);
+  printf("closed %s: %lu commands, %lu bytes in %lu writes and %lu syncs, waited for the disk %lu times\n",
+         store->path, store->records_written, store->bytes_written, store->writes, store->syncs, store->stalls);
+  free(store->pending);
+  zsock_destroy(&store->durable_reader);
+  zsock_destroy(&store->durable_writer);
+  free(snapshot_writer->saved);
+  freeBoard(&document->board);
+  freePublishBatch();
+  free(document->store_path);
+  free(document->board_file_path);
+  free(document->snapshot_path);
+  free(document);
+  store = NULL;
+  snapshot_writer = NULL;
+  publish_batch = NULL;
+}
+
+// WORKERS
+// -------
+// boards are spread over --workers threads by the hash of their name. a worker owns the documents of its
+// boards and is the only thread that touches them, so no board needs a lock. the main thread owns the
+// ROUTER and PUB sockets: it answers OP_HELLO itself, routes every other request to the worker of the
+// board of its client with the board name as first frame, and forwards what the workers send on their
+// PUSH sockets to the clients and subscribers. text clients and clients without a session are on the
+// default board
+
+// requests a worker handles before it looks at the timers of its documents again
+#define WORKER_DRAIN_MAX 256
+
+typedef struct
+{
+  pthread_t thread;
+  // main thread -> worker, the main thread pushes on route and the worker pulls from requests. a
+  // request is the board name, the envelope and the request itself, a message of one frame stops it
+  zsock_t *route;
+  zsock_t *requests;
+  zpoller_t *poller;
+  Document **documents;
+  int document_count;
+  int document_capacity;
+  // requests usually come in runs for one board, like tiles in one chunk
+  int last_document;
+} Worker;
+
+Worker *workers;
+
+// newInprocSocket
+// a socket between the main thread and a worker without a high water mark, so the main thread routing to
+// a busy worker and that worker pushing its replies back never wait on each other
+zsock_t *newInprocSocket(int type, const char *endpoint)
+{
+  zsock_t *socket = zsock_new(type);
+  if (socket == NULL)
+  {
+    fprintf(stderr, "error creating a socket for %s\n", endpoint);
+    exit(1);
+  }
+  zsock_set_sndhwm(socket, 0);
+  zsock_set_rcvhwm(socket, 0);
+  if (zsock_attach(socket, endpoint, true) != 0)
+  {
+    fprintf(stderr, "error attaching a socket to %s\n", endpoint);
+    exit(1);
+  }
+  return socket;
+}
+
+// boardWorker
+// the index of the worker that owns a board, FNV-1a of its name
+int boardWorker(const char *name)
+{
+  uint32_t hash = 2166136261u;
+  for (const char *c = name; *c != '\0'; c++)
+  {
+    hash = (hash ^ (uint8_t)*c) * 16777619u;
+  }
+  return hash % worker_count;
+}
+
+// findDocument
+// the document of a board, opened if the worker does not have it loaded
+Document *findDocument(Worker *worker, const char *name)
+{
+  if (worker->last_document < worker->document_count &&
+      strcmp(worker->documents[worker->last_document]->name, name) == 0)
+  {
+    return worker->documents[worker->last_document];
+  }
+  for (int i = 0; i < worker->document_count; i++)
+  {
+    if (strcmp(worker->documents[i]->name, name) == 0)
+    {
+      worker->last_document = i;
+      return worker->documents[i];
+    }
+  }
+  if (worker->document_count == worker->document_capacity)
+  {
+    worker->document_capacity = worker->document_capacity > 0 ? worker->document_capacity * 2 : 16;
+    worker->documents = (Document **)realloc(worker->documents, worker->document_capacity * sizeof(Document *));
+    if (worker->documents == NULL)
+    {
+      fprintf(stderr, "error realloc in findDocument\n");
+      exit(1);
+    }
+  }
+  Document *document = openDocument(name);
+  if (document->store.durable_reader != NULL)
+  {
+    zpoller_add(worker->poller, document->store.durable_reader);
+  }
+  worker->last_document = worker->document_count;
+  worker->documents[worker->document_count++] = document;
+  return document;
+}
+
+// evictDocument
+// close the i-th document of the worker, the last one takes its place
+void evictDocument(Worker *worker, int i)
+{
+  Document *document = worker->documents[i];
+  if (document->store.durable_reader != NULL)
+  {
+    zpoller_remove(worker->poller, document->store.durable_reader);
+  }
+  closeDocument(document);
+  worker->documents[i] = worker->documents[--worker->document_count];
+}
+
+// runWorker
+// the command loop of one worker, arg is the worker. runs until the main thread stops it, then closes
+// every document and tells the main thread with an empty frame on both sockets that it sent everything
+void *runWorker(void *arg)
+{
+  Worker *worker = (Worker *)arg;
+  responder = newInprocSocket(ZMQ_PUSH, ">inproc://worker-replies");
+  publisher = newInprocSocket(ZMQ_PUSH, ">inproc://worker-publish");
+  worker->poller = zpoller_new(worker->requests, NULL);
+  client_table.next_print = nowMs() + stats_s * 1000.0;
+  bool running = true;
+  while (running)
+  {
+    // wake up for requests, syncs of a store and the timers of the documents, and to print the client stats
+    double deadline = stats_s > 0 ? client_table.next_print : -1;
+    for (int i = 0; i < worker->document_count; i++)
+    {
+      Document *document = worker->documents[i];
+      if (evict_s > 0 && nowMs() - document->last_used >= evict_s * 1000.0)
+      {
+        evictDocument(worker, i--);
+        continue;
+      }
+      double document_deadline = tendDocument(document);
+      if (document_deadline >= 0 && (deadline < 0 || document_deadline < deadline))
+      {
+        deadline = document_deadline;
+      }
+    }
+    if (stats_s > 0 && nowMs() >= client_table.next_print)
+    {
+      printClientStats(false);
+      deadline = client_table.next_print;
+    }
+    int timeout = -1;
+    if (deadline >= 0)
+    {
+      double remaining = deadline - nowMs();
+      timeout = remaining > 0 ? (int)remaining + 1 : 0;
+    }
+    if (zpoller_wait(worker->poller, timeout) != worker->requests)
+    {
+      continue;
+    }
+    for (int handled = 0; handled < WORKER_DRAIN_MAX && (zsock_events(worker->requests) & ZMQ_POLLIN); handled++)
+    {
+      zmsg_t *request = zmsg_recv(worker->requests);
+      if (request == NULL)
+      {
+        break;
+      }
+      if (zmsg_size(request) == 1)
+      {
+        zmsg_destroy(&request);
+        running = false;
+        break;
+      }
+      char *name = zmsg_popstr(request);
+      Document *document = findDocument(worker, name);
+      free(name);
+      useDocument(document);
+      handleRequest(&document->board, request);
+      document->last_used = nowMs();
+      if ((publish_batch->count > 0 || publish_batch->shape_count > 0) && nowMs() >= publish_batch->deadline)
+      {
+        flushPublishBatch();
+      }
+      handleStoreSyncs();
+    }
+  }
+  while (worker->document_count > 0)
+  {
+    evictDocument(worker, worker->document_count - 1);
+  }
+  printClientStats(true);
+  freeClientTable();
+  freeFillBuffers();
+  zpoller_destroy(&worker->poller);
+  zstr_send(responder, "");
+  zstr_send(publisher, "");
+  zsock_destroy(&responder);
+  zsock_destroy(&publisher);
+  free(worker->documents);
+  return NULL;
+}
+
+// routeRequest
+// receive a request on the ROUTER socket and answer it if it is an OP_HELLO, otherwise send it on to the
+// worker of the board of its client
+void routeRequest(void)
+{
+  zmsg_t *request = zmsg_recv(responder);
+  if (request == NULL)
+  {
+    return;
+  }
+  char board[BOARD_NAME_MAX + 1] = "";
+  zframe_t *body = zmsg_last(request);
+  CommandHeader header;
+  if (zmsg_size(request) >= 2 && readCommandHeader(zframe_data(body), zframe_size(body), &header))
+  {
+    if (header.opcode == OP_HELLO)
+    {
+      uint8_t reply[COMMAND_FRAME_MAX];
+      size_t reply_size;
+      const char *name = (const char *)&header.payload[4];
+      size_t name_length = header.payload_length - 4;
+      if (isBoardName(name, name_length))
       {
-        zstr_send(responder, boardToCSV(&board));
+        memcpy(board, name, name_length);
+        board[name_length] = '\0';
+        reply_size = encodeWelcome(reply, startSession(readU32(header.payload), board), header.seq);
       }
       else
       {
-        parseCommand(&board, received_str);
-        /*
-        command\n
-        client_id\n
-        c,s,v
-        */
-        zstr_send(responder, "received command");
-        //}
-        // sleep(1);
+        fprintf(stderr, "ignoring hello to the board %.*s, not a board name\n", (int)name_length, name);
+        reply_size = encodeAck(reply, header.client_id, header.seq, ACK_REJECTED);
+      }
+      // the reply takes the place of the hello behind the envelope
+      zmsg_remove(request, body);
+      zframe_destroy(&body);
+      zmsg_addmem(request, reply, reply_size);
+      zmsg_send(&request, responder);
+      return;
+    }
+    if (client_table.capacity > 0 && findClientSlot(header.client_id)->used)
+    {
+      memcpy(board, findClientSlot(header.client_id)->board, sizeof(board));
+    }
+  }
+  zmsg_pushstr(request, board);
+  zmsg_send(&request, workers[boardWorker(board)].route);
+}
+
+// forwardWorkerMessages
+// send on what the workers queued on one of their PUSH sockets, replies to the ROUTER and published
+// commands to the PUB socket. returns how many workers said they are done
+int forwardWorkerMessages(zsock_t *from, zsock_t *to)
+{
+  int done = 0;
+  while (zsock_events(from) & ZMQ_POLLIN)
+  {
+    zmsg_t *message = zmsg_recv(from);
+    if (message == NULL)
+    {
+      break;
+    }
+    // replies have an envelope and published commands are never empty, so one empty frame is a worker done
+    if (zmsg_size(message) == 1 && zframe_size(zmsg_first(message)) == 0)
+    {
+      zmsg_destroy(&message);
+      done++;
+      continue;
+    }
+    zmsg_send(&message, to);
+  }
+  return done;
+}
+
+// BENCHMARKS
+// ----------
+
+// compareDoubles
+// qsort comparator for latency samples
+int compareDoubles(const void *a, const void *b)
+{
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+// benchUpdateLatencies
+// apply updates to random tiles as applyCommand does without its logging, count of them or until a
+// running snapshot is done if count is 0. prints the p50, p99 and largest latency
+int benchUpdateLatencies(Board *board, int count, const char *label)
+{
+  int capacity = count > 0 ? count : 1 << 16;
+  double *samples = malloc(capacity * sizeof(double));
+  int n = 0;
+  while (count > 0 ? n < count : !atomic_load(&snapshot_writer->done))
+  {
+    if (n == capacity)
+    {
+      capacity *= 2;
+      samples = realloc(samples, capacity * sizeof(double));
+    }
+    Command command = {.opcode = OP_UPDATE, .x = rand() % board->columns, .y = rand() % board->rows,
+                       .color_num = rand() % PALETTE_SIZE};
+    double start = nowMs();
+    *getBoardTile(board, command.y, command.x) = command.color_num;
+    board->version++;
+    recordCommand(board, &command);
+    samples[n++] = nowMs() - start;
+  }
+  qsort(samples, n, sizeof(double), compareDoubles);
+  printf("%d updates %s: p50 %.1f us, p99 %.1f us, max %.1f us\n", n, label, samples[n / 2] * 1000.0,
+         samples[(int)(n * 0.99)] * 1000.0, samples[n - 1] * 1000.0);
+  free(samples);
+  return n;
+}
+
+// runBenchmarks
+// started with ./server --bench, times the board operations on large boards without opening any sockets
+int runBenchmarks(void)
+{
+  // the store, snapshot writer and publish batch of the boards below
+  Document bench = {0};
+  bench.store.fd = -1;
+  bench.store.durability = durability;
+  bench.store.durability_ms = durability_ms;
+  useDocument(&bench);
+
+  Board board;
+  initBoard(&board);
+
+  double start = nowMs();
+  resizeBoardHeight(&board, 1000);
+  resizeBoardWidth(&board, 1000);
+  printf("resize 32x32 -> 1000x1000: %.3f ms\n", nowMs() - start);
+
+  start = nowMs();
+  for (int i = 0; i < board.rows; i++)
+  {
+    for (int j = 0; j < board.columns; j++)
+    {
+      *getBoardTile(&board, i, j) = (i + j) % 5;
+    }
+  }
+  printf("paint every tile 1000x1000: %.3f ms\n", nowMs() - start);
+
+  // count colors 10 times over so the number is not just noise, bulk scans sweep the chunk pool
+  start = nowMs();
+  long color_counts[5] = {0};
+  for (int pass = 0; pass < 10; pass++)
+  {
+    for (size_t i = 0; i < (size_t)board.chunk_count * CHUNK_AREA; i++)
+    {
+      color_counts[board.chunk_colors[i]]++;
+    }
+  }
+  printf("scan 1000x1000 x10: %.3f ms (%ld tiles of color 0)\n", nowMs() - start, color_counts[0]);
+
+  start = nowMs();
+  resizeBoardWidth(&board, 500);
+  resizeBoardHeight(&board, 500);
+  resizeBoardHeight(&board, 1000);
+  resizeBoardWidth(&board, 1000);
+  printf("resize 1000x1000 -> 500x500 -> 1000x1000: %.3f ms\n", nowMs() - start);
+
+  // a huge board where only a few scattered tiles are painted
+  resizeBoardHeight(&board, MAX_BOARD_DIMENSION);
+  resizeBoardWidth(&board, MAX_BOARD_DIMENSION);
+  start = nowMs();
+  for (int i = 0; i < 10000; i++)
+  {
+    *getBoardTile(&board, rand() % board.rows, rand() % board.columns) = 1 + rand() % 4;
+  }
+  printf("paint 10000 scattered tiles 100000x100000: %.3f ms (%d chunks, %zu KB)\n", nowMs() - start,
+         board.chunk_count, (size_t)board.chunk_count * CHUNK_AREA / 1024);
+
+  // fetch latency is dominated by boardToCSV, time it for growing fully painted boards
+  // and for the sparse board above
+  start = nowMs();
+  size_t csv_length;
+  char *csv = boardToCSV(&board, &csv_length, NULL);
+  printf("boardToCSV 100000x100000 with %d chunks: %.3f ms (%zu bytes)\n", board.chunk_count, nowMs() - start,
+         csv_length);
+  free(csv);
+  start = nowMs();
+  size_t snapshot_length;
+  uint8_t *snapshot = boardToSnapshot(&board, &snapshot_length);
+  printf("boardToSnapshot 100000x100000 with %d chunks: %.3f ms (%zu bytes)\n", board.chunk_count,
+         nowMs() - start, snapshot_length);
+  free(snapshot);
+  int fetch_sizes[] = {100, 250, 500, 1000, 2000};
+  for (int s = 0; s < 5; s++)
+  {
+    int size = fetch_sizes[s];
+    resizeBoardHeight(&board, 1);
+    resizeBoardWidth(&board, 1);
+    resizeBoardHeight(&board, size);
+    resizeBoardWidth(&board, size);
+    for (int i = 0; i < size; i++)
+    {
+      for (int j = 0; j < size; j++)
+      {
+        *getBoardTile(&board, i, j) = (i * 7 + j) % 5;
+      }
+    }
+    start = nowMs();
+    csv = boardToCSV(&board, &csv_length, NULL);
+    printf("boardToCSV %dx%d: %.3f ms (%zu bytes)\n", size, size, nowMs() - start, csv_length);
+    free(csv);
+    start = nowMs();
+    snapshot = boardToSnapshot(&board, &snapshot_length);
+    printf("boardToSnapshot %dx%d: %.3f ms (%zu bytes)\n", size, size, nowMs() - start, snapshot_length);
+    free(snapshot);
+  }
+
+  // 200 clients fetching the 2000x2000 board, with a single tile update between every fetch
+  for (int f = 0; f < 2; f++)
+  {
+    FetchFormat format = f == 0 ? FETCH_CSV : FETCH_SNAPSHOT;
+    start = nowMs();
+    for (int i = 0; i < 200; i++)
+    {
+      getFetchReply(&board, format);
+      int x = rand() % board.columns;
+      int y = rand() % board.rows;
+      int color_num = rand() % PALETTE_SIZE;
+      // what applyCommand does for an update, without its logging
+      *getBoardTile(&board, y, x) = color_num;
+      board.version++;
+      patchFetchCaches(&board, x, y, color_num);
+    }
+    printf("200 %s fetches 2000x2000 with an update between each: %.3f ms\n", f == 0 ? "CSV" : "snapshot",
+           nowMs() - start);
+  }
+
+  // a client that missed 100 updates catching up with fetch_since instead of a snapshot of the 2000x2000 board
+  for (int i = 0; i < 100; i++)
+  {
+    Command command = {.opcode = OP_UPDATE, .x = rand() % board.columns, .y = rand() % board.rows, .color_num = 1};
+    *getBoardTile(&board, command.y, command.x) = command.color_num;
+    board.version++;
+    recordCommand(&board, &command);
+  }
+  start = nowMs();
+  SharedBuffer *delta = getDeltaReply(&board, board.version - 100);
+  double delta_ms = nowMs() - start;
+  printf("fetch_since 100 updates ago 2000x2000: %.3f ms (%zu bytes, snapshot %zu bytes)\n", delta_ms, delta->size,
+         getFetchReply(&board, FETCH_SNAPSHOT)->size);
+  releaseSharedBuffer(delta);
+
+  // 50 painters each scribbling over their own 16x16 patch of the board, published in ticks of
+  // tick_ops updates. every update used to be its own message
+  initPublishBatch("");
+  start = nowMs();
+  for (int i = 0; i < 100000; i++)
+  {
+    int painter = i % 50;
+    Command command = {.opcode = OP_UPDATE, .client_id = painter, .color_num = rand() % PALETTE_SIZE};
+    command.x = (painter % 10) * 16 + rand() % 16;
+    command.y = (painter / 10) * 16 + rand() % 16;
+    *getBoardTile(&board, command.y, command.x) = command.color_num;
+    board.version++;
+    recordCommand(&board, &command);
+    queuePublishUpdate(command.client_id, command.x, command.y, command.color_num, command.seq);
+  }
+  flushPublishBatch();
+  printf("%lu updates from 50 painters in ticks of %d: %.3f ms, %lu messages with %lu updates\n",
+         (unsigned long)publish_batch->updates_queued, tick_ops, nowMs() - start,
+         (unsigned long)publish_batch->messages_published, (unsigned long)publish_batch->updates_published);
+
+  // a 100x100 area filled with an update per tile, then with one OP_FILL_RECT. replaying keeps
+  // applyCommand quiet
+  store->replaying = true;
+  uint64_t messages_before = publish_batch->messages_published;
+  start = nowMs();
+  for (int i = 0; i < 10000; i++)
+  {
+    Command command = {.opcode = OP_UPDATE, .x = 300 + i % 100, .y = 300 + i / 100, .color_num = 2};
+    applyCommand(&board, &command);
+    publishCommand(&board, &command, NULL);
+  }
+  flushPublishBatch();
+  printf("fill 100x100 with 10000 updates: %.3f ms, %lu messages\n", nowMs() - start,
+         (unsigned long)(publish_batch->messages_published - messages_before));
+  messages_before = publish_batch->messages_published;
+  start = nowMs();
+  Command rect = {.opcode = OP_FILL_RECT, .x = 300, .y = 300, .x1 = 399, .y1 = 399, .color_num = 3};
+  applyCommand(&board, &rect);
+  publishCommand(&board, &rect, NULL);
+  flushPublishBatch();
+  printf("fill 100x100 with one rect: %.3f ms, %lu message of %d bytes\n", nowMs() - start,
+         (unsigned long)(publish_batch->messages_published - messages_before), COMMAND_HEADER_SIZE + 16);
+  // a second of fast strokes from 50 painters, a line every frame from each, published in ticks under the
+  // regions they cross. every line used to be a message to every client
+  messages_before = publish_batch->messages_published;
+  start = nowMs();
+  for (int frame = 0; frame < 60; frame++)
+  {
+    for (int painter = 0; painter < 50; painter++)
+    {
+      int x = (painter % 10) * 100 + frame;
+      int y = (painter / 10) * 200;
+      Command line = {.opcode = OP_LINE, .client_id = painter, .x = x, .y = y, .x1 = x + 1, .y1 = y + 20,
+                      .color_num = 4};
+      applyCommand(&board, &line);
+      publishCommand(&board, &line, NULL);
+    }
+    if (nowMs() >= publish_batch->deadline)
+    {
+      flushPublishBatch();
+    }
+  }
+  flushPublishBatch();
+  printf("3000 stroke lines from 50 painters: %.3f ms, %lu region messages\n", nowMs() - start,
+         (unsigned long)(publish_batch->messages_published - messages_before));
+  // a line across the largest board goes to the regions it paints in, one or two per region row, not to every
+  // region of its bounding box
+  int rows = board.rows;
+  int columns = board.columns;
+  Command grow = {.opcode = OP_RESIZE, .rows = MAX_BOARD_DIMENSION, .columns = MAX_BOARD_DIMENSION};
+  applyCommand(&board, &grow);
+  messages_before = publish_batch->messages_published;
+  start = nowMs();
+  Command diagonal = {.opcode = OP_LINE, .x = 0, .y = 0, .x1 = MAX_BOARD_DIMENSION - 1,
+                      .y1 = MAX_BOARD_DIMENSION - 1, .color_num = 4};
+  applyCommand(&board, &diagonal);
+  publishCommand(&board, &diagonal, NULL);
+  flushPublishBatch();
+  printf("line across %dx%d: %.3f ms, %lu region messages\n", MAX_BOARD_DIMENSION, MAX_BOARD_DIMENSION,
+         nowMs() - start, (unsigned long)(publish_batch->messages_published - messages_before));
+  Command shrink = {.opcode = OP_RESIZE, .rows = rows, .columns = columns};
+  applyCommand(&board, &shrink);
+  // the same circles and lines drawn over a cleared 2000x2000 board, then the area around the top left
+  // corner flood filled, 4-connected fills stop at the diagonal steps of the lines
+  for (int connectivity = 4; connectivity <= 8; connectivity += 4)
+  {
+    srand(1);
+    start = nowMs();
+    Command clear = {.opcode = OP_FILL_RECT, .x = 0, .y = 0, .x1 = 1999, .y1 = 1999, .color_num = 0};
+    applyCommand(&board, &clear);
+    double clear_ms = nowMs() - start;
+    start = nowMs();
+    for (int i = 0; i < 200; i++)
+    {
+      Command circle = {.opcode = OP_FILL_CIRCLE, .x = rand() % 2000, .y = rand() % 2000, .radius = 8,
+                        .color_num = 1};
+      applyCommand(&board, &circle);
+      Command line = {.opcode = OP_LINE, .x = rand() % 2000, .y = rand() % 2000, .x1 = rand() % 2000,
+                      .y1 = rand() % 2000, .color_num = 1};
+      applyCommand(&board, &line);
+    }
+    double shapes_ms = nowMs() - start;
+    if (connectivity == 4)
+    {
+      printf("fill 2000x2000 with one rect: %.3f ms, 200 circles of radius 8 and 200 lines: %.3f ms\n", clear_ms,
+             shapes_ms);
+    }
+    messages_before = publish_batch->messages_published;
+    start = nowMs();
+    Command flood = {.opcode = OP_FLOOD_FILL, .color_num = 2, .connectivity = connectivity};
+    while (getBoardColor(&board, flood.y, flood.x) == 1)
+    {
+      flood.x++;
+    }
+    applyCommand(&board, &flood);
+    double fill_ms = nowMs() - start;
+    int64_t painted = 0;
+    for (int i = 0; i < fill_span_count; i++)
+    {
+      painted += fill_spans[i].x1 - fill_spans[i].x0 + 1;
+    }
+    publishCommand(&board, &flood, NULL);
+    printf("%d-connected flood fill of %ld tiles in 2000x2000: %.3f ms, %d runs, published in %.3f ms as %lu "
+           "messages\n", connectivity, (long)painted, fill_ms, fill_span_count, nowMs() - start - fill_ms,
+           (unsigned long)(publish_batch->messages_published - messages_before));
+  }
+  store->replaying = false;
+  freePublishBatch();
+  freeFillBuffers();
+  freeBoard(&board);
+
+  // 200000 updates logged to a scratch store in every durability mode, the main thread only queues
+  // them, then the same updates with a write and fdatasync each as the store would without group commit
+  char store_path[] = "/tmp/tile-store-benchXXXXXX";
+  int scratch_fd = mkstemp(store_path);
+  if (scratch_fd < 0)
+  {
+    fprintf(stderr, "error creating a scratch store: %s\n", strerror(errno));
+    return 1;
+  }
+  close(scratch_fd);
+  store->path = store_path;
+  const char *mode_names[] = {"always", "every 10 ms", "off"};
+  for (int mode = DURABILITY_ALWAYS; mode <= DURABILITY_OFF; mode++)
+  {
+    truncate(store_path, 0);
+    size_t length;
+    free(openStore(STORE_HEADER_SIZE, &length));
+    store->durability = mode;
+    store->records_written = store->bytes_written = store->writes = store->syncs = store->stalls = 0;
+    startStore(0);
+    start = nowMs();
+    Command resize = {.opcode = OP_RESIZE, .seq = 1, .rows = 1000, .columns = 1000};
+    storeCommand(&resize);
+    for (uint32_t seq = 2; seq <= 200001; seq++)
+    {
+      Command command = {.opcode = OP_UPDATE, .seq = seq, .x = rand() % 1000, .y = rand() % 1000, .color_num = 1};
+      storeCommand(&command);
+    }
+    double queued_ms = nowMs() - start;
+    stopStore();
+    printf("store 200000 updates, durability %s: queued in %.3f ms, on disk after %.3f ms, %lu writes, "
+           "%lu syncs\n", mode_names[mode], queued_ms, nowMs() - start, store->writes, store->syncs);
+  }
+  Board replayed;
+  initBoard(&replayed);
+  replayStore(&replayed, 0);
+  close(store->fd);
+  freeBoard(&replayed);
+
+  int sync_fd = open(store_path, O_WRONLY | O_TRUNC | O_APPEND);
+  start = nowMs();
+  for (int i = 0; i < 2000; i++)
+  {
+    uint8_t frame[COMMAND_FRAME_MAX];
+    writeAll(sync_fd, frame, encodeUpdate(frame, 0, i + 1, i % 1000, i / 1000, 1), store_path);
+    fdatasync(sync_fd);
+  }
+  printf("2000 updates with a write and fdatasync each: %.3f ms\n", nowMs() - start);
+  close(sync_fd);
+  unlink(store_path);
+
+  // a fully painted 10M tile board in a scratch board file, closed and mapped again as on a restart
+  char map_path[] = "/tmp/tile-map-benchXXXXXX";
+  close(mkstemp(map_path));
+  Board mapped;
+  initBoard(&mapped);
+  openBoardFile(&mapped, map_path);
+  resizeBoardHeight(&mapped, 3163);
+  resizeBoardWidth(&mapped, 3163);
+  for (int i = 0; i < mapped.rows; i++)
+  {
+    for (int j = 0; j < mapped.columns; j++)
+    {
+      *getBoardTile(&mapped, i, j) = (i + j) % PALETTE_SIZE;
+    }
+  }
+  start = nowMs();
+  closeBoardFile(&mapped, 0);
+  printf("close board file 3163x3163: %.3f ms\n", nowMs() - start);
+  freeBoard(&mapped);
+  initBoard(&mapped);
+  start = nowMs();
+  openBoardFile(&mapped, map_path);
+  printf("map board file 3163x3163: %.3f ms\n", nowMs() - start);
+  start = nowMs();
+  getFetchReply(&mapped, FETCH_SNAPSHOT);
+  printf("first snapshot fetch after mapping 3163x3163: %.3f ms\n", nowMs() - start);
 
+  // single updates on the same 10M tile board without a snapshot, while a background snapshot of it is
+  // written and what writing that snapshot inline stalls the command loop for
+  char snapshot_path[] = "/tmp/tile-snapshot-benchXXXXXX";
+  close(mkstemp(snapshot_path));
+  snapshot_writer->path = snapshot_path;
+  benchUpdateLatencies(&mapped, 200000, "without a snapshot");
+  startSnapshot(&mapped);
+  benchUpdateLatencies(&mapped, 0, "during a background snapshot 3163x3163");
+  finishSnapshot(true);
+  start = nowMs();
+  snapshot = boardToSnapshot(&mapped, &snapshot_length);
+  int inline_fd = open(snapshot_path, O_WRONLY | O_TRUNC);
+  writeAll(inline_fd, snapshot, snapshot_length, snapshot_path);
+  fdatasync(inline_fd);
+  close(inline_fd);
+  free(snapshot);
+  printf("inline snapshot 3163x3163, the command loop would stall for: %.3f ms\n", nowMs() - start);
+  freeBoard(&mapped);
+  unlink(map_path);
+  unlink(snapshot_path);
+
+  // 200 named boards in a scratch boards dir with 1000 updates each, closed as an idle board is evicted and
+  // loaded again as the next request for it does
+  char scratch_dir[] = "/tmp/tile-boards-benchXXXXXX";
+  if (mkdtemp(scratch_dir) == NULL)
+  {
+    fprintf(stderr, "error creating a scratch boards dir: %s\n", strerror(errno));
+    return 1;
+  }
+  boards_dir = scratch_dir;
+  durability = DURABILITY_INTERVAL;
+  Document *documents[200];
+  // every board prints a line or two as it opens and closes
+  fflush(stdout);
+  int saved_stdout = dup(STDOUT_FILENO);
+  int null_fd = open("/dev/null", O_WRONLY);
+  double phase_ms[3];
+  for (int phase = 0; phase < 3; phase++)
+  {
+    dup2(null_fd, STDOUT_FILENO);
+    start = nowMs();
+    for (int d = 0; d < 200; d++)
+    {
+      char name[16];
+      snprintf(name, sizeof(name), "bench-%d", d);
+      if (phase != 1)
+      {
+        documents[d] = openDocument(name);
+      }
+      if (phase == 0)
+      {
+        for (int i = 0; i < 1000; i++)
+        {
+          Command command = {.opcode = OP_UPDATE, .x = rand() % INIT_COLUMNS, .y = rand() % INIT_ROWS,
+                             .color_num = rand() % PALETTE_SIZE};
+          applyCommand(&documents[d]->board, &command);
+        }
+      }
+      if (phase != 0)
+      {
+        closeDocument(documents[d]);
       }
-      zstr_free(&received_str);
     }
+    fflush(stdout);
+    dup2(saved_stdout, STDOUT_FILENO);
+    phase_ms[phase] = nowMs() - start;
+  }
+  close(null_fd);
+  close(saved_stdout);
+  printf("200 new boards with 1000 updates each: %.3f ms, evicting them: %.3f ms, loading them again and "
+         "evicting: %.3f ms\n", phase_ms[0], phase_ms[1], phase_ms[2]);
+  for (int d = 0; d < 200; d++)
+  {
+    const char *extensions[] = {".db", ".map", ".tsnf"};
+    for (int e = 0; e < 3; e++)
+    {
+      char path[128];
+      snprintf(path, sizeof(path), "%s/bench-%d%s", scratch_dir, d, extensions[e]);
+      unlink(path);
+    }
+  }
+  rmdir(scratch_dir);
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  for (int i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "--bench") == 0)
+    {
+      return runBenchmarks();
+    }
+    if (strcmp(argv[i], "--text-pub") == 0)
+    {
+      text_pub = true;
+    }
+    if (strcmp(argv[i], "--tick-ms") == 0 && i + 1 < argc)
+    {
+      tick_ms = atoi(argv[++i]);
+    }
+    if (strcmp(argv[i], "--tick-ops") == 0 && i + 1 < argc)
+    {
+      tick_ops = atoi(argv[++i]);
+    }
+    if (strcmp(argv[i], "--stats-s") == 0 && i + 1 < argc)
+    {
+      stats_s = atoi(argv[++i]);
+    }
+    if (strcmp(argv[i], "--store") == 0 && i + 1 < argc)
+    {
+      store_path = argv[++i];
+    }
+    if (strcmp(argv[i], "--durability") == 0 && i + 1 < argc)
+    {
+      parseDurability(argv[++i]);
+    }
+    if (strcmp(argv[i], "--board-file") == 0 && i + 1 < argc)
+    {
+      board_file_path = argv[++i];
+    }
+    if (strcmp(argv[i], "--msync-ms") == 0 && i + 1 < argc)
+    {
+      msync_ms = atoi(argv[++i]);
+    }
+    if (strcmp(argv[i], "--snapshot") == 0 && i + 1 < argc)
+    {
+      snapshot_path = argv[++i];
+    }
+    if (strcmp(argv[i], "--snapshot-s") == 0 && i + 1 < argc)
+    {
+      snapshot_s = atoi(argv[++i]);
+    }
+    if (strcmp(argv[i], "--boards-dir") == 0 && i + 1 < argc)
+    {
+      boards_dir = argv[++i];
+    }
+    if (strcmp(argv[i], "--evict-s") == 0 && i + 1 < argc)
+    {
+      evict_s = atoi(argv[++i]);
+    }
+    if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc)
+    {
+      worker_count = atoi(argv[++i]);
+    }
+  }
+  if (tick_ops < 1 || tick_ops > PUBLISH_BATCH_MAX)
+  {
+    tick_ops = PUBLISH_BATCH_MAX;
+  }
+  if (worker_count < 1)
+  {
+    worker_count = sysconf(_SC_NPROCESSORS_ONLN) > 0 ? sysconf(_SC_NPROCESSORS_ONLN) : 1;
+  }
+  if (mkdir(boards_dir, 0755) != 0 && errno != EEXIST)
+  {
+    fprintf(stderr, "error creating %s: %s\n", boards_dir, strerror(errno));
+    return 1;
+  }
+
+  // exit program on ctrl-c
+  if (signal(SIGINT, handleSigint) == SIG_ERR)
+  {
+    printf("error setting up signal handler \n");
+    return 1;
+  }
+
+  responder = zsock_new(ZMQ_ROUTER);
+  int rc = zsock_bind(responder, "tcp://*:5555");
+  assert(rc == 5555);
+  printf("tcp router listening on 5555 \n");
+
+  // publisher socket
+  publisher = zsock_new_pub("tcp://*:5556");
+  if (!publisher)
+  {
+    printf("Error: Unable to create publisher socket\n");
+    return 1;
+  }
+  printf("tcp pub-sub listening on 5556%s\n", text_pub ? ", publishing text commands" : "");
+
+  // the workers push their replies and published commands to the main thread
+  zsock_t *replies = newInprocSocket(ZMQ_PULL, "@inproc://worker-replies");
+  zsock_t *published = newInprocSocket(ZMQ_PULL, "@inproc://worker-publish");
+  // only the main thread takes SIGINT, the workers and the threads they start inherit the blocked mask
+  sigset_t sigint_mask;
+  sigset_t old_mask;
+  sigemptyset(&sigint_mask);
+  sigaddset(&sigint_mask, SIGINT);
+  pthread_sigmask(SIG_BLOCK, &sigint_mask, &old_mask);
+  workers = (Worker *)calloc(worker_count, sizeof(Worker));
+  if (workers == NULL)
+  {
+    fprintf(stderr, "error calloc workers\n");
+    return 1;
+  }
+  for (int w = 0; w < worker_count; w++)
+  {
+    char endpoint[64];
+    snprintf(endpoint, sizeof(endpoint), "@inproc://worker-%d", w);
+    workers[w].route = newInprocSocket(ZMQ_PUSH, endpoint);
+    endpoint[0] = '>';
+    workers[w].requests = newInprocSocket(ZMQ_PULL, endpoint);
+    if (pthread_create(&workers[w].thread, NULL, runWorker, &workers[w]) != 0)
+    {
+      fprintf(stderr, "error starting worker %d\n", w);
+      return 1;
+    }
+  }
+  pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+  printf("serving boards on %d workers, named boards in %s/\n", worker_count, boards_dir);
+
+  zpoller_t *poller = zpoller_new(responder, replies, published, NULL);
+  while (keep_running)
+  {
+    zpoller_wait(poller, -1);
+    // route the requests that queued up while we were busy, but keep the replies flowing
+    for (int routed = 0; routed < WORKER_DRAIN_MAX && keep_running && (zsock_events(responder) & ZMQ_POLLIN);
+         routed++)
+    {
+      routeRequest();
+    }
+    forwardWorkerMessages(replies, responder);
+    forwardWorkerMessages(published, publisher);
+  }
+  zpoller_destroy(&poller);
+  // the workers close their boards and say when everything they sent is on its way
+  for (int w = 0; w < worker_count; w++)
+  {
+    zstr_send(workers[w].route, "");
+  }
+  poller = zpoller_new(replies, published, NULL);
+  int done = 0;
+  while (done < 2 * worker_count)
+  {
+    zpoller_wait(poller, 100);
+    done += forwardWorkerMessages(replies, responder);
+    done += forwardWorkerMessages(published, publisher);
+  }
+  zpoller_destroy(&poller);
+  for (int w = 0; w < worker_count; w++)
+  {
+    pthread_join(workers[w].thread, NULL);
+    zsock_destroy(&workers[w].route);
+    zsock_destroy(&workers[w].requests);
   }
+  free(workers);
+  freeClientTable();
   printf("server stopped gracefully\n");
+  zsock_destroy(&replies);
+  zsock_destroy(&published);
   zsock_destroy(&responder);
+  zsock_destroy(&publisher);
 
   return 0;
 }